@@ -0,0 +1,60 @@
+# Bitwise CRC-32 (reflected, polynomial 0xedb88320) of a 4K buffer of pseudo-random bytes, each pass continues from
+# the CRC of the one before
+# Exit code: -1329770772
+
+    .equ BUFFER, 0x80040000
+    .equ SIZE, 4096
+    .equ PASSES, 1024
+
+    .text
+_start:
+    li sp, 0x80100000
+
+    # Linear congruential generator, the byte is taken from bits 16 to 23
+    li t0, BUFFER
+    li t1, SIZE
+    li t2, 12345
+    li t3, 1103515245
+    li t5, 12345
+fill:
+    mul t2, t2, t3
+    add t2, t2, t5
+    srli t4, t2, 16
+    sb t4, 0(t0)
+    addi t0, t0, 1
+    addi t1, t1, -1
+    bnez t1, fill
+
+    li s1, PASSES
+    li a0, -1
+repeat:
+    li a1, BUFFER
+    li a2, SIZE
+    call crc32
+    addi s1, s1, -1
+    bnez s1, repeat
+    not a0, a0
+    li t0, 0x11100000
+    sw a0, 0(t0)
+hang:
+    j hang
+
+# a0 = CRC of a2 bytes at a1 starting from a0, without the final inversion
+crc32:
+    li a5, 0xedb88320
+    add a2, a1, a2
+byte:
+    lbu a3, 0(a1)
+    xor a0, a0, a3
+    li a4, 8
+bit:
+    andi a3, a0, 1
+    neg a3, a3
+    and a3, a3, a5
+    srli a0, a0, 1
+    xor a0, a0, a3
+    addi a4, a4, -1
+    bnez a4, bit
+    addi a1, a1, 1
+    bne a1, a2, byte
+    ret
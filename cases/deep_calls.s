@@ -0,0 +1,24 @@
+# Recursion a million calls deep, far more than the host stack holds as nested calls. Returns the depth
+# Exit code: 1000000
+
+    .text
+_start:
+    li sp, 0x83f00000
+    li a0, 1000000
+    call depth
+    li t0, 0x11100000
+    sw a0, 0(t0)
+
+# Recurses a0 times, returns the depth
+depth:
+    beqz a0, leaf
+    addi sp, sp, -16
+    sw ra, 12(sp)
+    addi a0, a0, -1
+    call depth
+    addi a0, a0, 1
+    lw ra, 12(sp)
+    addi sp, sp, 16
+    ret
+leaf:
+    ret
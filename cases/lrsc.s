@@ -0,0 +1,66 @@
+# LR.W and SC.W reservations. Bit n of the low byte is set if SC.W failed in case n: 0 with nothing in between, 1 after
+# a store of the same value, 2 after a store to another word of the granule, 3 to another address than LR.W's, 4
+# without LR.W, 5 after an AMO leaving the word as it was. The count of 100 increments follows from bit 8.
+# Exit code: 25662
+
+    .equ WORD, 0x80040000
+
+    .text
+_start:
+    li t0, WORD
+    li s0, 0
+
+    # 0: succeeds
+    lr.w t1, (t0)
+    sc.w t2, t1, (t0)
+    or s0, s0, t2
+
+    # 1: a store of the same value
+    lr.w t1, (t0)
+    sw t1, 0(t0)
+    sc.w t2, t1, (t0)
+    slli t2, t2, 1
+    or s0, s0, t2
+
+    # 2: a store to the same granule
+    lr.w t1, (t0)
+    sw zero, 32(t0)
+    sc.w t2, t1, (t0)
+    slli t2, t2, 2
+    or s0, s0, t2
+
+    # 3: another address
+    addi t3, t0, 4
+    lr.w t1, (t0)
+    sc.w t2, t1, (t3)
+    slli t2, t2, 3
+    or s0, s0, t2
+
+    # 4: no reservation, the failed SC.W dropped it
+    sc.w t2, t1, (t0)
+    slli t2, t2, 4
+    or s0, s0, t2
+
+    # 5: an AMO that doesn't change the word
+    lr.w t1, (t0)
+    amoadd.w zero, zero, (t0)
+    sc.w t2, t1, (t0)
+    slli t2, t2, 5
+    or s0, s0, t2
+
+    # Increments retried until SC.W succeeds
+    sw zero, 0(t0)
+    li s1, 100
+increment:
+    lr.w t1, (t0)
+    addi t1, t1, 1
+    sc.w t2, t1, (t0)
+    bnez t2, increment
+    addi s1, s1, -1
+    bnez s1, increment
+    lw t1, 0(t0)
+    slli t1, t1, 8
+    or a0, s0, t1
+
+    li t0, 0x11100000
+    sw a0, 0(t0)
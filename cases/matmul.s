@@ -0,0 +1,85 @@
+# Product of two 32x32 matrices of words, A[i][j] = i + j and B[i][j] = i - j. Returns the sum of the elements of the
+# product
+# Exit code: 2793472
+
+    .equ N, 32
+    .equ A, 0x80040000
+    .equ B, A + N * N * 4
+    .equ C, B + N * N * 4
+    .equ PASSES, 512
+
+    .text
+_start:
+    li sp, 0x80100000
+
+    li t0, A
+    li t1, B
+    li t2, 0
+init_row:
+    li t3, 0
+init_column:
+    add t4, t2, t3
+    sw t4, 0(t0)
+    sub t4, t2, t3
+    sw t4, 0(t1)
+    addi t0, t0, 4
+    addi t1, t1, 4
+    addi t3, t3, 1
+    li t4, N
+    bne t3, t4, init_column
+    addi t2, t2, 1
+    bne t2, t4, init_row
+
+    li s1, PASSES
+repeat:
+    li a0, A
+    li a1, B
+    li a2, C
+    call matmul
+    addi s1, s1, -1
+    bnez s1, repeat
+
+    li t0, C
+    li t1, N * N
+    li a0, 0
+checksum:
+    lw t2, 0(t0)
+    add a0, a0, t2
+    addi t0, t0, 4
+    addi t1, t1, -1
+    bnez t1, checksum
+    li t0, 0x11100000
+    sw a0, 0(t0)
+hang:
+    j hang
+
+# a2 = a0 * a1, all N x N in row-major order
+matmul:
+    li t6, N
+    li t0, 0
+row:
+    li t1, 0
+column:
+    # a3 walks row t0 of A, a4 column t1 of B
+    slli a3, t0, 7
+    add a3, a0, a3
+    slli a4, t1, 2
+    add a4, a1, a4
+    li t2, N
+    li t3, 0
+dot:
+    lw t4, 0(a3)
+    lw t5, 0(a4)
+    mul t4, t4, t5
+    add t3, t3, t4
+    addi a3, a3, 4
+    addi a4, a4, N * 4
+    addi t2, t2, -1
+    bnez t2, dot
+    sw t3, 0(a2)
+    addi a2, a2, 4
+    addi t1, t1, 1
+    bne t1, t6, column
+    addi t0, t0, 1
+    bne t0, t6, row
+    ret
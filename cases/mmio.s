@@ -0,0 +1,23 @@
+# Devices reached through pointers loaded from memory, which the translation can't tell from RAM pointers. Writes
+# mtimecmp and reads it back, then adds the transmitter bits of the UART line status and powers off through SYSCON.
+# Exit code: 1330
+
+    .text
+_start:
+    la t0, devices
+    lw s0, 0(t0)
+    lw s1, 4(t0)
+    li t1, 1234
+    sw t1, 0(s1)
+    lw a0, 0(s1)
+    lbu t1, 5(s0)
+    andi t1, t1, 0x60
+    add a0, a0, t1
+    lw t0, 8(t0)
+    sw a0, 0(t0)
+
+    .data
+devices:
+    .word 0x10000000 # UART
+    .word 0x11004000 # mtimecmp of hart 0
+    .word 0x11100000 # SYSCON
@@ -0,0 +1,40 @@
+# Naive recursive Fibonacci, a call and a stack frame per number
+# Exit code: 46368
+
+    .equ PASSES, 40
+
+    .text
+_start:
+    li sp, 0x80100000
+    li s1, PASSES
+repeat:
+    li a0, 24
+    call fib
+    addi s1, s1, -1
+    bnez s1, repeat
+    li t0, 0x11100000
+    sw a0, 0(t0)
+hang:
+    j hang
+
+# a0 = fib(a0)
+fib:
+    li t0, 2
+    blt a0, t0, fib_ret
+    addi sp, sp, -16
+    sw ra, 12(sp)
+    sw s0, 8(sp)
+    sw s1, 4(sp)
+    mv s0, a0
+    addi a0, a0, -1
+    call fib
+    mv s1, a0
+    addi a0, s0, -2
+    call fib
+    add a0, a0, s1
+    lw ra, 12(sp)
+    lw s0, 8(sp)
+    lw s1, 4(sp)
+    addi sp, sp, 16
+fib_ret:
+    ret
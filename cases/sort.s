@@ -0,0 +1,76 @@
+# Insertion sort of 1024 pseudo-random numbers below 65536, refilled for every pass. Returns the median of the last
+# pass or -1 if it isn't sorted
+# Exit code: 32015
+
+    .equ ARRAY, 0x80040000
+    .equ COUNT, 1024
+    .equ PASSES, 64
+
+    .text
+_start:
+    li sp, 0x80100000
+    li s1, PASSES
+    li s2, 12345
+repeat:
+    # Linear congruential generator carried over the passes, the number is taken from bits 16 to 31
+    li t0, ARRAY
+    li t1, COUNT
+    li t3, 1103515245
+    li t5, 12345
+fill:
+    mul s2, s2, t3
+    add s2, s2, t5
+    srli t4, s2, 16
+    sw t4, 0(t0)
+    addi t0, t0, 4
+    addi t1, t1, -1
+    bnez t1, fill
+
+    li a0, ARRAY
+    li a1, COUNT
+    call sort
+    addi s1, s1, -1
+    bnez s1, repeat
+
+    li t0, ARRAY
+    li t1, COUNT - 1
+check:
+    lw t2, 0(t0)
+    lw t3, 4(t0)
+    blt t3, t2, unsorted
+    addi t0, t0, 4
+    addi t1, t1, -1
+    bnez t1, check
+    li t0, ARRAY + COUNT / 2 * 4
+    lw a0, 0(t0)
+    j done
+unsorted:
+    li a0, -1
+done:
+    li t0, 0x11100000
+    sw a0, 0(t0)
+hang:
+    j hang
+
+# Sorts the a1 words at a0 in ascending order
+sort:
+    slli a1, a1, 2
+    add a1, a0, a1
+    addi a2, a0, 4
+outer:
+    bgeu a2, a1, sorted
+    lw a3, 0(a2)
+    mv a4, a2
+inner:
+    beq a4, a0, insert
+    lw a5, -4(a4)
+    bge a3, a5, insert
+    sw a5, 0(a4)
+    addi a4, a4, -4
+    j inner
+insert:
+    sw a3, 0(a4)
+    addi a2, a2, 4
+    j outer
+sorted:
+    ret
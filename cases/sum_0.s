@@ -0,0 +1,31 @@
+# sum() of sum_0.c: adds the five codes
+# Exit code: 255
+
+    .text
+_start:
+    li sp, 0x80100000
+    li s1, 10000000
+repeat:
+    call sum
+    addi s1, s1, -1
+    bnez s1, repeat
+    li t0, 0x11100000
+    sw a0, 0(t0)
+hang:
+    j hang
+
+sum:
+    la a5, codes
+    addi a3, a5, 5
+    li a0, 0
+loop:
+    lbu a4, 0(a5)
+    addi a5, a5, 1
+    add a0, a0, a4
+    bne a5, a3, loop
+    ret
+
+    .rodata
+codes:
+    .byte '1', '2', '3', '4', '5'
+    .align 2
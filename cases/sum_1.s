@@ -0,0 +1,55 @@
+# sum() of sum_1.c: a switch over the five codes compiled to a jump table
+# Exit code: 15
+
+    .text
+_start:
+    li sp, 0x80100000
+    li s1, 1000000
+repeat:
+    call sum
+    addi s1, s1, -1
+    bnez s1, repeat
+    li t0, 0x11100000
+    sw a0, 0(t0)
+hang:
+    j hang
+
+sum:
+    la a5, codes
+    addi a2, a5, 5
+    li a0, 0
+    la a3, table
+loop:
+    lbu a4, 0(a5)
+    addi a4, a4, -'1'
+    li a1, 4
+    bltu a1, a4, next
+    slli a4, a4, 2
+    add a4, a4, a3
+    lw a4, 0(a4)
+    jr a4
+case1:
+    addi a0, a0, 1
+    j next
+case2:
+    addi a0, a0, 2
+    j next
+case3:
+    addi a0, a0, 3
+    j next
+case4:
+    addi a0, a0, 4
+    j next
+case5:
+    addi a0, a0, 5
+next:
+    addi a5, a5, 1
+    bne a5, a2, loop
+    ret
+
+    .rodata
+table:
+    .word case1, case2, case3, case4, case5
+codes:
+    .byte '1', '2', '3', '4', '5'
+    .align 2
@@ -0,0 +1,90 @@
+# sum() of sum_2.c without optimizations: adds the codes that are prime, isPrime() divides by every smaller number
+# Exit code: 53
+
+    .text
+_start:
+    li sp, 0x80100000
+    li s1, 100000
+repeat:
+    call sum
+    addi s1, s1, -1
+    bnez s1, repeat
+    li t0, 0x11100000
+    sw a0, 0(t0)
+hang:
+    j hang
+
+isPrime:
+    addi sp, sp, -32
+    sw s0, 28(sp)
+    addi s0, sp, 32
+    sw a0, -20(s0)
+    li a5, 2
+    sw a5, -24(s0)
+    j ip_cond
+ip_body:
+    lw a4, -20(s0)
+    lw a5, -24(s0)
+    rem a5, a4, a5
+    bnez a5, ip_inc
+    li a5, 0
+    j ip_ret
+ip_inc:
+    lw a5, -24(s0)
+    addi a5, a5, 1
+    sw a5, -24(s0)
+ip_cond:
+    lw a4, -24(s0)
+    lw a5, -20(s0)
+    blt a4, a5, ip_body
+    li a5, 1
+ip_ret:
+    mv a0, a5
+    lw s0, 28(sp)
+    addi sp, sp, 32
+    ret
+
+sum:
+    addi sp, sp, -32
+    sw ra, 28(sp)
+    sw s0, 24(sp)
+    addi s0, sp, 32
+    sw zero, -20(s0)
+    sw zero, -24(s0)
+    j s_cond
+s_body:
+    la a4, codes
+    lw a5, -24(s0)
+    add a5, a4, a5
+    lbu a5, 0(a5)
+    mv a0, a5
+    call isPrime
+    mv a5, a0
+    beqz a5, s_inc
+    la a4, codes
+    lw a5, -24(s0)
+    add a5, a4, a5
+    lbu a5, 0(a5)
+    mv a4, a5
+    lw a5, -20(s0)
+    add a5, a5, a4
+    sw a5, -20(s0)
+s_inc:
+    lw a5, -24(s0)
+    addi a5, a5, 1
+    sw a5, -24(s0)
+s_cond:
+    lw a4, -24(s0)
+    li a5, 4
+    ble a4, a5, s_body
+    lw a5, -20(s0)
+    mv a0, a5
+    lw ra, 28(sp)
+    lw s0, 24(sp)
+    addi sp, sp, 32
+    ret
+
+    .rodata
+codes:
+    .byte '1', '2', '3', '4', '5'
+    .align 2
@@ -0,0 +1,117 @@
+# Interpreter of a bytecode dispatched through a jump table, running a program that sums 1 to 100000. Instructions
+# are an opcode, a destination register and either two source registers or a 16 bit immediate
+# Exit code: 705082704
+
+    .equ PASSES, 10
+
+    .equ HALT, 0
+    .equ LI, 1
+    .equ ADD, 2
+    .equ ADDI, 3
+    .equ BNZ, 4
+    .equ MUL, 5
+    .equ OPS, 6
+
+    .text
+_start:
+    li sp, 0x80100000
+    li s1, PASSES
+repeat:
+    la a0, program
+    call vm
+    addi s1, s1, -1
+    bnez s1, repeat
+    li t0, 0x11100000
+    sw a0, 0(t0)
+hang:
+    j hang
+
+# Runs the bytecode at a0 with 8 registers on the stack, returns r0 once it halts or -1 on an unknown opcode
+vm:
+    addi sp, sp, -32
+    mv t6, sp
+    la t5, handlers
+dispatch:
+    lbu t0, 0(a0)
+    li t1, OPS
+    bgeu t0, t1, invalid
+    slli t0, t0, 2
+    add t0, t5, t0
+    lw t0, 0(t0)
+    lbu t1, 1(a0)
+    slli t1, t1, 2
+    add t1, t6, t1
+    addi a0, a0, 4
+    jr t0
+op_halt:
+    lw a0, 0(t6)
+    addi sp, sp, 32
+    ret
+op_li:
+    lh t2, -2(a0)
+    sw t2, 0(t1)
+    j dispatch
+op_add:
+    lbu t2, -2(a0)
+    lbu t3, -1(a0)
+    slli t2, t2, 2
+    slli t3, t3, 2
+    add t2, t6, t2
+    add t3, t6, t3
+    lw t2, 0(t2)
+    lw t3, 0(t3)
+    add t2, t2, t3
+    sw t2, 0(t1)
+    j dispatch
+op_addi:
+    lbu t2, -2(a0)
+    lb t3, -1(a0)
+    slli t2, t2, 2
+    add t2, t6, t2
+    lw t2, 0(t2)
+    add t2, t2, t3
+    sw t2, 0(t1)
+    j dispatch
+op_bnz:
+    lw t2, 0(t1)
+    beqz t2, dispatch
+    lh t3, -2(a0)
+    slli t3, t3, 2
+    add a0, a0, t3
+    j dispatch
+op_mul:
+    lbu t2, -2(a0)
+    lbu t3, -1(a0)
+    slli t2, t2, 2
+    slli t3, t3, 2
+    add t2, t6, t2
+    add t3, t6, t3
+    lw t2, 0(t2)
+    lw t3, 0(t3)
+    mul t2, t2, t3
+    sw t2, 0(t1)
+    j dispatch
+invalid:
+    li a0, -1
+    addi sp, sp, 32
+    ret
+
+    .rodata
+handlers:
+    .word op_halt, op_li, op_add, op_addi, op_bnz, op_mul
+
+# r0 = 0, r1 = 1000 * 100, then r0 += r1 while --r1
+program:
+    .byte LI, 0
+    .half 0
+    .byte LI, 1
+    .half 1000
+    .byte LI, 2
+    .half 100
+    .byte MUL, 1, 1, 2
+loop:
+    .byte ADD, 0, 0, 1
+    .byte ADDI, 1, 1, -1
+    .byte BNZ, 1
+    .half (loop - . - 2) / 4
+    .byte HALT, 0, 0, 0
@@ -0,0 +1,66 @@
+# Traps and timer interrupts. Two ECALLs add a0 to s0, an illegal instruction counts in s3, and the timer interrupts
+# every 2 ms while the guest spins until 3 of them and then waits for one more in WFI. Returns s0 * 100 + s1 * 10 + s3
+# Exit code: 1041
+
+    .text
+_start:
+    li sp, 0x80100000
+    la t0, handler
+    csrw 0x305, t0 # mtvec
+    li s0, 0
+    li s1, 0
+    li s3, 0
+    li a0, 5
+    ecall
+    ecall
+    .word 0x10200073 # SRET, there's no supervisor mode
+    li t0, 0x1100bff8
+    lw t1, 0(t0)
+    addi t1, t1, 2000
+    li t0, 0x11004004
+    sw zero, 0(t0)
+    li t0, 0x11004000
+    sw t1, 0(t0)
+    li t0, 0x80
+    csrw 0x304, t0 # mie.MTIE
+    csrsi 0x300, 8 # mstatus.MIE
+spin:
+    addi s2, s2, 1
+    li s4, 3
+    blt s1, s4, spin
+    addi s5, s1, 1
+wl:
+    wfi
+    blt s1, s5, wl
+    li t0, 100
+    mul s0, s0, t0
+    li t0, 10
+    mul s1, s1, t0
+    add s0, s0, s1
+    add s0, s0, s3
+    li t0, 0x11100000
+    sw s0, 0(t0)
+hang:
+    j hang
+handler:
+    csrr t0, 0x342 # mcause
+    blt t0, zero, irq
+    li t1, 2
+    beq t0, t1, illegal
+    add s0, s0, a0
+    j skip
+illegal:
+    addi s3, s3, 1
+skip:
+    csrr t0, 0x341 # mepc
+    addi t0, t0, 4
+    csrw 0x341, t0
+    mret
+irq:
+    addi s1, s1, 1
+    li t0, 0x1100bff8
+    lw t1, 0(t0)
+    addi t1, t1, 2000
+    li t0, 0x11004000
+    sw t1, 0(t0)
+    mret
@@ -1,17 +1,73 @@
+#include <cstring>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <string>
 
 using namespace std;
 
+// Keeps the timestamp of unchanged files, so dependent sources aren't rebuilt
+static bool writeIfChanged(const char *path, const string &content) {
+    ifstream old(path, ios::binary);
+    if (old) {
+        stringstream ss;
+        ss << old.rdbuf();
+        if (ss.str() == content) {
+            return true;
+        }
+    }
+
+    ofstream output(path, ios::binary);
+    if (!output) {
+        cerr << "Error: Could not open output file " << path << endl;
+        return false;
+    }
+    output << content;
+    return true;
+}
+
+// Bytes as a comma separated list of decimals, formatted by hand
+static string byteList(const string &data) {
+    string res;
+    res.reserve(data.size() * 4 + data.size() / 32);
+    char buf[4];
+    for (size_t i = 0; i < data.size(); ++i) {
+        unsigned int c = (unsigned char) data[i];
+        int n = 0;
+        if (c >= 100) {
+            buf[n++] = '0' + c / 100;
+        }
+        if (c >= 10) {
+            buf[n++] = '0' + c / 10 % 10;
+        }
+        buf[n++] = '0' + c % 10;
+        buf[n++] = ',';
+        res.append(buf, n);
+        if (i % 32 == 31) {
+            res += '\n';
+        }
+    }
+    return res;
+}
+
+static bool isAssembly(const char *path) {
+    size_t n = strlen(path);
+    return n >= 2 && path[n - 2] == '.' && (path[n - 1] == 'S' || path[n - 1] == 's');
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " [input_file] [output_file]" << endl;
+    if (argc != 3 && argc != 4) {
+        cerr << "Usage: " << argv[0] << " [input_file] [header_file] [data_file]" << endl;
+        cerr << "Without a data file the header defines the whole array. Otherwise it only declares binary_data and "
+                "binary_data_size, defined by the data file: assembly embedding the input with .incbin for a .S "
+                "file, an array definition for any other file."
+             << endl;
         return 1;
     }
 
     const char *input_file = argv[1];
-    const char *output_file = argv[2];
+    const char *header_file = argv[2];
+    const char *data_file = argc == 4 ? argv[3] : nullptr;
 
     // 打开输入文件
     ifstream input(input_file, ios::binary);
@@ -20,43 +76,84 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    // 打开输出文件
-    ofstream output(output_file);
-    if (!output) {
-        cerr << "Error: Could not open output file " << output_file << endl;
-        return 1;
-    }
-
-    // 读取输入文件大小
-    input.seekg(0, ios::end);
-    streampos size = input.tellg();
-    input.seekg(0, ios::beg);
-
-    // 分配缓冲区
-    char *buffer = new char[size];
-
     // 读取文件内容到缓冲区
-    input.read(buffer, size);
+    stringstream ss;
+    ss << input.rdbuf();
+    string data = ss.str();
+    input.close();
 
     // 写入头文件内容
-    output << "#ifndef BINARY_DATA_H" << endl;
-    output << "#define BINARY_DATA_H" << endl;
-    output << endl;
-    output << "const unsigned char binary_data[] = {";
-
-    // 写入每个字节的十六进制表示
-    for (int i = 0; i < size; i++) {
-        output << "0x" << setw(2) << setfill('0') << hex << static_cast<int>((buffer[i] + 256) % 256) << ",";
+    string header = "#ifndef BINARY_DATA_H\n"
+                    "#define BINARY_DATA_H\n"
+                    "\n"
+                    "#include <cstddef>\n"
+                    "\n";
+    if (!data_file) {
+        header += "const unsigned char binary_data[] = {\n" + byteList(data) + "};\n";
+        header += "const size_t binary_data_size = " + to_string(data.size()) + ";\n";
+    } else {
+        header += "extern \"C\" const unsigned char binary_data[];\n"
+                  "extern \"C\" const size_t binary_data_size;\n";
+    }
+    header += "\n"
+              "#endif // BINARY_DATA_H\n";
+    if (!writeIfChanged(header_file, header)) {
+        return 1;
+    }
+    if (!data_file) {
+        return 0;
     }
 
-    output << "};" << endl;
-    output << endl;
-    output << "#endif // BINARY_DATA_H" << endl;
-
-    // 清理资源
-    delete[] buffer;
-    input.close();
-    output.close();
-
-    return 0;
+    string content;
+    if (isAssembly(data_file)) {
+        // The assembler reads the input itself, binary_data_start is an alias of binary_data. Page aligned so the
+        // runtime can map the data instead of copying it
+        string path;
+        for (const char *p = input_file; *p; ++p) {
+            char c = *p == '\\' ? '/' : *p;
+            if (c == '"') {
+                path += '\\';
+            }
+            path += c;
+        }
+        content = "#ifdef __APPLE__\n"
+                  "#    define SYMBOL(name) _##name\n"
+                  "#    define SECTION .const\n"
+                  "#else\n"
+                  "#    define SYMBOL(name) name\n"
+                  "#    define SECTION .section .rodata\n"
+                  "#endif\n"
+                  "#if defined(__LP64__) || defined(_WIN64)\n"
+                  "#    define SIZE .quad\n"
+                  "#else\n"
+                  "#    define SIZE .long\n"
+                  "#endif\n"
+                  "\n"
+                  "    SECTION\n"
+                  "    .globl SYMBOL(binary_data)\n"
+                  "    .globl SYMBOL(binary_data_start)\n"
+                  "    .globl SYMBOL(binary_data_end)\n"
+                  "    .globl SYMBOL(binary_data_size)\n"
+                  "    .balign 4096\n"
+                  "SYMBOL(binary_data):\n"
+                  "SYMBOL(binary_data_start):\n"
+                  "    .incbin \"" +
+                  path +
+                  "\"\n"
+                  "SYMBOL(binary_data_end):\n"
+                  "    .balign 8\n"
+                  "SYMBOL(binary_data_size):\n"
+                  "    SIZE SYMBOL(binary_data_end) - SYMBOL(binary_data_start)\n"
+                  "\n"
+                  "#ifdef __ELF__\n"
+                  "    .section .note.GNU-stack, \"\", @progbits\n"
+                  "#endif\n";
+    } else {
+        content = "#include <cstddef>\n"
+                  "\n"
+                  "extern \"C\" const unsigned char binary_data[] = {\n" +
+                  byteList(data) + "0};\n" + "extern \"C\" const size_t binary_data_size = " + to_string(data.size()) +
+                  ";\n";
+    }
+    return writeIfChanged(data_file, content) ? 0 : 1;
 }
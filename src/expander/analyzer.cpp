@@ -0,0 +1,642 @@
+#include "analyzer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iterator>
+
+#include "decoder.h"
+
+// sp, gp, tp, s0-s11, preserved across calls by the calling convention
+static const uint32_t CALLEE_SAVED = (1u << 2) | (1u << 3) | (1u << 4) | (1u << 8) | (1u << 9) | (0x3ffu << 18);
+
+bool RegState::meet(const RegState &other) {
+    uint32_t mask = known & other.known;
+    for (int i = 1; i < 32; ++i) {
+        if ((mask & (1u << i)) && values[i] != other.values[i]) {
+            mask &= ~(1u << i);
+        }
+    }
+    if (mask == known && (ram & other.ram) == ram) {
+        return false;
+    }
+    known = mask;
+    ram &= other.ram;
+    return true;
+}
+
+uint32_t Analyzer::evalAlu(uint32_t ir, uint32_t rs1, uint32_t rs2) {
+    uint32_t is_reg = !!(ir & 0b100000);
+    if (is_reg && (ir & 0x02000000)) {
+        switch ((ir >> 12) & 7) {
+            case 0b000:
+                return rs1 * rs2; // MUL
+            case 0b001:
+                return ((int64_t) ((int32_t) rs1) * (int64_t) ((int32_t) rs2)) >> 32; // MULH
+            case 0b010:
+                return ((int64_t) ((int32_t) rs1) * (uint64_t) rs2) >> 32; // MULHSU
+            case 0b011:
+                return ((uint64_t) rs1 * (uint64_t) rs2) >> 32; // MULHU
+            case 0b100:
+                if (rs2 == 0)
+                    return -1;
+                return ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1) ? rs1 : ((int32_t) rs1 / (int32_t) rs2);
+            case 0b101:
+                return rs2 == 0 ? 0xffffffff : rs1 / rs2; // DIVU
+            case 0b110:
+                if (rs2 == 0)
+                    return rs1;
+                return ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1)
+                           ? 0
+                           : ((uint32_t) ((int32_t) rs1 % (int32_t) rs2)); // REM
+            default:
+                return rs2 == 0 ? rs1 : rs1 % rs2; // REMU
+        }
+    }
+    switch ((ir >> 12) & 7) {
+        case 0b000:
+            return (is_reg && (ir & 0x40000000)) ? (rs1 - rs2) : (rs1 + rs2);
+        case 0b001:
+            return rs1 << (rs2 & 0x1F);
+        case 0b010:
+            return (int32_t) rs1 < (int32_t) rs2;
+        case 0b011:
+            return rs1 < rs2;
+        case 0b100:
+            return rs1 ^ rs2;
+        case 0b101:
+            return (ir & 0x40000000) ? (((int32_t) rs1) >> (rs2 & 0x1F)) : (rs1 >> (rs2 & 0x1F));
+        case 0b110:
+            return rs1 | rs2;
+        default:
+            return rs1 & rs2;
+    }
+}
+
+Analyzer::Analyzer(std::string_view content, uint32_t base) : content(content), base(base), entry(base) {
+}
+
+Analyzer::~Analyzer() {
+}
+
+uint32_t Analyzer::load4(uint32_t pc) const {
+    uint32_t ofs = pc - base;
+    if (ofs > content.size() || content.size() - ofs < 4) {
+        return 0;
+    }
+    uint32_t val;
+    memcpy(&val, content.data() + ofs, sizeof(val));
+    return val;
+}
+
+void Analyzer::analyze() {
+    findCode();
+    buildBlocks();
+    findFunctions();
+    propagateConstants();
+}
+
+void Analyzer::setReadOnlyRanges(const std::vector<AddressRange> &ranges) {
+    readOnlyRanges = ranges;
+}
+
+void Analyzer::setCodeRanges(const std::vector<AddressRange> &ranges) {
+    codeRanges = ranges;
+}
+
+void Analyzer::setEntry(uint32_t pc) {
+    entry = pc;
+}
+
+void Analyzer::setFunctionEntries(const std::set<uint32_t> &entries) {
+    entrySet = entries;
+}
+
+RegState Analyzer::blockState(uint32_t pc) const {
+    auto it = stateMap.find(pc);
+    if (it == stateMap.end()) {
+        return RegState();
+    }
+    return it->second;
+}
+
+bool Analyzer::branchTaken(uint32_t funct3, uint32_t rs1, uint32_t rs2) {
+    switch (funct3) {
+        case 0b000:
+            return rs1 == rs2;
+        case 0b001:
+            return rs1 != rs2;
+        case 0b100:
+            return (int32_t) rs1 < (int32_t) rs2;
+        case 0b101:
+            return (int32_t) rs1 >= (int32_t) rs2;
+        case 0b110:
+            return rs1 < rs2;
+        default:
+            return rs1 >= rs2;
+    }
+}
+
+bool Analyzer::loadReadOnly(uint32_t addr, uint32_t size, uint32_t &val) const {
+    uint32_t ofs = addr - base;
+    if (ofs > content.size() || content.size() - ofs < size) {
+        return false;
+    }
+    for (const auto &range : readOnlyRanges) {
+        if (range.contains(addr, size)) {
+            val = 0;
+            memcpy(&val, content.data() + ofs, size);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Analyzer::step(RegState &state, uint32_t pc, uint32_t ir) const {
+    Instruction inst(ir);
+    uint32_t rd = inst.rd();
+    uint32_t rs1 = state.values[inst.rs1()];
+    bool rs1Known = state.isKnown(inst.rs1());
+
+    bool rs1Ram = state.isRam(inst.rs1()), rs2Ram = state.isRam(inst.rs2());
+
+    switch (inst.opcode()) {
+        case Instruction::LUI:
+            state.set(rd, inst.immU());
+            break;
+        case Instruction::AUIPC:
+            state.set(rd, pc + inst.immU());
+            break;
+        case Instruction::JAL:
+        case Instruction::JALR:
+            state.set(rd, pc + 4);
+            break;
+        case Instruction::LOAD: {
+            uint32_t val;
+            uint32_t size = 1u << (inst.funct3() & 3);
+            if (rs1Known && size <= 4 && loadReadOnly(rs1 + inst.immI(), size, val)) {
+                switch (inst.funct3()) {
+                    case 0b000:
+                        val = (int8_t) val;
+                        break;
+                    case 0b001:
+                        val = (int16_t) val;
+                        break;
+                    default:
+                        break;
+                }
+                state.set(rd, val);
+            } else {
+                state.reset(rd);
+            }
+            break;
+        }
+        case Instruction::OP_IMM:
+            if (rs1Known) {
+                state.set(rd, evalAlu(ir, rs1, inst.immI()));
+            } else {
+                state.reset(rd);
+                state.setRam(rd, rs1Ram && inst.funct3() == 0b000); // ADDI
+            }
+            break;
+        case Instruction::OP:
+            if (rs1Known && state.isKnown(inst.rs2())) {
+                state.set(rd, evalAlu(ir, rs1, state.values[inst.rs2()]));
+            } else {
+                // A pointer plus or minus an offset, the sum of two pointers isn't one
+                bool add = (ir & 0xfe007000) == 0, sub = (ir & 0xfe007000) == 0x40000000;
+                state.reset(rd);
+                state.setRam(rd, rs1Ram != rs2Ram && (add || (sub && rs1Ram)));
+            }
+            break;
+        case Instruction::BRANCH:
+        case Instruction::STORE:
+        case Instruction::MISC_MEM:
+            return;
+        default:
+            state.reset(rd);
+            break;
+    }
+
+    // Addresses above the base are RAM
+    if (state.isKnown(rd) && state.values[rd] >= base) {
+        state.setRam(rd, true);
+    }
+}
+
+void Analyzer::propagateConstants() {
+    stateMap.clear();
+    if (blockMap.empty()) {
+        return;
+    }
+
+    // Blocks ending in a call, by the site the callee returns to
+    std::map<uint32_t, uint32_t> returnSites;
+    std::set<uint32_t> returnTargets;
+    for (const auto &item : blockMap) {
+        const auto &block = item.second;
+        if (block.end == block.start) {
+            continue;
+        }
+        Instruction inst(load4(block.end - 4));
+        if ((inst.opcode() == Instruction::JAL || inst.opcode() == Instruction::JALR) && inst.rd() == 1 &&
+            blockMap.count(block.end)) {
+            returnSites[item.first] = block.end;
+            returnTargets.insert(block.end);
+        }
+    }
+
+    // Indirect targets may be entered with any register values. Return sites are seeded by their calls instead
+    std::vector<uint32_t> worklist;
+    for (const auto &item : blockMap) {
+        if (targetSet.count(item.first) && !returnTargets.count(item.first)) {
+            stateMap[item.first] = RegState();
+            worklist.push_back(item.first);
+        }
+    }
+
+    auto merge = [&](uint32_t pc, const RegState &state) {
+        auto it = stateMap.find(pc);
+        if (it == stateMap.end()) {
+            stateMap[pc] = state;
+            worklist.push_back(pc);
+        } else if (it->second.meet(state)) {
+            worklist.push_back(pc);
+        }
+    };
+
+    while (!worklist.empty()) {
+        uint32_t pc = worklist.back();
+        worklist.pop_back();
+
+        const auto &block = blockMap.at(pc);
+        RegState state = stateMap.at(pc);
+        for (uint32_t cur = block.start; cur < block.end; cur += 4) {
+            step(state, cur, load4(cur));
+        }
+
+        for (uint32_t succ : block.succs) {
+            merge(succ, state);
+        }
+
+        // The callee keeps the saved registers, so they still point into RAM once it returns. Only where they point
+        // is assumed, their values are unknown
+        auto call = returnSites.find(pc);
+        if (call != returnSites.end()) {
+            RegState ret;
+            ret.ram = state.ram & CALLEE_SAVED;
+            merge(call->second, ret);
+        }
+
+        // Return sites of calls never reached are indirect targets like any other
+        if (worklist.empty()) {
+            for (uint32_t site : returnTargets) {
+                if (!stateMap.count(site)) {
+                    merge(site, RegState());
+                }
+            }
+        }
+    }
+}
+
+bool Analyzer::plausibleCode(uint32_t pc) const {
+    // A straight-line run of valid instructions up to a control transfer or known code
+    for (int i = 0; i < MAX_PROBE; ++i, pc += 4) {
+        if (codeSet.count(pc)) {
+            return true;
+        }
+        if (!inCodeRange(pc)) {
+            return false;
+        }
+        Instruction inst(load4(pc));
+        if (!inst.isValid()) {
+            return false;
+        }
+        if (inst.isControlTransfer()) {
+            return true;
+        }
+    }
+    return true;
+}
+
+void Analyzer::findCode() {
+    codeSet.clear();
+    leaderSet.clear();
+    targetSet.clear();
+    callSet.clear();
+
+    std::vector<uint32_t> worklist;
+    auto addLeader = [&](uint32_t pc) {
+        if (inCodeRange(pc)) {
+            leaderSet.insert(pc);
+            worklist.push_back(pc);
+        }
+    };
+    auto addTarget = [&](uint32_t pc) {
+        if (inCodeRange(pc)) {
+            targetSet.insert(pc);
+            addLeader(pc);
+        }
+    };
+
+    // Addresses whose value is taken but never jumped to directly, they become indirect
+    // targets if they look like code. Seeded by code addresses stored as data, e.g. switch
+    // tables and function pointers.
+    std::set<uint32_t> candidates;
+    for (uint32_t pc = base; pc - base + 4 <= content.size(); pc += 4) {
+        if (inCodeRange(load4(pc))) {
+            candidates.insert(load4(pc));
+        }
+    }
+
+    addTarget(entry);
+    for (uint32_t pc : entrySet) {
+        addTarget(pc);
+        callSet.insert(pc);
+    }
+
+    // Values of registers set by LUI/AUIPC/ADDI in the current straight-line run, used to
+    // resolve "auipc + jalr" calls and "lui/auipc + addi" code addresses
+    uint32_t known[32];
+    uint32_t knownMask = 0;
+
+    for (;;) {
+        while (!worklist.empty()) {
+            uint32_t pc = worklist.back();
+            worklist.pop_back();
+
+            // Follow the fall through path until it reaches known code or an invalid word
+            knownMask = 0;
+            while (inCodeRange(pc) && !codeSet.count(pc)) {
+                Instruction inst(load4(pc));
+                if (!inst.isValid()) {
+                    break;
+                }
+                codeSet.insert(pc);
+
+                uint32_t rd = inst.rd();
+                bool fallThrough = true;
+                switch (inst.opcode()) {
+                    case Instruction::LUI:
+                        known[rd] = inst.immU();
+                        knownMask |= 1u << rd;
+                        break;
+                    case Instruction::AUIPC:
+                        known[rd] = pc + inst.immU();
+                        knownMask |= 1u << rd;
+                        break;
+                    case Instruction::OP_IMM:
+                        if (inst.funct3() == 0 && (knownMask & (1u << inst.rs1()))) {
+                            known[rd] = known[inst.rs1()] + inst.immI();
+                            knownMask |= 1u << rd;
+                            if (inCodeRange(known[rd])) {
+                                candidates.insert(known[rd]);
+                            }
+                        } else {
+                            knownMask &= ~(1u << rd);
+                        }
+                        break;
+                    case Instruction::JAL:
+                        addLeader(pc + inst.immJ());
+                        if (rd == 1) {
+                            callSet.insert(pc + inst.immJ());
+                        }
+                        if (rd) {
+                            addTarget(pc + 4); // Return site
+                        }
+                        fallThrough = rd != 0;
+                        break;
+                    case Instruction::JALR:
+                        if (knownMask & (1u << inst.rs1())) {
+                            addTarget((known[inst.rs1()] + inst.immI()) & ~1);
+                            if (rd == 1) {
+                                callSet.insert((known[inst.rs1()] + inst.immI()) & ~1);
+                            }
+                        }
+                        if (rd) {
+                            addTarget(pc + 4); // Return site
+                        }
+                        fallThrough = rd != 0;
+                        break;
+                    case Instruction::BRANCH:
+                        addLeader(pc + inst.immB());
+                        break;
+                    case Instruction::STORE:
+                    case Instruction::MISC_MEM:
+                        break;
+                    case Instruction::SYSTEM:
+                        if (inst.isTrap()) {
+                            // Trap handlers return after the instruction by adjusting mepc
+                            if (!inst.isMret()) {
+                                addTarget(pc + 4);
+                            }
+                            fallThrough = false;
+                        } else if (inst.isWfi()) {
+                            // The interrupt waited for resumes at the next instruction, it starts a block
+                            addLeader(pc + 4);
+                        }
+                        knownMask &= ~(1u << rd);
+                        break;
+                    default:
+                        knownMask &= ~(1u << rd);
+                        break;
+                }
+                knownMask &= ~1u;
+
+                if (inst.isControlTransfer()) {
+                    knownMask = 0;
+                    leaderSet.insert(pc + 4);
+                }
+                if (!fallThrough) {
+                    break;
+                }
+                pc += 4;
+            }
+        }
+
+        if (candidates.empty()) {
+            break;
+        }
+        for (uint32_t pc : candidates) {
+            if (plausibleCode(pc)) {
+                addTarget(pc);
+            }
+        }
+        candidates.clear();
+    }
+
+    // Only keep leaders of real instructions
+    for (auto it = leaderSet.begin(); it != leaderSet.end();) {
+        it = codeSet.count(*it) ? std::next(it) : leaderSet.erase(it);
+    }
+    for (auto it = targetSet.begin(); it != targetSet.end();) {
+        it = codeSet.count(*it) ? std::next(it) : targetSet.erase(it);
+    }
+    for (auto it = callSet.begin(); it != callSet.end();) {
+        it = codeSet.count(*it) ? std::next(it) : callSet.erase(it);
+    }
+}
+
+void Analyzer::buildBlocks() {
+    blockMap.clear();
+
+    BasicBlock *block = nullptr;
+    for (uint32_t pc : codeSet) {
+        if (block && block->end != pc) {
+            block = nullptr; // Falls off into data
+        }
+        if (!block || leaderSet.count(pc)) {
+            if (block) {
+                block->succs.push_back(pc); // Fall through
+            }
+            block = &blockMap[pc];
+            block->start = pc;
+        }
+        block->end = pc + 4;
+
+        Instruction inst(load4(pc));
+        switch (inst.opcode()) {
+            case Instruction::JAL:
+                if (inCode(pc + inst.immJ())) {
+                    block->succs.push_back(pc + inst.immJ());
+                }
+                block = nullptr;
+                break;
+            case Instruction::JALR:
+                block = nullptr;
+                break;
+            case Instruction::BRANCH:
+                if (inCode(pc + inst.immB())) {
+                    block->succs.push_back(pc + inst.immB());
+                }
+                if (inCode(pc + 4)) {
+                    block->succs.push_back(pc + 4);
+                }
+                block = nullptr;
+                break;
+            case Instruction::SYSTEM:
+                if (inst.isTrap()) {
+                    block = nullptr;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+std::vector<uint32_t> Analyzer::localSuccs(const BasicBlock &block) const {
+    std::vector<uint32_t> res;
+    uint32_t pc = block.end - 4;
+    Instruction inst(load4(pc));
+    switch (inst.opcode()) {
+        case Instruction::JAL:
+            if (inst.rd() == 1) {
+                res.push_back(pc + 4); // Return site
+            } else if (!callSet.count(pc + inst.immJ())) {
+                res.push_back(pc + inst.immJ()); // Not a tail call
+            }
+            break;
+        case Instruction::JALR:
+            if (inst.rd() == 1) {
+                res.push_back(pc + 4);
+            }
+            break;
+        case Instruction::BRANCH:
+            res.push_back(pc + inst.immB());
+            res.push_back(pc + 4);
+            break;
+        default:
+            if (!inst.isMret()) {
+                res.push_back(block.end); // Falls through, or where a trap handler returns to
+            }
+            break;
+    }
+
+    for (auto it = res.begin(); it != res.end();) {
+        it = blockMap.count(*it) ? std::next(it) : res.erase(it);
+    }
+    return res;
+}
+
+void Analyzer::findFunctions() {
+    functionMap.clear();
+    if (blockMap.empty()) {
+        return;
+    }
+
+    // Blocks reachable from `root` without leaving through a call or tail call
+    auto reach = [&](uint32_t root) {
+        std::set<uint32_t> blocks;
+        std::vector<uint32_t> stack = {root};
+        while (!stack.empty()) {
+            uint32_t pc = stack.back();
+            stack.pop_back();
+            if (!blocks.insert(pc).second) {
+                continue;
+            }
+            for (uint32_t succ : localSuccs(blockMap.at(pc))) {
+                stack.push_back(succ);
+            }
+        }
+        return blocks;
+    };
+
+    std::set<uint32_t> owned;
+    auto addFunction = [&](uint32_t entry) {
+        auto &func = functionMap[entry];
+        func.entry = entry;
+        func.blocks = reach(entry);
+        owned.insert(func.blocks.begin(), func.blocks.end());
+    };
+
+    addFunction(entry);
+    for (uint32_t entry : callSet) {
+        if (blockMap.count(entry)) {
+            addFunction(entry);
+        }
+    }
+
+    // Targets of a jump table, between the function with the indirect jump and the next one and either among its
+    // blocks or leading back into them, are entered through the function's own dispatch instead of becoming functions
+    auto jumpsIndirectly = [&](const Function &func) {
+        for (uint32_t start : func.blocks) {
+            Instruction inst(load4(blockMap.at(start).end - 4));
+            if (inst.opcode() == Instruction::JALR && inst.rd() == 0 && inst.rs1() != 1) {
+                return true;
+            }
+        }
+        return false;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto it = functionMap.begin(); it != functionMap.end(); ++it) {
+            auto &func = it->second;
+            auto next = std::next(it);
+            if (!jumpsIndirectly(func)) {
+                continue;
+            }
+            for (auto target = targetSet.lower_bound(func.entry);
+                 target != targetSet.end() && (next == functionMap.end() || *target < next->first); ++target) {
+                if (owned.count(*target) || !blockMap.count(*target)) {
+                    continue;
+                }
+                std::set<uint32_t> blocks = reach(*target);
+                if (*target < *func.blocks.rbegin() ||
+                    std::any_of(blocks.begin(), blocks.end(), [&](uint32_t pc) { return func.blocks.count(pc); })) {
+                    func.blocks.insert(blocks.begin(), blocks.end());
+                    owned.insert(blocks.begin(), blocks.end());
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Indirect targets no function reaches, e.g. routines only called through pointers
+    for (uint32_t pc : targetSet) {
+        if (!owned.count(pc) && blockMap.count(pc)) {
+            callSet.insert(pc);
+            addFunction(pc);
+        }
+    }
+}
@@ -0,0 +1,186 @@
+#ifndef ANALYZER_H
+#define ANALYZER_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct BasicBlock {
+    uint32_t start; // PC of the first instruction
+    uint32_t end;   // PC after the last instruction
+
+    // Statically known successors, indirect jumps have none
+    std::vector<uint32_t> succs;
+};
+
+// Guest routine translated into its own host function
+struct Function {
+    uint32_t entry;
+
+    // Starts of the blocks reachable from the entry, or from the targets of its jump tables, without leaving through
+    // a call or tail call
+    std::set<uint32_t> blocks;
+};
+
+struct AddressRange {
+    uint32_t begin;
+    uint32_t end;
+
+    bool contains(uint32_t addr, uint32_t size = 1) const {
+        return addr >= begin && addr < end && end - addr >= size;
+    }
+};
+
+// Statically known register values, x0 is always known
+struct RegState {
+    uint32_t known;
+    uint32_t values[32];
+
+    // Registers pointing into RAM, known or not. Includes sp by the calling convention, and stays set through
+    // small offsets, which can't reach the devices far below the RAM.
+    uint32_t ram;
+
+    RegState() : known(1), values(), ram(1u << 2) {
+    }
+
+    bool isKnown(uint32_t n) const {
+        return known & (1u << n);
+    }
+
+    bool isRam(uint32_t n) const {
+        return ram & (1u << n);
+    }
+
+    void set(uint32_t n, uint32_t val) {
+        if (n) {
+            known |= 1u << n;
+            values[n] = val;
+            ram &= ~(1u << n);
+        }
+    }
+
+    void reset(uint32_t n) {
+        if (n) {
+            known &= ~(1u << n);
+            ram &= ~(1u << n);
+        }
+    }
+
+    void setRam(uint32_t n, bool isRam) {
+        if (n && isRam) {
+            ram |= 1u << n;
+        }
+    }
+
+    // Keep the values both states agree on, returns true if anything changed
+    bool meet(const RegState &other);
+};
+
+class Analyzer {
+public:
+    Analyzer(std::string_view content, uint32_t base);
+    ~Analyzer();
+
+    void setReadOnlyRanges(const std::vector<AddressRange> &ranges);
+
+    // Only look for code inside the ranges, the whole image by default
+    void setCodeRanges(const std::vector<AddressRange> &ranges);
+
+    // Start of execution, the base by default
+    void setEntry(uint32_t pc);
+
+    // Known function entries, e.g. from a symbol table, entered directly and through pointers
+    void setFunctionEntries(const std::set<uint32_t> &entries);
+
+    void analyze();
+
+    // Addresses of all instructions reachable from the entry or an address-taken target
+    const std::set<uint32_t> &code() const {
+        return codeSet;
+    }
+
+    const std::map<uint32_t, BasicBlock> &blocks() const {
+        return blockMap;
+    }
+
+    // Addresses that may be reached through JALR
+    const std::set<uint32_t> &indirectTargets() const {
+        return targetSet;
+    }
+
+    // Functions by entry, the image entry and targets of JAL/JALR with ra as link register
+    const std::map<uint32_t, Function> &functions() const {
+        return functionMap;
+    }
+
+    // Successors of the block inside its function, a call continues at the return site
+    std::vector<uint32_t> localSuccs(const BasicBlock &block) const;
+
+    uint32_t load4(uint32_t pc) const;
+
+    // Register values on entry of the block, all unknown for indirect targets
+    RegState blockState(uint32_t pc) const;
+
+    // Apply the instruction to the state
+    void step(RegState &state, uint32_t pc, uint32_t ir) const;
+
+    // Constant evaluation of a branch condition
+    static bool branchTaken(uint32_t funct3, uint32_t rs1, uint32_t rs2);
+
+    // Result of an OP or OP-IMM instruction, rs2 is the immediate for the latter
+    static uint32_t evalAlu(uint32_t ir, uint32_t rs1, uint32_t rs2);
+
+private:
+    std::string_view content;
+    uint32_t base;
+    uint32_t entry;
+
+    // Length of the straight-line run checked before an address-taken value is treated as code
+    static const int MAX_PROBE = 64;
+
+    std::set<uint32_t> codeSet;
+    std::set<uint32_t> leaderSet;
+    std::set<uint32_t> targetSet;
+    std::set<uint32_t> callSet;
+    std::map<uint32_t, BasicBlock> blockMap;
+    std::map<uint32_t, Function> functionMap;
+
+    std::vector<AddressRange> readOnlyRanges;
+    std::vector<AddressRange> codeRanges;
+    std::set<uint32_t> entrySet;
+    std::map<uint32_t, RegState> stateMap;
+
+    bool inImage(uint32_t pc) const {
+        return pc >= base && pc - base < content.size() && content.size() - (pc - base) >= 4 && (pc & 3) == 0;
+    }
+
+    bool inCodeRange(uint32_t pc) const {
+        if (!inImage(pc)) {
+            return false;
+        }
+        for (const auto &range : codeRanges) {
+            if (range.contains(pc, 4)) {
+                return true;
+            }
+        }
+        return codeRanges.empty();
+    }
+
+    bool inCode(uint32_t pc) const {
+        return codeSet.count(pc);
+    }
+
+    bool plausibleCode(uint32_t pc) const;
+
+    void findCode();
+    void buildBlocks();
+    void findFunctions();
+    void propagateConstants();
+
+    bool loadReadOnly(uint32_t addr, uint32_t size, uint32_t &val) const;
+};
+
+#endif // ANALYZER_H
@@ -0,0 +1,148 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <cstdint>
+
+// Field and immediate extraction of a single RV32IMA instruction word
+struct Instruction {
+    enum Opcode {
+        LUI = 0b0110111,
+        AUIPC = 0b0010111,
+        JAL = 0b1101111,
+        JALR = 0b1100111,
+        BRANCH = 0b1100011,
+        LOAD = 0b0000011,
+        STORE = 0b0100011,
+        OP_IMM = 0b0010011,
+        OP = 0b0110011,
+        MISC_MEM = 0b0001111,
+        SYSTEM = 0b1110011,
+        AMO = 0b0101111,
+    };
+
+    uint32_t ir;
+
+    explicit Instruction(uint32_t ir) : ir(ir) {
+    }
+
+    uint32_t opcode() const {
+        return ir & 0x7f;
+    }
+
+    uint32_t rd() const {
+        return (ir >> 7) & 0x1f;
+    }
+
+    uint32_t rs1() const {
+        return (ir >> 15) & 0x1f;
+    }
+
+    uint32_t rs2() const {
+        return (ir >> 20) & 0x1f;
+    }
+
+    uint32_t funct3() const {
+        return (ir >> 12) & 0x7;
+    }
+
+    int32_t immI() const {
+        uint32_t imm = ir >> 20;
+        return imm | ((imm & 0x800) ? 0xfffff000 : 0);
+    }
+
+    int32_t immS() const {
+        uint32_t imm = ((ir >> 7) & 0x1f) | ((ir & 0xfe000000) >> 20);
+        return imm | ((imm & 0x800) ? 0xfffff000 : 0);
+    }
+
+    int32_t immB() const {
+        uint32_t imm = ((ir & 0xf00) >> 7) | ((ir & 0x7e000000) >> 20) | ((ir & 0x80) << 4) | ((ir >> 31) << 12);
+        return imm | ((imm & 0x1000) ? 0xffffe000 : 0);
+    }
+
+    uint32_t immU() const {
+        return ir & 0xfffff000;
+    }
+
+    int32_t immJ() const {
+        uint32_t imm =
+            ((ir & 0x80000000) >> 11) | ((ir & 0x7fe00000) >> 20) | ((ir & 0x00100000) >> 9) | ((ir & 0x000ff000));
+        return imm | ((imm & 0x00100000) ? 0xffe00000 : 0);
+    }
+
+    // Whether the word is an instruction of RV32IMA plus Zicsr
+    bool isValid() const {
+        uint32_t funct7 = ir >> 25;
+        switch (opcode()) {
+            case LUI:
+            case AUIPC:
+            case JAL:
+            case SYSTEM:
+                return true;
+            case JALR:
+                return funct3() == 0;
+            case BRANCH:
+                return funct3() != 0b010 && funct3() != 0b011;
+            case LOAD:
+                return funct3() != 0b011 && funct3() < 0b110;
+            case STORE:
+                return funct3() <= 0b010;
+            case OP_IMM:
+                if (funct3() == 0b001) {
+                    return funct7 == 0;
+                }
+                if (funct3() == 0b101) {
+                    return funct7 == 0 || funct7 == 0b0100000;
+                }
+                return true;
+            case OP:
+                if (funct7 == 0b0100000) {
+                    return funct3() == 0b000 || funct3() == 0b101;
+                }
+                return funct7 == 0 || funct7 == 1;
+            case MISC_MEM:
+                return funct3() <= 0b001;
+            case AMO:
+                // LR.W and SC.W, then AMOSWAP, ADD, XOR, AND, OR, MIN, MAX, MINU and MAXU
+                switch (ir >> 27) {
+                    case 0b00010:
+                    case 0b00011:
+                    case 0b00001:
+                    case 0b00000:
+                    case 0b00100:
+                    case 0b01100:
+                    case 0b01000:
+                    case 0b10000:
+                    case 0b10100:
+                    case 0b11000:
+                    case 0b11100:
+                        return funct3() == 0b010;
+                    default:
+                        return false;
+                }
+            default:
+                return false;
+        }
+    }
+
+    // SYSTEM instructions continuing in the trap handler, ECALL, EBREAK and the illegal ones, or at mepc for MRET
+    bool isTrap() const {
+        return opcode() == SYSTEM && !(funct3() & 3) && !isWfi();
+    }
+
+    bool isMret() const {
+        return ir == 0x30200073;
+    }
+
+    bool isWfi() const {
+        return ir == 0x10500073;
+    }
+
+    // Any instruction after which execution doesn't simply fall through
+    bool isControlTransfer() const {
+        auto op = opcode();
+        return op == JAL || op == JALR || op == BRANCH || isTrap();
+    }
+};
+
+#endif // DECODER_H
@@ -0,0 +1,153 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "analyzer.h"
+
+// Loadable image, sections and symbols of a little endian ELF32 RISC-V executable
+class ElfFile {
+public:
+    // Executable code and read-only data, from the section headers
+    std::vector<AddressRange> codeRanges;
+    std::vector<AddressRange> readOnlyRanges;
+
+    // Names of the functions and global code labels by address
+    std::map<uint32_t, std::string> symbols;
+
+    static bool isElf(std::string_view file) {
+        return file.size() >= 4 && memcmp(file.data(), "\177ELF", 4) == 0;
+    }
+
+    // Lays out the segments starting at `base`, returns false if the file isn't a RISC-V executable loaded there
+    bool load(std::string_view file, uint32_t base) {
+        data = file;
+        image.clear();
+        codeRanges.clear();
+        readOnlyRanges.clear();
+        symbols.clear();
+
+        if (!isElf(file) || file.size() < 52 || file[4] != 1 || file[5] != 1 || half(16) != 2 || half(18) != 243) {
+            return false;
+        }
+        entryPc = word(24);
+
+        // Program headers
+        uint32_t phoff = word(28), phentsize = half(42), phnum = half(44);
+        for (uint32_t i = 0; i < phnum; ++i) {
+            uint32_t ph = phoff + i * phentsize;
+            if (!has(ph, 32)) {
+                return false;
+            }
+            if (word(ph) != PT_LOAD || !word(ph + 20)) {
+                continue;
+            }
+            uint32_t offset = word(ph + 4), addr = word(ph + 8), filesz = word(ph + 16), memsz = word(ph + 20);
+            if (addr < base || addr - base > MAX_IMAGE || memsz > MAX_IMAGE - (addr - base) || filesz > memsz ||
+                !has(offset, filesz)) {
+                return false;
+            }
+            uint32_t ofs = addr - base;
+            if (image.size() < ofs + memsz) {
+                image.resize(ofs + memsz);
+            }
+            memcpy(&image[ofs], file.data() + offset, filesz);
+        }
+
+        // Section headers, optional for loading
+        uint32_t shoff = word(32), shentsize = half(46), shnum = half(48);
+        if (!shoff || !has(shoff, shnum * shentsize)) {
+            return true;
+        }
+        for (uint32_t i = 0; i < shnum; ++i) {
+            uint32_t sh = shoff + i * shentsize;
+            uint32_t type = word(sh + 4), flags = word(sh + 8), addr = word(sh + 12), size = word(sh + 20);
+            if (type == SHT_SYMTAB) {
+                uint32_t strtab = shoff + word(sh + 24) * shentsize;
+                if (has(strtab, shentsize)) {
+                    loadSymbols(word(sh + 16), size, word(strtab + 16), word(strtab + 20));
+                }
+            }
+            if (!(flags & SHF_ALLOC) || !size) {
+                continue;
+            }
+            if (flags & SHF_EXECINSTR) {
+                codeRanges.push_back({addr, addr + size});
+            } else if (!(flags & SHF_WRITE) && type == SHT_PROGBITS) {
+                readOnlyRanges.push_back({addr, addr + size});
+            }
+        }
+
+        // Labels outside of the code are data
+        for (auto it = symbols.begin(); it != symbols.end();) {
+            bool code = false;
+            for (const auto &range : codeRanges) {
+                code = code || range.contains(it->first, 4);
+            }
+            it = code ? std::next(it) : symbols.erase(it);
+        }
+        return true;
+    }
+
+    // Segments laid out from the base, with zeros in between and for .bss
+    const std::string &content() const {
+        return image;
+    }
+
+    uint32_t entry() const {
+        return entryPc;
+    }
+
+private:
+    static const uint32_t PT_LOAD = 1;
+    static const uint32_t SHT_PROGBITS = 1;
+    static const uint32_t SHT_SYMTAB = 2;
+    static const uint32_t SHF_WRITE = 1;
+    static const uint32_t SHF_ALLOC = 2;
+    static const uint32_t SHF_EXECINSTR = 4;
+    static const uint32_t STT_NOTYPE = 0;
+    static const uint32_t STT_FUNC = 2;
+    static const uint32_t STB_GLOBAL = 1;
+
+    // Largest image accepted, the guest RAM is far smaller
+    static const uint32_t MAX_IMAGE = 1u << 30;
+
+    std::string_view data;
+    std::string image;
+    uint32_t entryPc = 0;
+
+    bool has(uint32_t offset, uint32_t size) const {
+        return offset <= data.size() && size <= data.size() - offset;
+    }
+
+    uint32_t half(uint32_t offset) const {
+        return (uint8_t) data[offset] | (uint8_t) data[offset + 1] << 8;
+    }
+
+    uint32_t word(uint32_t offset) const {
+        return half(offset) | half(offset + 2) << 16;
+    }
+
+    void loadSymbols(uint32_t offset, uint32_t size, uint32_t strOffset, uint32_t strSize) {
+        if (!has(offset, size) || !has(strOffset, strSize)) {
+            return;
+        }
+        for (uint32_t sym = offset; sym + 16 <= offset + size; sym += 16) {
+            uint32_t name = word(sym), value = word(sym + 4);
+            uint32_t type = data[sym + 12] & 0xf, bind = ((uint8_t) data[sym + 12]) >> 4;
+            if (!name || name >= strSize || !(type == STT_FUNC || (type == STT_NOTYPE && bind == STB_GLOBAL))) {
+                continue;
+            }
+            const char *str = data.data() + strOffset + name;
+            symbols[value & ~1u] = std::string(str, strnlen(str, strSize - name));
+        }
+    }
+};
+
+#endif // ELF_H
@@ -1,15 +1,79 @@
 #include "generator.h"
 
-#include <sstream>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <string>
 
+#include "analyzer.h"
+#include "decoder.h"
+#include "parallel.h"
+
+static std::string quote(const std::string &str) {
+    std::string res = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            res += '\\';
+        }
+        res += c;
+    }
+    return res + "\"";
+}
+
+// Collects the code of one function in memory, in a temporary file where open_memstream() is missing
+class MemoryFile {
+public:
+    MemoryFile() {
+#ifdef _WIN32
+        fp = tmpfile();
+#else
+        fp = open_memstream(&data, &size);
+#endif
+    }
+
+    FILE *file() const {
+        return fp;
+    }
+
+    // Closes the file
+    std::string take() {
+        std::string res;
+#ifdef _WIN32
+        res.resize(ftell(fp));
+        rewind(fp);
+        fread(&res[0], 1, res.size(), fp);
+        fclose(fp);
+#else
+        fclose(fp);
+        res.assign(data, size);
+        free(data);
+#endif
+        return res;
+    }
+
+private:
+    FILE *fp;
+#ifndef _WIN32
+    char *data = nullptr;
+    size_t size = 0;
+#endif
+};
+
 static std::string dec2hex(uint32_t i, size_t width = 8) {
-    std::stringstream ioss;                                                // 定义字符串流
-    std::string s_temp;                                                    // 存放转化后字符
-    ioss << std::hex << i;                                                 // 以十六制形式输出
-    ioss >> s_temp;
-    std::string s(width > s_temp.size() ? width - s_temp.size() : 0, '0'); // 补0
-    s += s_temp;                                                           // 合并
+    // Called for every label and address, short enough to stay in the small string buffer
+    static const char digits[] = "0123456789abcdef";
+    char buf[8];
+    size_t n = 0;
+    do {
+        buf[7 - n++] = digits[i & 0xf];
+        i >>= 4;
+    } while (i);
+
+    std::string s(width > n ? width - n : 0, '0');
+    s.append(buf + 8 - n, n);
     return s;
 }
 
@@ -24,764 +88,1399 @@ static std::string dec2hex(uint32_t i, size_t width = 8) {
 
 #define MINIRV32_RAM_IMAGE_OFFSET 0x80000000
 
-Generator::Generator(FILE *fp, const std::string &content) : fp(fp), content(content) {
+// Device registers of the runtime
+static const uint32_t MMIO_BEGIN = 0x10000000;
+static const uint32_t MMIO_END = 0x12000000;
+
+Generator::Generator(FILE *fp, std::string_view content)
+    : fp(fp), content(content), jobs(1), headerFile(nullptr), entry(MINIRV32_RAM_IMAGE_OFFSET), profile(nullptr),
+      polling(false), shared(false), analyzer(nullptr), function(nullptr), usedRegs(0), writtenRegs(0),
+      hasError(false), errorPc(0) {
 }
 
 Generator::~Generator() {
 }
 
 void Generator::generate() {
-    auto image = content.data();
-    auto image_size = content.size();
-
-    bool hasError = false;
-    auto error = [&](uint32_t pc) {
-        if (!hasError) {
-            std::cerr << "Unexpected instruction at pc " << std::hex << pc << std::endl;
-            hasError = true;
+    Analyzer analyzer(content, MINIRV32_RAM_IMAGE_OFFSET);
+    analyzer.setReadOnlyRanges(readOnlyRanges);
+    analyzer.setCodeRanges(codeRanges);
+    analyzer.setEntry(entry);
+    std::set<uint32_t> entries;
+    for (const auto &item : symbols) {
+        entries.insert(item.first);
+    }
+    analyzer.setFunctionEntries(entries);
+    analyzer.analyze();
+
+    this->analyzer = &analyzer;
+    hasError = false;
+
+    // Interrupts need a SYSTEM instruction to be enabled, without any the translation doesn't poll for them.
+    // Otherwise the polls' resume points can be dispatched to, where MRET returns after the interrupt.
+    // Guests synchronizing through atomics or fences may wait in a loop for a store of another hart, memory is read
+    // again after the same points then.
+    polling = false;
+    shared = false;
+    for (uint32_t pc : analyzer.code()) {
+        Instruction inst(analyzer.load4(pc));
+        polling = polling || inst.opcode() == Instruction::SYSTEM;
+        shared = shared || inst.opcode() == Instruction::AMO ||
+                 (inst.opcode() == Instruction::MISC_MEM && inst.funct3() == 0b000);
+    }
+    // Function entries too, where tail calls can't be guaranteed they return the entry to run() instead
+    dispatchTargets = analyzer.indirectTargets();
+    for (const auto &item : analyzer.functions()) {
+        dispatchTargets.insert(item.first);
+    }
+    for (uint32_t pc : analyzer.code()) {
+        uint32_t target;
+        if (polling && pollTarget(pc, analyzer.load4(pc), target)) {
+            dispatchTargets.insert(target);
         }
-    };
+    }
 
-    uint32_t pc = MINIRV32_RAM_IMAGE_OFFSET;
+    // Declarations shared by the shards go to the header
+    FILE *out = fp;
+    std::string linkage = shardFiles.empty() ? "static " : "";
+    if (!shardFiles.empty()) {
+        fp = headerFile;
+        fprintf(fp, "#pragma once\n\n");
+    }
 
     // Function name
+    if (!instrumentPath.empty()) {
+        fprintf(fp, "#include <cstdio>\n\n");
+    }
+    fprintf(fp, "#include \"atomics.h\"\n");
+    fprintf(fp, "#include \"jit.h\"\n");
     fprintf(fp, "#include \"rv32core.h\"\n");
     fprintf(fp, "#include \"rv32macros.h\"\n");
+    fprintf(fp, "#include \"traps.h\"\n");
     fprintf(fp, "\n\n");
 
-    fprintf(fp, "static inline bool is_syscon(uint32_t addy) {\n"
-                "    return addy == 2433744896;\n"
+    fprintf(fp, "static inline bool is_mmio(uint32_t addy) {\n"
+                "    return addy - (MMIO_BEGIN - MINIRV32_RAM_IMAGE_OFFSET) < MMIO_END - MMIO_BEGIN;\n"
+                "}\n\n");
+
+    fprintf(fp, "static inline int find_target(const uint32_t *pcs, int size, uint32_t pc) {\n"
+                "    int lo = 0, hi = size;\n"
+                "    while (lo < hi) {\n"
+                "        int mid = (lo + hi) / 2;\n"
+                "        if (pcs[mid] < pc)\n"
+                "            lo = mid + 1;\n"
+                "        else\n"
+                "            hi = mid;\n"
+                "    }\n"
+                "    return (lo < size && pcs[lo] == pc) ? lo : -1;\n"
                 "}\n\n\n");
 
-    fprintf(fp, "int run(RV32Core &core) {\n\n");
-
-    // Jump table
-    // fprintf(fp, "#define CREATE_JUMP_TABLE(PC) \\\n");
-    // fprintf(fp, "switch (PC) {\\\n");
-    // for (int i = 0; i < image_size; i += 4) {
-    //     uint32_t tmp = MINIRV32_RAM_IMAGE_OFFSET + i;
-    //     if (MINIRV32_LOAD4(i) == 0) {
-    //         break;
-    //     }
-    //     fprintf(fp,
-    //             "    case 0x%x:\\\n"
-    //             "        goto lab_%s;\\\n"
-    //             "        break;\\\n",
-    //             tmp, dec2hex(tmp).data());
-    // }
-    // fprintf(fp, "    default:\\\n"
-    //             "        break;\\\n"
-    //             "}\n\n");
-
-    // Jump table
-    fprintf(fp, "static void *jump_table[] = {\n");
-    for (int i = 0; i < image_size; i += 4) {
-        uint32_t tmp = MINIRV32_RAM_IMAGE_OFFSET + i;
-        if (MINIRV32_LOAD4(i) == 0) {
-            break;
+    // Jumps to other functions are host tail calls where the compiler guarantees them, the stack would grow with every
+    // jump otherwise
+    fprintf(fp, "#if defined(__has_attribute)\n"
+                "#    if __has_attribute(musttail)\n"
+                "#        define TAIL_CALLS 1\n"
+                "#    endif\n"
+                "#endif\n"
+                "#ifndef TAIL_CALLS\n"
+                "#    define TAIL_CALLS 0\n"
+                "#endif\n\n");
+
+    // Returned instead of the next pc once the program stops
+    fprintf(fp, "static const uint32_t EXIT_PC = 1;\n");
+
+    // Guest calls nested as host calls at most, each takes a frame of the translated function on the host stack
+    fprintf(fp, "static const uint32_t MAX_CALL_DEPTH = 4096;\n");
+    if (!shardFiles.empty()) {
+        fprintf(fp, "extern thread_local int exit_code;\n");
+        if (!instrumentPath.empty()) {
+            fprintf(fp, "extern uint64_t block_counts[];\n");
+            fprintf(fp, "extern uint64_t taken_counts[];\n");
+        }
+        fprintf(fp, "\n");
+        generateDeclarations(linkage);
+
+        fp = out;
+        fprintf(fp, "#include \"%s\"\n\n\n", headerName.data());
+    }
+    // Per hart, each runs the translation on its own thread
+    fprintf(fp, "%sthread_local int exit_code = 0;\n\n", linkage.data());
+
+    // Counters of the instrumented build
+    blockIndex.clear();
+    branchIndex.clear();
+    if (!instrumentPath.empty()) {
+        for (const auto &item : analyzer.blocks()) {
+            blockIndex[item.first] = (int) blockIndex.size();
+            uint32_t last = item.second.end - 4;
+            if (Instruction(analyzer.load4(last)).opcode() == Instruction::BRANCH) {
+                branchIndex[last] = (int) branchIndex.size();
+            }
         }
-        fprintf(fp, "    &&lab_%s,\n", dec2hex(tmp).data());
+        generateProfileWriter(linkage);
+    }
+
+    if (shardFiles.empty()) {
+        generateDeclarations(linkage);
+    }
+    generateFunctions();
+
+    // Indirect targets and resume points sorted by address, each entered through a function containing it
+    const auto &functions = analyzer.functions();
+    const auto &targets = dispatchTargets;
+    std::vector<uint32_t> owners;
+    for (uint32_t pc : targets) {
+        uint32_t owner = pc;
+        if (!functions.count(pc)) {
+            for (const auto &item : functions) {
+                if (item.second.blocks.count(pc)) {
+                    owner = item.first;
+                    break;
+                }
+            }
+        }
+        owners.push_back(owner);
+    }
+
+    fprintf(fp, "static const uint32_t function_pcs[] = {\n");
+    for (uint32_t pc : targets) {
+        fprintf(fp, "    0x%s,\n", dec2hex(pc).data());
+    }
+    fprintf(fp, "};\n");
+    fprintf(fp, "static uint32_t (*const function_table[])(RV32Core &, uint32_t) = {\n");
+    for (uint32_t owner : owners) {
+        fprintf(fp, "    fn_%s,\n", dec2hex(owner).data());
     }
     fprintf(fp, "};\n\n");
 
-    while (true) {
-        std::string if_jump;
-        uint32_t jal_pc = 0;
-        bool jalr = false;
+    // The interpreter and JIT only come back at indirect targets, which make no assumptions about the registers
+    fprintf(fp, "static const bool function_resumes[] = {\n");
+    for (uint32_t pc : targets) {
+        fprintf(fp, "    %s,\n", analyzer.indirectTargets().count(pc) ? "false" : "true");
+    }
+    fprintf(fp, "};\n\n");
+    fprintf(fp,
+            "static bool is_entry(uint32_t pc) {\n"
+            "    int i = find_target(function_pcs, %d, pc);\n"
+            "    return i >= 0 && !function_resumes[i];\n"
+            "}\n\n",
+            (int) targets.size());
+
+    // Code outside of the translation runs in the JIT until it reaches translated code again
+    fprintf(fp,
+            "%suint32_t dispatch(RV32Core &core, uint32_t pc) {\n"
+            "    int i = find_target(function_pcs, %d, pc);\n"
+            "    if (i < 0) {\n"
+            "        core.pc = pc;\n"
+            "        if (!jit_run(core, is_entry, exit_code)) {\n"
+            "            return EXIT_PC;\n"
+            "        }\n"
+            "        return core.pc;\n"
+            "    }\n"
+            "    return function_table[i](core, pc);\n"
+            "}\n\n\n",
+            linkage.data(), (int) targets.size());
+
+    // Starts at the entry, or resumes where a snapshot of the core stopped
+    fprintf(fp, "int run(RV32Core &core) {\n"
+                "    exit_code = 0;\n"
+                "    core.depth = 0;\n"
+                "    uint32_t pc = core.pc ? core.pc : 0x%x;\n"
+                "    while (pc != EXIT_PC) {\n",
+            entry);
+    if (polling) {
+        fprintf(fp, "        if ((core.mstatus & 8) && interrupt_take(core, pc)) {\n"
+                    "            pc = core.pc;\n"
+                    "        }\n");
+    }
+    fprintf(fp, "        pc = dispatch(core, pc);\n"
+                "    }\n");
+    if (!instrumentPath.empty()) {
+        fprintf(fp, "    write_profile();\n");
+    }
+    fprintf(fp, "    return exit_code;\n"
+                "}\n");
 
-        uint32_t ofs_pc = pc - MINIRV32_RAM_IMAGE_OFFSET;
+    if (hasError) {
+        std::cerr << "Unexpected instruction at pc " << std::hex << errorPc << std::endl;
+    }
+    this->analyzer = nullptr;
+}
 
-        if (ofs_pc >= content.size()) {
-            break;
+void Generator::setCodeRanges(const std::vector<AddressRange> &ranges) {
+    codeRanges = ranges;
+}
+
+void Generator::setEntry(uint32_t pc) {
+    entry = pc;
+}
+
+void Generator::setSymbols(const std::map<uint32_t, std::string> &symbols) {
+    this->symbols = symbols;
+}
+
+void Generator::setInstrument(const std::string &path) {
+    instrumentPath = path;
+}
+
+void Generator::setProfile(const Profile *profile) {
+    this->profile = profile;
+}
+
+void Generator::setShards(FILE *header, const std::string &name, const std::vector<FILE *> &files) {
+    headerFile = header;
+    headerName = name;
+    shardFiles = files;
+}
+
+void Generator::setJobs(int jobs) {
+    this->jobs = jobs;
+}
+
+void Generator::generateDeclarations(const std::string &linkage) {
+    for (const auto &item : analyzer->functions()) {
+        fprintf(fp, "%suint32_t fn_%s(RV32Core &core, uint32_t pc);\n", linkage.data(), dec2hex(item.first).data());
+    }
+    fprintf(fp, "%suint32_t dispatch(RV32Core &core, uint32_t pc);\n\n\n", linkage.data());
+}
+
+void Generator::generateFunctions() {
+    const auto &functions = analyzer->functions();
+    std::vector<const Function *> tasks;
+    std::vector<FILE *> files;
+
+    // Shards are contiguous address ranges of functions with about the same number of instructions each, counting
+    // blocks shared by several functions once per function. Functions go to the shard their midpoint falls into, so
+    // a large one early on doesn't leave the others empty.
+    std::vector<size_t> sizes;
+    size_t total = 0;
+    for (const auto &item : functions) {
+        size_t size = 0;
+        for (uint32_t start : item.second.blocks) {
+            const auto &block = analyzer->blocks().at(start);
+            size += (block.end - block.start) / 4;
+        }
+        tasks.push_back(&item.second);
+        sizes.push_back(size);
+        total += size;
+    }
+    size_t done = 0;
+    for (size_t size : sizes) {
+        size_t shard = total ? std::min((done + size / 2) * shardFiles.size() / total, shardFiles.size() - 1) : 0;
+        files.push_back(shardFiles.empty() ? fp : shardFiles[shard]);
+        done += size;
+    }
+    for (FILE *file : shardFiles) {
+        fprintf(file, "#include \"%s\"\n\n\n", headerName.data());
+    }
+
+    FILE *out = fp;
+    if (jobs <= 1) {
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            fp = files[i];
+            generateFunction(*tasks[i]);
+        }
+        fp = out;
+        return;
+    }
+
+    // Each thread translates into its own copy of the generator, the results are written in address order as soon
+    // as they are complete
+    std::vector<std::unique_ptr<Generator>> workers;
+    for (int i = 0; i < jobs; ++i) {
+        workers.emplace_back(new Generator(*this));
+    }
+    std::vector<std::string> results(tasks.size());
+    std::vector<char> ready(tasks.size());
+    std::mutex lock;
+    std::condition_variable readyChanged;
+
+    TaskPool pool(tasks.size(), jobs, [&](int worker, size_t i) {
+        Generator &generator = *workers[worker];
+        MemoryFile code;
+        generator.fp = code.file();
+        generator.generateFunction(*tasks[i]);
+        std::string result = code.take();
+
+        std::lock_guard<std::mutex> guard(lock);
+        results[i].swap(result);
+        ready[i] = true;
+        readyChanged.notify_all();
+    });
+
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        std::string result;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            readyChanged.wait(guard, [&]() { return ready[i] != 0; });
+            result.swap(results[i]);
+        }
+        fwrite(result.data(), 1, result.size(), files[i]);
+    }
+    pool.join();
+
+    for (const auto &worker : workers) {
+        if (worker->hasError) {
+            error(worker->errorPc);
+        }
+    }
+}
+
+void Generator::generateProfileWriter(const std::string &linkage) {
+    fprintf(fp, "%suint64_t block_counts[%d];\n", linkage.data(), (int) blockIndex.size());
+    fprintf(fp, "static const uint32_t block_pcs[] = {\n");
+    for (const auto &item : blockIndex) {
+        fprintf(fp, "    0x%s,\n", dec2hex(item.first).data());
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "%suint64_t taken_counts[%d];\n", linkage.data(), (int) std::max<size_t>(branchIndex.size(), 1));
+    fprintf(fp, "static const uint32_t branch_pcs[] = {\n");
+    for (const auto &item : branchIndex) {
+        fprintf(fp, "    0x%s,\n", dec2hex(item.first).data());
+    }
+    fprintf(fp, "    0,\n");
+    fprintf(fp, "};\n\n");
+
+    // Only non-zero counts are written, see profile.h for the format
+    fprintf(fp,
+            "static void write_records(FILE *fp, const uint32_t *pcs, const uint64_t *counts, uint32_t size) {\n"
+            "    for (uint32_t i = 0; i < size; ++i) {\n"
+            "        if (counts[i]) {\n"
+            "            fwrite(&pcs[i], sizeof(uint32_t), 1, fp);\n"
+            "            fwrite(&counts[i], sizeof(uint64_t), 1, fp);\n"
+            "        }\n"
+            "    }\n"
+            "}\n\n");
+    fprintf(fp,
+            "static void write_profile() {\n"
+            "    FILE *fp = fopen(%s, \"wb\");\n"
+            "    if (!fp) {\n"
+            "        return;\n"
+            "    }\n"
+            "    uint32_t header[4] = {%u, 0x%x, 0, 0};\n"
+            "    for (uint64_t count : block_counts) {\n"
+            "        header[2] += count != 0;\n"
+            "    }\n"
+            "    for (uint32_t i = 0; i < %d; ++i) {\n"
+            "        header[3] += taken_counts[i] != 0;\n"
+            "    }\n"
+            "    fwrite(\"RVPF\", 4, 1, fp);\n"
+            "    fwrite(header, sizeof(uint32_t), 4, fp);\n"
+            "    write_records(fp, block_pcs, block_counts, %d);\n"
+            "    write_records(fp, branch_pcs, taken_counts, %d);\n"
+            "    fclose(fp);\n"
+            "}\n\n\n",
+            quote(instrumentPath).data(), Profile::VERSION, Profile::checksum(content), (int) branchIndex.size(),
+            (int) blockIndex.size(), (int) branchIndex.size());
+}
+
+std::vector<uint32_t> Generator::layout(const Function &func) const {
+    std::vector<uint32_t> order;
+    if (!profile) {
+        order.assign(func.blocks.begin(), func.blocks.end());
+        return order;
+    }
+
+    // Chain each hot block to its hottest successor that isn't placed yet, starting from the entry and then
+    // from the hottest remaining block. Blocks that never ran go last in address order.
+    std::set<uint32_t> placed;
+    uint32_t pc = func.entry;
+    for (;;) {
+        while (!placed.count(pc)) {
+            placed.insert(pc);
+            order.push_back(pc);
+
+            uint64_t best = 0;
+            for (uint32_t succ : analyzer->localSuccs(analyzer->blocks().at(pc))) {
+                if (!placed.count(succ) && func.blocks.count(succ) && profile->blockCount(succ) > best) {
+                    best = profile->blockCount(succ);
+                    pc = succ;
+                }
+            }
         }
 
-        uint32_t ir = MINIRV32_LOAD4(ofs_pc);
-        if (ir == 0) {
+        uint64_t best = 0;
+        for (uint32_t start : func.blocks) {
+            if (!placed.count(start) && profile->blockCount(start) > best) {
+                best = profile->blockCount(start);
+                pc = start;
+            }
+        }
+        if (!best) {
             break;
         }
+    }
+    for (uint32_t start : func.blocks) {
+        if (!placed.count(start)) {
+            order.push_back(start);
+        }
+    }
+    return order;
+}
+
+std::string Generator::branchJump(uint32_t pc, const std::string &cond) {
+    auto it = branchIndex.find(pc);
+    if (it != branchIndex.end()) {
+        fprintf(fp, "taken_counts[%d] += (%s);\n", it->second, cond.data());
+    }
+
+    if (profile) {
+        uint64_t total = profile->blockCount(currentBlock);
+        uint64_t taken = profile->takenCount(pc);
+        if (total && taken * 5 >= total * 4) {
+            return "if (__builtin_expect(!!(" + cond + "), 1)) ";
+        }
+        if (total && taken * 5 <= total) {
+            return "if (__builtin_expect(!!(" + cond + "), 0)) ";
+        }
+    }
+    return "if (" + cond + ") ";
+}
+
+void Generator::generateFunction(const Function &func) {
+    function = &func;
+
+    // Only the registers the function touches live in locals
+    usedRegs = 0;
+    writtenRegs = 0;
+    for (uint32_t start : func.blocks) {
+        const auto &block = analyzer->blocks().at(start);
+        for (uint32_t pc = block.start; pc < block.end; pc += 4) {
+            Instruction inst(analyzer->load4(pc));
+            switch (inst.opcode()) {
+                case Instruction::STORE:
+                case Instruction::BRANCH:
+                    usedRegs |= (1u << inst.rs1()) | (1u << inst.rs2());
+                    break;
+                case Instruction::MISC_MEM:
+                    break;
+                case Instruction::LUI:
+                case Instruction::AUIPC:
+                case Instruction::JAL:
+                    writtenRegs |= 1u << inst.rd();
+                    break;
+                case Instruction::OP:
+                case Instruction::AMO:
+                    usedRegs |= (1u << inst.rs1()) | (1u << inst.rs2());
+                    writtenRegs |= 1u << inst.rd();
+                    break;
+                default:
+                    usedRegs |= 1u << inst.rs1();
+                    writtenRegs |= 1u << inst.rd();
+                    break;
+            }
+        }
+    }
+    usedRegs = (usedRegs | writtenRegs) & ~1u;
+    writtenRegs &= ~1u;
+
+    // Functions that never ran go to the cold section
+    bool cold = profile != nullptr;
+    for (uint32_t start : func.blocks) {
+        cold = cold && !profile->blockCount(start);
+    }
+    auto symbol = symbols.find(func.entry);
+    if (symbol != symbols.end()) {
+        std::string name;
+        for (char c : symbol->second) {
+            name += (c >= 0x20 && c < 0x7f && c != '\\') ? c : '?';
+        }
+        fprintf(fp, "// %s\n", name.data());
+    }
+    fprintf(fp, "%s%suint32_t fn_%s(RV32Core &core, uint32_t pc) {\n\n", cold ? "__attribute__((cold)) " : "",
+            shardFiles.empty() ? "static " : "", dec2hex(func.entry).data());
+
+    // Next guest pc, returned to the caller once it isn't in this function
+    fprintf(fp, "uint32_t next_pc = 0;\n");
+
+    // RAM of the guest, the instances of a batch run on their own
+    fprintf(fp, "uint8_t *const image = core.image;\n\n");
+
+    for (int i = 1; i < 32; ++i) {
+        if (usedRegs & (1u << i)) {
+            fprintf(fp, "uint32_t x%d = core.regs[%d];\n", i, i);
+        }
+    }
+    fprintf(fp, "\n");
+
+    // Indirect targets and resume points of this function sorted by address, looked up by binary search
+    std::vector<uint32_t> targets;
+    for (uint32_t pc : dispatchTargets) {
+        if (func.blocks.count(pc)) {
+            targets.push_back(pc);
+        }
+    }
+    if (!targets.empty()) {
+        fprintf(fp, "static const uint32_t target_pcs[] = {\n");
+        for (uint32_t pc : targets) {
+            fprintf(fp, "    0x%s,\n", dec2hex(pc).data());
+        }
+        fprintf(fp, "};\n");
+        fprintf(fp, "static void *const target_labels[] = {\n");
+        for (uint32_t pc : targets) {
+            fprintf(fp, "    &&lab_%s,\n", dec2hex(pc).data());
+        }
+        fprintf(fp, "};\n\n");
+    }
+
+    fprintf(fp, "if (pc == 0x%x) goto lab_%s;\n", func.entry, dec2hex(func.entry).data());
+    fprintf(fp, "next_pc = pc;\n");
+    fprintf(fp, "goto lab_dispatch;\n\n");
+
+    auto order = layout(func);
+    for (auto it = order.begin(); it != order.end(); ++it) {
+        const auto &block = analyzer->blocks().at(*it);
+        currentBlock = block.start;
 
         // Add block start
-        fprintf(fp, "lab_%s: {\n", dec2hex(pc).data());
-        fprintf(fp, "    // IR: %s\n", dec2hex(ir, 8).data());
+        if (profile && !cold && !profile->blockCount(block.start)) {
+            fprintf(fp, "lab_%s: __attribute__((cold));\n", dec2hex(block.start).data());
+        } else {
+            fprintf(fp, "lab_%s:\n", dec2hex(block.start).data());
+        }
+        if (blockIndex.count(block.start)) {
+            fprintf(fp, "++block_counts[%d];\n", blockIndex[block.start]);
+        }
+        RegState state = analyzer->blockState(block.start);
+        uint32_t ir = 0;
+        retiredPc = block.start;
+        for (uint32_t pc = block.start; pc < block.end; pc += 4) {
+            ir = analyzer->load4(pc);
+
+            // The block is counted once before it's left, CSRs read the count of the instructions before them
+            Instruction inst(ir);
+            bool leaves = inst.opcode() == Instruction::JAL || inst.opcode() == Instruction::JALR ||
+                          inst.opcode() == Instruction::BRANCH || inst.isMret() || inst.isWfi();
+            if (leaves || (inst.opcode() == Instruction::SYSTEM && (inst.funct3() & 3))) {
+                uint32_t end = leaves ? pc + 4 : pc;
+                generateRetire(end);
+                retiredPc = end;
+            }
+            generateInstruction(pc, ir, state);
+            analyzer->step(state, pc, ir);
+        }
+        generateRetire(block.end);
 
-        uint32_t rdid = (ir >> 7) & 0x1f;
+        // Execution leaves the function or runs off the end of the discovered code
+        auto op = Instruction(ir).opcode();
+        auto next = std::next(it);
+        if (op != Instruction::JAL && op != Instruction::JALR && (next == order.end() || *next != block.end)) {
+            generateJump(block.end, "");
+        }
+        fprintf(fp, "\n");
+    }
 
-        // uint32_t rval = 0;
+    // Jump to an address that isn't a block of this function
+    fprintf(fp, "lab_dispatch:\n");
+    if (polling) {
+        fprintf(fp, "    if (__builtin_expect(core.mstatus & 8, 0) && next_pc != EXIT_PC && "
+                    "interrupt_take(core, next_pc)) next_pc = core.pc;\n");
+    }
+    if (!targets.empty()) {
+        fprintf(fp, "    { int i = find_target(target_pcs, %d, next_pc); if (i >= 0) goto *target_labels[i]; }\n",
+                (int) targets.size());
+    }
+    fprintf(fp, "\n");
 
-        // Add define rval
-        fprintf(fp, "uint32_t rval = 0;\n");
+    // Write registers back
+    fprintf(fp, "lab_exit:\n");
+    writeBack();
+    fprintf(fp, "    return next_pc;\n");
+    fprintf(fp, "}\n\n");
 
-        switch (ir & 0x7f) {
-            case 0b0110111: // LUI
-                fprintf(fp, "// LUI\n");
+    function = nullptr;
+}
 
-                // rval = (ir & 0xfffff000);
+void Generator::writeBack() {
+    for (int i = 1; i < 32; ++i) {
+        if (writtenRegs & (1u << i)) {
+            fprintf(fp, "    core.regs[%d] = x%d;\n", i, i);
+        }
+    }
+}
 
-                // Add rval assign
-                fprintf(fp, "rval = 0x%x;\n", (ir & 0xfffff000));
-                break;
-            case 0b0010111: // AUIPC
-                fprintf(fp, "// AUIPC\n");
+void Generator::reload() {
+    for (int i = 1; i < 32; ++i) {
+        if (usedRegs & (1u << i)) {
+            fprintf(fp, "    x%d = core.regs[%d];\n", i, i);
+        }
+    }
+}
 
+void Generator::generateCall(uint32_t pc, uint32_t target) {
+    // Registers are shared with the callee through the core
+    writeBack();
 
-                // rval = pc + (ir & 0xfffff000);
+    // Calls nest on the host stack up to a depth, deeper ones go to the callee like a jump. It's then either in this
+    // function or the caller, up to run(), dispatches it, and the return is dispatched like an indirect jump.
+    std::string callee = "dispatch(core, next_pc)";
+    if (target) {
+        callee = "fn_" + dec2hex(target) + "(core, 0x" + dec2hex(target) + ")";
+    }
+    fprintf(fp, "if (__builtin_expect(core.depth >= MAX_CALL_DEPTH, 0)) {\n");
+    if (target) {
+        fprintf(fp, "    next_pc = 0x%x;\n", target);
+    }
+    fprintf(fp, "    goto lab_dispatch;\n"
+                "}\n"
+                "++core.depth;\n"
+                "next_pc = %s;\n"
+                "--core.depth;\n",
+            callee.data());
+    reload();
+
+    // Any other pc than the return site is dispatched like an indirect jump
+    fprintf(fp, "if (next_pc != 0x%x) goto lab_dispatch;\n", pc + 4);
+    generateJump(pc + 4, "");
+}
 
-                // Add rval assign
-                fprintf(fp, "rval = 0x%x;\n", pc + (ir & 0xfffff000));
-                break;
-            case 0b1101111: // JAL
-            {
-                fprintf(fp, "// JAL\n");
+void Generator::setReadOnlyRanges(const std::vector<AddressRange> &ranges) {
+    readOnlyRanges = ranges;
+}
 
-                int32_t reladdy = ((ir & 0x80000000) >> 11) | ((ir & 0x7fe00000) >> 20) | ((ir & 0x00100000) >> 9) |
-                                  ((ir & 0x000ff000));
-                if (reladdy & 0x00100000)
-                    reladdy |= 0xffe00000; // Sign extension.
-                // rval = pc + 4;
+std::string Generator::reg(uint32_t n) {
+    return n ? "x" + std::to_string(n) : "0";
+}
 
-                // Add rval assign
-                fprintf(fp, "rval = 0x%x;\n", pc + 4);
+void Generator::error(uint32_t pc) {
+    // Reported once translation is done, the lowest pc no matter which thread hits it first
+    errorPc = hasError ? std::min(errorPc, pc) : pc;
+    hasError = true;
+}
 
-                // pc = pc + reladdy - 4;
-                jal_pc = pc + reladdy - 4;
-                break;
-            }
-            case 0b1100111: // JALR
-            {
-                fprintf(fp, "// JALR\n");
+bool Generator::pollTarget(uint32_t pc, uint32_t ir, uint32_t &target) const {
+    if (!polling && !shared) {
+        return false;
+    }
+    Instruction inst(ir);
+    switch (inst.opcode()) {
+        case Instruction::JAL:
+            // Calls aren't loops
+            target = pc + inst.immJ();
+            return target <= pc && !(inst.rd() == 1 && analyzer->functions().count(target));
+        case Instruction::BRANCH:
+            target = pc + inst.immB();
+            return target <= pc;
+        case Instruction::SYSTEM:
+            target = pc + 4;
+            return inst.isWfi();
+        default:
+            return false;
+    }
+}
 
-                uint32_t imm = ir >> 20;
-                int32_t imm_se = imm | ((imm & 0x800) ? 0xfffff000 : 0);
+void Generator::generatePoll(uint32_t pc) {
+    if (shared) {
+        fprintf(fp, "    std::atomic_signal_fence(std::memory_order_seq_cst);\n");
+    }
+    if (!polling) {
+        return;
+    }
+    fprintf(fp,
+            "    if (__builtin_expect(core.mstatus & 8, 0) && interrupt_take(core, 0x%x)) {\n"
+            "        next_pc = core.pc;\n"
+            "        goto lab_dispatch;\n"
+            "    }\n",
+            pc);
+}
 
-                // rval = pc + 4;
+void Generator::generateRetire(uint32_t end) {
+    if (end > retiredPc) {
+        fprintf(fp, "core_retire(core, %u);\n", (end - retiredPc) / 4);
+    }
+}
 
-                // Add rval assign
-                fprintf(fp, "rval = 0x%x;\n", pc + 4);
+void Generator::generateTrap(uint32_t pc, const std::string &cause, const std::string &tval) {
+    generateRetire(pc);
+    fprintf(fp,
+            "core.pc = 0x%x;\n"
+            "if (trap_take(core, %s, %s)) {\n"
+            "    next_pc = core.pc;\n"
+            "    goto lab_dispatch;\n"
+            "}\n"
+            "exit_code = -1;\n"
+            "next_pc = EXIT_PC;\n"
+            "goto lab_exit;\n",
+            pc, cause.data(), tval.data());
+}
 
-                // pc = ((REG((ir >> 15) & 0x1f) + imm_se) & ~1) - 4;
-                // No need to minus 4
-                fprintf(fp, "uint32_t pc = ((core.regs[%d] + (uint32_t) 0x%x) & ~1);\n", (ir >> 15) & 0x1f, imm_se);
-                jalr = true;
+void Generator::generateJump(uint32_t target, const std::string &cond, bool poll) {
+    if (function->blocks.count(target) && poll) {
+        fprintf(fp, "%s{\n", cond.data());
+        generatePoll(target);
+        fprintf(fp, "    goto lab_%s;\n", dec2hex(target).data());
+        fprintf(fp, "}\n");
+    } else if (function->blocks.count(target)) {
+        fprintf(fp, "%sgoto lab_%s;\n", cond.data(), dec2hex(target).data());
+    } else if (analyzer->functions().count(target)) {
+        // Tail call
+        fprintf(fp, "%s{\n", cond.data());
+        if (poll) {
+            generatePoll(target);
+        }
+        writeBack();
+        fprintf(fp,
+                "#if TAIL_CALLS\n"
+                "    __attribute__((musttail)) return fn_%s(core, 0x%x);\n"
+                "#else\n"
+                "    return 0x%x;\n"
+                "#endif\n"
+                "}\n",
+                dec2hex(target).data(), target, target);
+    } else {
+        // Out of the function
+        fprintf(fp, "%s{ next_pc = 0x%x; goto lab_dispatch; }\n", cond.data(), target);
+    }
+}
 
-                break;
+std::string Generator::src(const RegState &state, uint32_t n) {
+    return state.isKnown(n) ? "0x" + dec2hex(state.values[n]) : reg(n);
+}
+
+void Generator::generateInstruction(uint32_t pc, uint32_t ir, const RegState &state) {
+    std::string if_jump;
+    uint32_t jal_pc = 0;
+    bool jalr = false;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "    // IR: %s\n", dec2hex(ir, 8).data());
+
+    uint32_t rdid = (ir >> 7) & 0x1f;
+
+    // Results known at translation time, including loads from read-only data
+    switch (ir & 0x7f) {
+        case 0b0110111: // LUI
+        case 0b0010111: // AUIPC
+        case 0b0000011: // Load
+        case 0b0010011: // Op-immediate
+        case 0b0110011: // Op
+        {
+            RegState after = state;
+            analyzer->step(after, pc, ir);
+            if (rdid && after.isKnown(rdid)) {
+                fprintf(fp, "// Folded\n");
+                fprintf(fp, "%s = 0x%x;\n", reg(rdid).data(), after.values[rdid]);
+                fprintf(fp, "}\n");
+                return;
             }
-            case 0b1100011: // Branch
-            {
-                fprintf(fp, "// Branch\n");
-
-                uint32_t immm4 =
-                    ((ir & 0xf00) >> 7) | ((ir & 0x7e000000) >> 20) | ((ir & 0x80) << 4) | ((ir >> 31) << 12);
-                if (immm4 & 0x1000)
-                    immm4 |= 0xffffe000;
-
-                // int32_t rs1 = REG((ir >> 15) & 0x1f);
-                // int32_t rs2 = REG((ir >> 20) & 0x1f);
-
-                // Add read reg
-                fprintf(fp, "int32_t rs1 = core.regs[%d];\n", (ir >> 15) & 0x1f);
-                fprintf(fp, "int32_t rs2 = core.regs[%d];\n", (ir >> 20) & 0x1f);
-
-                immm4 = pc + immm4 - 4;
-                rdid = 0;
-                switch ((ir >> 12) & 0x7) {
-                    // BEQ, BNE, BLT, BGE, BLTU, BGEU
-                    case 0b000:
-                        // if (rs1 == rs2)
-                        //     pc = immm4;
+            break;
+        }
+        case 0b1100011: // Branch
+        {
+            Instruction inst(ir);
+            if (state.isKnown(inst.rs1()) && state.isKnown(inst.rs2())) {
+                fprintf(fp, "// Folded branch\n");
+                if (Analyzer::branchTaken(inst.funct3(), state.values[inst.rs1()], state.values[inst.rs2()])) {
+                    uint32_t resume;
+                    generateJump(pc + inst.immB(), "", pollTarget(pc, ir, resume));
+                }
+                fprintf(fp, "}\n");
+                return;
+            }
+            break;
+        }
+        default:
+            break;
+    }
 
-                        // Add jump
-                        if_jump = "if (rs1 == rs2) ";
-                        jal_pc = immm4;
-                        break;
+    // uint32_t rval = 0;
 
-                    case 0b001:
-                        // if (rs1 != rs2)
-                        //     pc = immm4;
+    // Add define rval
+    fprintf(fp, "uint32_t rval = 0;\n");
 
-                        // Add jump
-                        if_jump = "if (rs1 != rs2) ";
-                        jal_pc = immm4;
-                        break;
+    switch (ir & 0x7f) {
+        case 0b0110111: // LUI
+            fprintf(fp, "// LUI\n");
 
-                    case 0b100:
-                        // if (rs1 < rs2)
-                        //     pc = immm4;
+            // rval = (ir & 0xfffff000);
 
-                        // Add jump
-                        if_jump = "if (rs1 < rs2) ";
-                        jal_pc = immm4;
-                        break;
+            // Add rval assign
+            fprintf(fp, "rval = 0x%x;\n", (ir & 0xfffff000));
+            break;
+        case 0b0010111: // AUIPC
+            fprintf(fp, "// AUIPC\n");
 
-                    case 0b101:
-                        // if (rs1 >= rs2)
-                        //     pc = immm4;
 
-                        // Add jump
-                        if_jump = "if (rs1 >= rs2) ";
-                        jal_pc = immm4;
-                        break; // BGE
+            // rval = pc + (ir & 0xfffff000);
 
-                    case 0b110:
-                        // if ((uint32_t) rs1 < (uint32_t) rs2)
-                        //     pc = immm4;
+            // Add rval assign
+            fprintf(fp, "rval = 0x%x;\n", pc + (ir & 0xfffff000));
+            break;
+        case 0b1101111: // JAL
+        {
+            fprintf(fp, "// JAL\n");
 
-                        // Add jump
-                        if_jump = "if ((uint32_t) rs1 < (uint32_t) rs2)) ";
-                        jal_pc = immm4;
-                        break; // BLTU
+            int32_t reladdy = ((ir & 0x80000000) >> 11) | ((ir & 0x7fe00000) >> 20) | ((ir & 0x00100000) >> 9) |
+                              ((ir & 0x000ff000));
+            if (reladdy & 0x00100000)
+                reladdy |= 0xffe00000; // Sign extension.
+            // rval = pc + 4;
 
-                    case 0b111:
-                        // if ((uint32_t) rs1 >= (uint32_t) rs2)
-                        //     pc = immm4;
+            // Add rval assign
+            fprintf(fp, "rval = 0x%x;\n", pc + 4);
 
-                        // Add jump
-                        if_jump = "if ((uint32_t) rs1 >= (uint32_t) rs2)) ";
-                        jal_pc = immm4;
-                        break; // BGEU
+            // pc = pc + reladdy - 4;
+            jal_pc = pc + reladdy - 4;
+            break;
+        }
+        case 0b1100111: // JALR
+        {
+            fprintf(fp, "// JALR\n");
 
-                    default:
-                        // trap = (2 + 1);
-                        error(pc);
-                        break;
+            uint32_t imm = ir >> 20;
+            int32_t imm_se = imm | ((imm & 0x800) ? 0xfffff000 : 0);
+
+            // rval = pc + 4;
+
+            // Add rval assign
+            fprintf(fp, "rval = 0x%x;\n", pc + 4);
+
+            // pc = ((REG((ir >> 15) & 0x1f) + imm_se) & ~1) - 4;
+            // No need to minus 4
+            fprintf(fp, "next_pc = ((%s + (uint32_t) 0x%x) & ~1);\n", src(state, (ir >> 15) & 0x1f).data(), imm_se);
+            jalr = true;
+
+            break;
+        }
+        case 0b1100011: // Branch
+        {
+            fprintf(fp, "// Branch\n");
+
+            uint32_t immm4 =
+                ((ir & 0xf00) >> 7) | ((ir & 0x7e000000) >> 20) | ((ir & 0x80) << 4) | ((ir >> 31) << 12);
+            if (immm4 & 0x1000)
+                immm4 |= 0xffffe000;
+
+            // int32_t rs1 = REG((ir >> 15) & 0x1f);
+            // int32_t rs2 = REG((ir >> 20) & 0x1f);
+
+            // Add read reg
+            fprintf(fp, "int32_t rs1 = %s;\n", src(state, (ir >> 15) & 0x1f).data());
+            fprintf(fp, "int32_t rs2 = %s;\n", src(state, (ir >> 20) & 0x1f).data());
+
+            immm4 = pc + immm4 - 4;
+            rdid = 0;
+            switch ((ir >> 12) & 0x7) {
+                // BEQ, BNE, BLT, BGE, BLTU, BGEU
+                case 0b000:
+                    // if (rs1 == rs2)
+                    //     pc = immm4;
+
+                    // Add jump
+                    if_jump = branchJump(pc, "rs1 == rs2");
+                    jal_pc = immm4;
+                    break;
+
+                case 0b001:
+                    // if (rs1 != rs2)
+                    //     pc = immm4;
+
+                    // Add jump
+                    if_jump = branchJump(pc, "rs1 != rs2");
+                    jal_pc = immm4;
+                    break;
+
+                case 0b100:
+                    // if (rs1 < rs2)
+                    //     pc = immm4;
+
+                    // Add jump
+                    if_jump = branchJump(pc, "rs1 < rs2");
+                    jal_pc = immm4;
+                    break;
+
+                case 0b101:
+                    // if (rs1 >= rs2)
+                    //     pc = immm4;
+
+                    // Add jump
+                    if_jump = branchJump(pc, "rs1 >= rs2");
+                    jal_pc = immm4;
+                    break; // BGE
+
+                case 0b110:
+                    // if ((uint32_t) rs1 < (uint32_t) rs2)
+                    //     pc = immm4;
+
+                    // Add jump
+                    if_jump = branchJump(pc, "(uint32_t) rs1 < (uint32_t) rs2");
+                    jal_pc = immm4;
+                    break; // BLTU
+
+                case 0b111:
+                    // if ((uint32_t) rs1 >= (uint32_t) rs2)
+                    //     pc = immm4;
+
+                    // Add jump
+                    if_jump = branchJump(pc, "(uint32_t) rs1 >= (uint32_t) rs2");
+                    jal_pc = immm4;
+                    break; // BGEU
+
+                default:
+                    // trap = (2 + 1);
+                    error(pc);
+                    break;
+            }
+            break;
+        }
+        case 0b0000011: // Load
+        {
+            fprintf(fp, "// Load\n");
+
+            uint32_t imm = ir >> 20;
+            int32_t imm_se = imm | ((imm & 0x800) ? 0xfffff000 : 0);
+
+            // uint32_t rs1 = REG((ir >> 15) & 0x1f);
+            // uint32_t rsval = rs1 + imm_se;
+
+            // Add read reg
+            fprintf(fp, "uint32_t rs1 = %s;\n", src(state, (ir >> 15) & 0x1f).data());
+            fprintf(fp, "uint32_t rsval = rs1 + (int32_t) %d;\n", imm_se);
+
+            // rsval -= MINIRV32_RAM_IMAGE_OFFSET;
+            fprintf(fp, "rsval -= MINIRV32_RAM_IMAGE_OFFSET;\n");
+
+            // if (rsval >= MINI_RV32_RAM_SIZE - 3) {
+            // Ignore
+
+            // rsval += MINIRV32_RAM_IMAGE_OFFSET;
+            // if (rsval >= 0x10000000 && rsval < 0x12000000) // UART, CLNT
+            // {
+            //     if (rsval == 0x1100bffc) // https://chromitem-soc.readthedocs.io/en/latest/clint.html
+            //         rval = CSR(timerh);
+            //     else if (rsval == 0x1100bff8)
+            //         rval = CSR(timerl);
+            //     else
+            //         handleMemLoadControl(rsval, rval);
+            // } else {
+            //     trap = (5 + 1);
+            //     rval = rsval;
+            // }
+            // } else {
+
+            // Device registers at addresses known here, the devices are at fixed addresses outside of RAM
+            static const char *const types[] = {"int8_t", "int16_t", "uint32_t", "", "uint8_t", "uint16_t"};
+            uint32_t funct3 = (ir >> 12) & 0x7;
+            uint32_t rs1id = (ir >> 15) & 0x1f;
+            uint32_t addr = state.values[rs1id] + imm_se;
+            if (state.isKnown(rs1id) && addr >= MMIO_BEGIN && addr < MMIO_END) {
+                if (funct3 > 0b101 || funct3 == 0b011) {
+                    error(pc);
+                    break;
                 }
+                fprintf(fp, "if (MINIRV32_HANDLE_MEM_LOAD_CONTROL(core, 0x%x, rval) != MMIO_OK) {\n", addr);
+                generateTrap(pc, "TRAP_LOAD_FAULT", "0x" + dec2hex(addr));
+                fprintf(fp, "}\n");
+                fprintf(fp, "rval = (uint32_t) (%s) rval;\n", types[funct3]);
                 break;
             }
-            case 0b0000011: // Load
-            {
-                fprintf(fp, "// Load\n");
-
-                uint32_t imm = ir >> 20;
-                int32_t imm_se = imm | ((imm & 0x800) ? 0xfffff000 : 0);
-
-                // uint32_t rs1 = REG((ir >> 15) & 0x1f);
-                // uint32_t rsval = rs1 + imm_se;
-
-                // Add read reg
-                fprintf(fp, "uint32_t rs1 = core.regs[%d];\n", (ir >> 15) & 0x1f);
-                fprintf(fp, "uint32_t rsval = rs1 + (int32_t) %d;\n", imm_se);
-
-                // rsval -= MINIRV32_RAM_IMAGE_OFFSET;
-                fprintf(fp, "rsval -= MINIRV32_RAM_IMAGE_OFFSET;\n");
-
-                // if (rsval >= MINI_RV32_RAM_SIZE - 3) {
-                // Ignore
-
-                // rsval += MINIRV32_RAM_IMAGE_OFFSET;
-                // if (rsval >= 0x10000000 && rsval < 0x12000000) // UART, CLNT
-                // {
-                //     if (rsval == 0x1100bffc) // https://chromitem-soc.readthedocs.io/en/latest/clint.html
-                //         rval = CSR(timerh);
-                //     else if (rsval == 0x1100bff8)
-                //         rval = CSR(timerl);
-                //     else
-                //         handleMemLoadControl(rsval, rval);
-                // } else {
-                //     trap = (5 + 1);
-                //     rval = rsval;
-                // }
-                // } else {
-
-                switch ((ir >> 12) & 0x7) {
-                    // LB, LH, LW, LBU, LHU
+
+            // Other loads the analysis doesn't prove to read RAM check for the devices, like the stores
+            bool device = !state.isRam(rs1id) && !state.isKnown(rs1id) && funct3 <= 0b101 && funct3 != 0b011;
+            if (device) {
+                fprintf(fp, "if (is_mmio(rsval)) {\n"
+                            "    uint32_t addr = rsval + MINIRV32_RAM_IMAGE_OFFSET;\n"
+                            "    if (MINIRV32_HANDLE_MEM_LOAD_CONTROL(core, addr, rval) != MMIO_OK) {\n");
+                generateTrap(pc, "TRAP_LOAD_FAULT", "addr");
+                fprintf(fp,
+                        "    }\n"
+                        "    rval = (uint32_t) (%s) rval;\n"
+                        "} else {\n",
+                        types[funct3]);
+            }
+
+            switch ((ir >> 12) & 0x7) {
+                // LB, LH, LW, LBU, LHU
+                case 0b000:
+                    // rval = (int8_t) MINIRV32_LOAD1(rsval);
+
+                    // Add rval assign
+                    fprintf(fp, "rval = (int8_t) MINIRV32_LOAD1(rsval);\n");
+                    break;
+                case 0b001:
+                    // rval = (int16_t) MINIRV32_LOAD2(rsval);
+
+                    // Add rval assign
+                    fprintf(fp, "rval = (int16_t) MINIRV32_LOAD2(rsval);\n");
+                    break;
+                case 0b010:
+                    // rval = MINIRV32_LOAD4(rsval);
+
+                    // Add rval assign
+                    fprintf(fp, "rval = MINIRV32_LOAD4(rsval);\n");
+                    break;
+                case 0b100:
+                    // rval = MINIRV32_LOAD1(rsval);
+
+                    // Add rval assign
+                    fprintf(fp, "rval = MINIRV32_LOAD1(rsval);\n");
+                    break;
+                case 0b101:
+                    // rval = MINIRV32_LOAD2(rsval);
+
+                    // Add rval assign
+                    fprintf(fp, "rval = MINIRV32_LOAD2(rsval);\n");
+                    break;
+                default:
+                    // trap = (2 + 1);
+                    error(pc);
+                    break;
+            }
+            if (device) {
+                fprintf(fp, "}\n");
+            }
+
+            // }
+            break;
+        }
+        case 0b0100011: // Store
+        {
+            fprintf(fp, "// Store\n");
+
+            // uint32_t rs1 = REG((ir >> 15) & 0x1f);
+            // uint32_t rs2 = REG((ir >> 20) & 0x1f);
+
+            // Add read reg
+            fprintf(fp, "uint32_t rs1 = %s;\n", src(state, (ir >> 15) & 0x1f).data());
+            fprintf(fp, "uint32_t rs2 = %s;\n", src(state, (ir >> 20) & 0x1f).data());
+
+            uint32_t addy = ((ir >> 7) & 0x1f) | ((ir & 0xfe000000) >> 20);
+            if (addy & 0x800)
+                addy |= 0xfffff000;
+
+            // addy += rs1 - MINIRV32_RAM_IMAGE_OFFSET;
+            fprintf(fp, "uint32_t addy = (uint32_t) 0x%x + rs1 - MINIRV32_RAM_IMAGE_OFFSET;\n", addy);
+
+            rdid = 0;
+
+            // if (addy >= MINI_RV32_RAM_SIZE - 3) {
+            //     addy += MINIRV32_RAM_IMAGE_OFFSET;
+            //     if (addy >= 0x10000000 && addy < 0x12000000) {
+            //         // Should be stuff like SYSCON, 8250, CLNT
+            //         if (addy == 0x11004004)      // CLNT
+            //             CSR(timermatchh) = rs2;
+            //         else if (addy == 0x11004000) // CLNT
+            //             CSR(timermatchl) = rs2;
+            //         else if (addy == 0x11100000) // SYSCON (reboot, poweroff, etc.)
+            //         {
+            //             SETCSR(pc, pc + 4);
+            //             return rs2; // NOTE: PC will be PC of Syscon.
+            //         } else
+            //             handleMemStoreControl(addy, rs2);
+            //     } else {
+            //         trap = (7 + 1); // Store access fault.
+            //         rval = addy;
+            //     }
+            // } else {
+
+            // Stores the analysis proves to miss the devices, based on RAM pointers or at known addresses, go
+            // straight to memory
+            uint32_t rs1id = (ir >> 15) & 0x1f;
+            uint32_t target = state.values[rs1id] + addy;
+            bool device = !state.isRam(rs1id) &&
+                          !(state.isKnown(rs1id) && (target < MMIO_BEGIN || target >= MMIO_END));
+
+            // Devices stop the guest on SYSCON (reboot, poweroff, etc.) or raise an access fault
+            if (device) {
+                fprintf(fp, "if (is_mmio(addy)) {\n"
+                            "    uint32_t addr = addy + MINIRV32_RAM_IMAGE_OFFSET;\n"
+                            "    int res = MINIRV32_HANDLE_MEM_STORE_CONTROL(core, addr, rs2);\n"
+                            "    if (res == MMIO_STOP) {\n");
+                generateRetire(pc + 4);
+                fprintf(fp,
+                        "        exit_code = (int) rs2;\n"
+                        "        core.pc = 0x%x;\n"
+                        "        next_pc = EXIT_PC;\n"
+                        "        goto lab_exit;\n"
+                        "    }\n"
+                        "    if (res != MMIO_OK) {\n",
+                        pc);
+                generateTrap(pc, "TRAP_STORE_FAULT", "addr");
+                fprintf(fp, "    }\n"
+                            "} else {\n");
+            }
+
+            switch ((ir >> 12) & 0x7) {
+                // SB, SH, SW
+                case 0b000:
+                    // MINIRV32_STORE1(addy, rs2);
+                    fprintf(fp, "MINIRV32_STORE1(addy, rs2);\n");
+                    break;
+                case 0b001:
+                    // MINIRV32_STORE2(addy, rs2);
+                    fprintf(fp, "MINIRV32_STORE2(addy, rs2);\n");
+                    break;
+                case 0b010:
+                    // MINIRV32_STORE4(addy, rs2);
+                    fprintf(fp, "MINIRV32_STORE4(addy, rs2);\n");
+                    break;
+                default:
+                    // trap = (2 + 1);
+                    error(pc);
+                    break;
+            }
+
+            // Stores break the LR.W reservations of the other harts
+            if (shared) {
+                fprintf(fp, "amo_store(image, addy, %u);\n", 1u << ((ir >> 12) & 0x7));
+            }
+            if (device) {
+                fprintf(fp, "}\n");
+            }
+            // }
+            break;
+        }
+        case 0b0010011: // Op-immediate
+        case 0b0110011: // Op
+        {
+            fprintf(fp, "// ALU\n");
+
+            uint32_t imm = ir >> 20;
+            imm = imm | ((imm & 0x800) ? 0xfffff000 : 0);
+            uint32_t is_reg = !!(ir & 0b100000);
+
+            // uint32_t rs1 = REG((ir >> 15) & 0x1f);
+            // uint32_t rs2 = is_reg ? REG(imm & 0x1f) : imm;
+
+            // Add read reg
+            fprintf(fp, "uint32_t rs1 = %s;\n", src(state, (ir >> 15) & 0x1f).data());
+            if (is_reg) {
+                fprintf(fp, "uint32_t rs2 = %s;\n", src(state, imm & 0x1f).data());
+            } else {
+                fprintf(fp, "uint32_t rs2 = 0x%x;\n", imm);
+            }
+
+            if (is_reg && (ir & 0x02000000)) {
+                switch ((ir >> 12) & 7) // 0x02000000 = RV32M
+                {
                     case 0b000:
-                        // rval = (int8_t) MINIRV32_LOAD1(rsval);
+                        // rval = rs1 * rs2;
 
                         // Add rval assign
-                        fprintf(fp, "rval = (int8_t) MINIRV32_LOAD1(rsval);\n");
-                        break;
+                        fprintf(fp, "rval = rs1 * rs2;\n");
+                        break; // MUL
                     case 0b001:
-                        // rval = (int16_t) MINIRV32_LOAD2(rsval);
+                        // rval = ((int64_t) ((int32_t) rs1) * (int64_t) ((int32_t) rs2)) >> 32;
 
                         // Add rval assign
-                        fprintf(fp, "rval = (int16_t) MINIRV32_LOAD2(rsval);\n");
-                        break;
+                        fprintf(fp, "rval = ((int64_t) ((int32_t) rs1) * (int64_t) ((int32_t) rs2)) >> 32;\n");
+                        break; // MULH
                     case 0b010:
-                        // rval = MINIRV32_LOAD4(rsval);
+                        // rval = ((int64_t) ((int32_t) rs1) * (uint64_t) rs2) >> 32;
 
                         // Add rval assign
-                        fprintf(fp, "rval = MINIRV32_LOAD4(rsval);\n");
-                        break;
+                        fprintf(fp, "rval = ((int64_t) ((int32_t) rs1) * (uint64_t) rs2) >> 32;\n");
+                        break; // MULHSU
+                    case 0b011:
+                        // rval = ((uint64_t) rs1 * (uint64_t) rs2) >> 32;
+
+                        // Add rval assign
+                        fprintf(fp, "rval = ((uint64_t) rs1 * (uint64_t) rs2) >> 32;\n");
+                        break; // MULHU
                     case 0b100:
-                        // rval = MINIRV32_LOAD1(rsval);
+                        // if (rs2 == 0)
+                        //     rval = -1;
+                        // else
+                        //     rval = ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1)
+                        //                ? rs1
+                        //                : ((int32_t) rs1 / (int32_t) rs2);
 
                         // Add rval assign
-                        fprintf(fp, "rval = MINIRV32_LOAD1(rsval);\n");
-                        break;
+                        fprintf(fp, "if (rs2 == 0)\n"
+                                    "   rval = -1;\n"
+                                    "else\n"
+                                    "    rval = ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1)\n"
+                                    "               ? rs1\n"
+                                    "               : ((int32_t) rs1 / (int32_t) rs2);\n");
+                        break; // DIV
                     case 0b101:
-                        // rval = MINIRV32_LOAD2(rsval);
+                        // if (rs2 == 0)
+                        //     rval = 0xffffffff;
+                        // else
+                        //     rval = rs1 / rs2;
 
                         // Add rval assign
-                        fprintf(fp, "rval = MINIRV32_LOAD2(rsval);\n");
-                        break;
-                    default:
-                        // trap = (2 + 1);
-                        error(pc);
-                        break;
-                }
+                        fprintf(fp, "if (rs2 == 0)\n"
+                                    "    rval = 0xffffffff;\n"
+                                    "else\n"
+                                    "    rval = rs1 / rs2;\n");
+                        break; // DIVU
+                    case 0b110:
+                        // if (rs2 == 0)
+                        //     rval = rs1;
+                        // else
+                        //     rval = ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1)
+                        //                ? 0
+                        //                : ((uint32_t) ((int32_t) rs1 % (int32_t) rs2));
 
-                // }
-                break;
-            }
-            case 0b0100011: // Store
-            {
-                fprintf(fp, "// Store\n");
-
-                // uint32_t rs1 = REG((ir >> 15) & 0x1f);
-                // uint32_t rs2 = REG((ir >> 20) & 0x1f);
-
-                // Add read reg
-                fprintf(fp, "uint32_t rs1 = core.regs[%d];\n", (ir >> 15) & 0x1f);
-                fprintf(fp, "uint32_t rs2 = core.regs[%d];\n", (ir >> 20) & 0x1f);
-
-                uint32_t addy = ((ir >> 7) & 0x1f) | ((ir & 0xfe000000) >> 20);
-                if (addy & 0x800)
-                    addy |= 0xfffff000;
-
-                // addy += rs1 - MINIRV32_RAM_IMAGE_OFFSET;
-                fprintf(fp, "uint32_t addy = (uint32_t) 0x%x + rs1 - MINIRV32_RAM_IMAGE_OFFSET;\n", addy);
-
-                rdid = 0;
-
-                // if (addy >= MINI_RV32_RAM_SIZE - 3) {
-                //     addy += MINIRV32_RAM_IMAGE_OFFSET;
-                //     if (addy >= 0x10000000 && addy < 0x12000000) {
-                //         // Should be stuff like SYSCON, 8250, CLNT
-                //         if (addy == 0x11004004)      // CLNT
-                //             CSR(timermatchh) = rs2;
-                //         else if (addy == 0x11004000) // CLNT
-                //             CSR(timermatchl) = rs2;
-                //         else if (addy == 0x11100000) // SYSCON (reboot, poweroff, etc.)
-                //         {
-                //             SETCSR(pc, pc + 4);
-                //             return rs2; // NOTE: PC will be PC of Syscon.
-                //         } else
-                //             handleMemStoreControl(addy, rs2);
-                //     } else {
-                //         trap = (7 + 1); // Store access fault.
-                //         rval = addy;
-                //     }
-                // } else {
-
-                fprintf(fp, "if(is_syscon(addy)) //SYSCON (reboot, poweroff, etc.)\n"
-                            "{\n"
-                            "    return rs2; // NOTE: PC will be PC of Syscon.\n"
-                            "}\n");
-
-                switch ((ir >> 12) & 0x7) {
-                    // SB, SH, SW
+                        // Add rval assign
+                        fprintf(fp, "if (rs2 == 0)\n"
+                                    "    rval = rs1;\n"
+                                    "else\n"
+                                    "    rval = ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1)\n"
+                                    "               ? 0\n"
+                                    "               : ((uint32_t) ((int32_t) rs1 %% (int32_t) rs2));\n");
+
+
+                        break; // REM
+                    case 0b111:
+                        // if (rs2 == 0)
+                        //     rval = rs1;
+                        // else
+                        //     rval = rs1 % rs2;
+
+                        // Add rval assign
+                        fprintf(fp, "if (rs2 == 0)\n"
+                                    "    rval = rs1;\n"
+                                    "else\n"
+                                    "    rval = rs1 %% rs2;\n");
+                        break; // REMU
+                }
+            } else {
+                switch ((ir >> 12) & 7) // These could be either op-immediate or op commands.  Be careful.
+                {
                     case 0b000:
-                        // MINIRV32_STORE1(addy, rs2);
-                        fprintf(fp, "MINIRV32_STORE1(addy, rs2);\n");
+                        // rval = (is_reg && (ir & 0x40000000)) ? (rs1 - rs2) : (rs1 + rs2);
+                        if (is_reg && (ir & 0x40000000))
+                            fprintf(fp, "rval = rs1 - rs2;\n");
+                        else
+                            fprintf(fp, "rval = rs1 + rs2;\n");
                         break;
                     case 0b001:
-                        // MINIRV32_STORE2(addy, rs2);
-                        fprintf(fp, "MINIRV32_STORE2(addy, rs2);\n");
+                        // rval = rs1 << (rs2 & 0x1F);
+                        fprintf(fp, "rval = rs1 << (rs2 & 0x1F);\n");
                         break;
                     case 0b010:
-                        // MINIRV32_STORE4(addy, rs2);
-                        fprintf(fp, "MINIRV32_STORE4(addy, rs2);\n");
+                        // rval = (int32_t) rs1 < (int32_t) rs2;
+                        fprintf(fp, "rval = (int32_t) rs1 < (int32_t) rs2;\n");
+                        break;
+                    case 0b011:
+                        // rval = rs1 < rs2;
+                        fprintf(fp, "rval = rs1 < rs2;\n");
+                        break;
+                    case 0b100:
+                        // rval = rs1 ^ rs2;
+                        fprintf(fp, "rval = rs1 ^ rs2;\n");
+                        break;
+                    case 0b101:
+                        // rval = (ir & 0x40000000) ? (((int32_t) rs1) >> (rs2 & 0x1F)) : (rs1 >> (rs2 & 0x1F));
+                        if (ir & 0x40000000)
+                            fprintf(fp, "rval = (((int32_t) rs1) >> (rs2 & 0x1F));\n");
+                        else
+                            fprintf(fp, "rval = (rs1 >> (rs2 & 0x1F));\n");
+                        break;
+                    case 0b110:
+                        // rval = rs1 | rs2;
+                        fprintf(fp, "rval = rs1 | rs2;\n");
                         break;
-                    default:
-                        // trap = (2 + 1);
-                        error(pc);
+                    case 0b111:
+                        // rval = rs1 & rs2;
+                        fprintf(fp, "rval = rs1 & rs2;\n");
                         break;
                 }
-                // }
-                break;
             }
-            case 0b0010011: // Op-immediate
-            case 0b0110011: // Op
-            {
-                fprintf(fp, "// ALU\n");
-
-                uint32_t imm = ir >> 20;
-                imm = imm | ((imm & 0x800) ? 0xfffff000 : 0);
-                uint32_t is_reg = !!(ir & 0b100000);
-
-                // uint32_t rs1 = REG((ir >> 15) & 0x1f);
-                // uint32_t rs2 = is_reg ? REG(imm & 0x1f) : imm;
-
-                // Add read reg
-                fprintf(fp, "uint32_t rs1 = core.regs[%d];\n", (ir >> 15) & 0x1f);
-                if (is_reg) {
-                    fprintf(fp, "uint32_t rs2 = core.regs[%d];\n", imm & 0x1f);
-                } else {
-                    fprintf(fp, "uint32_t rs2 = 0x%x;\n", imm);
-                }
-
-                if (is_reg && (ir & 0x02000000)) {
-                    switch ((ir >> 12) & 7) // 0x02000000 = RV32M
-                    {
-                        case 0b000:
-                            // rval = rs1 * rs2;
-
-                            // Add rval assign
-                            fprintf(fp, "rval = rs1 * rs2;\n");
-                            break; // MUL
-                        case 0b001:
-                            // rval = ((int64_t) ((int32_t) rs1) * (int64_t) ((int32_t) rs2)) >> 32;
-
-                            // Add rval assign
-                            fprintf(fp, "rval = ((int64_t) ((int32_t) rs1) * (int64_t) ((int32_t) rs2)) >> 32;\n");
-                            break; // MULH
-                        case 0b010:
-                            // rval = ((int64_t) ((int32_t) rs1) * (uint64_t) rs2) >> 32;
-
-                            // Add rval assign
-                            fprintf(fp, "rval = ((int64_t) ((int32_t) rs1) * (uint64_t) rs2) >> 32;\n");
-                            break; // MULHSU
-                        case 0b011:
-                            // rval = ((uint64_t) rs1 * (uint64_t) rs2) >> 32;
-
-                            // Add rval assign
-                            fprintf(fp, "rval = ((uint64_t) rs1 * (uint64_t) rs2) >> 32;\n");
-                            break; // MULHU
-                        case 0b100:
-                            // if (rs2 == 0)
-                            //     rval = -1;
-                            // else
-                            //     rval = ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1)
-                            //                ? rs1
-                            //                : ((int32_t) rs1 / (int32_t) rs2);
-
-                            // Add rval assign
-                            fprintf(fp, "if (rs2 == 0)\n"
-                                        "   rval = -1;\n"
-                                        "else\n"
-                                        "    rval = ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1)\n"
-                                        "               ? rs1\n"
-                                        "               : ((int32_t) rs1 / (int32_t) rs2);\n");
-                            break; // DIV
-                        case 0b101:
-                            // if (rs2 == 0)
-                            //     rval = 0xffffffff;
-                            // else
-                            //     rval = rs1 / rs2;
-
-                            // Add rval assign
-                            fprintf(fp, "if (rs2 == 0)\n"
-                                        "    rval = 0xffffffff;\n"
-                                        "else\n"
-                                        "    rval = rs1 / rs2;\n");
-                            break; // DIVU
-                        case 0b110:
-                            // if (rs2 == 0)
-                            //     rval = rs1;
-                            // else
-                            //     rval = ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1)
-                            //                ? 0
-                            //                : ((uint32_t) ((int32_t) rs1 % (int32_t) rs2));
-
-                            // Add rval assign
-                            fprintf(fp, "if (rs2 == 0)\n"
-                                        "    rval = rs1;\n"
-                                        "else\n"
-                                        "    rval = ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1)\n"
-                                        "               ? 0\n"
-                                        "               : ((uint32_t) ((int32_t) rs1 %% (int32_t) rs2));\n");
-
-
-                            break; // REM
-                        case 0b111:
-                            // if (rs2 == 0)
-                            //     rval = rs1;
-                            // else
-                            //     rval = rs1 % rs2;
-
-                            // Add rval assign
-                            fprintf(fp, "if (rs2 == 0)\n"
-                                        "    rval = rs1;\n"
-                                        "else\n"
-                                        "    rval = rs1 %% rs2;\n");
-                            break; // REMU
-                    }
-                } else {
-                    switch ((ir >> 12) & 7) // These could be either op-immediate or op commands.  Be careful.
-                    {
-                        case 0b000:
-                            // rval = (is_reg && (ir & 0x40000000)) ? (rs1 - rs2) : (rs1 + rs2);
-                            if (is_reg && (ir & 0x40000000))
-                                fprintf(fp, "rval = rs1 - rs2;\n");
-                            else
-                                fprintf(fp, "rval = rs1 + rs2;\n");
-                            break;
-                        case 0b001:
-                            // rval = rs1 << (rs2 & 0x1F);
-                            fprintf(fp, "rval = rs1 << (rs2 & 0x1F);\n");
-                            break;
-                        case 0b010:
-                            // rval = (int32_t) rs1 < (int32_t) rs2;
-                            fprintf(fp, "rval = (int32_t) rs1 < (int32_t) rs2;\n");
-                            break;
-                        case 0b011:
-                            // rval = rs1 < rs2;
-                            fprintf(fp, "rval = rs1 < rs2;\n");
-                            break;
-                        case 0b100:
-                            // rval = rs1 ^ rs2;
-                            fprintf(fp, "rval = rs1 ^ rs2;\n");
-                            break;
-                        case 0b101:
-                            // rval = (ir & 0x40000000) ? (((int32_t) rs1) >> (rs2 & 0x1F)) : (rs1 >> (rs2 & 0x1F));
-                            if (ir & 0x40000000)
-                                fprintf(fp, "rval = (((int32_t) rs1) >> (rs2 & 0x1F));\n");
-                            else
-                                fprintf(fp, "rval = (rs1 >> (rs2 & 0x1F));\n");
-                            break;
-                        case 0b110:
-                            // rval = rs1 | rs2;
-                            fprintf(fp, "rval = rs1 | rs2;\n");
-                            break;
-                        case 0b111:
-                            // rval = rs1 & rs2;
-                            fprintf(fp, "rval = rs1 & rs2;\n");
-                            break;
-                    }
-                }
-                break;
+            break;
+        }
+        case 0b0001111:
+            rdid = 0;
+
+            // FENCE orders the accesses of this hart for the others, FENCE.I means code in RAM may have changed
+            // under the JIT
+            if (((ir >> 12) & 0b111) == 0b000) {
+                fprintf(fp, "std::atomic_thread_fence(std::memory_order_seq_cst);\n");
+            } else if (((ir >> 12) & 0b111) == 0b001) {
+                fprintf(fp, "jit_flush();\n");
             }
-            case 0b0001111:
-                rdid = 0; // fencetype = (ir >> 12) & 0b111; We ignore fences in this impl.
+            break;
+        case 0b1110011: // Zicsr, traps
+        {
+            uint32_t funct3 = (ir >> 12) & 0x7;
+            if (funct3 & 3) {
+                fprintf(fp, "// Zicsr\n");
+
+                // The immediate forms take the rs1 field as the value
+                uint32_t rs1imm = (ir >> 15) & 0x1f;
+                std::string value = (funct3 & 4) ? std::to_string(rs1imm) : src(state, rs1imm);
+                fprintf(fp, "rval = csr_access(core, 0x%x, %s);\n", ir, value.data());
                 break;
-            // case 0b1110011: // Zifencei+Zicsr
-            // {
-            //     uint32_t csrno = ir >> 20;
-            //     int microop = (ir >> 12) & 0b111;
-            //     if ((microop & 3)) // It's a Zicsr function.
-            //     {
-            //         int rs1imm = (ir >> 15) & 0x1f;
-            //         uint32_t rs1 = REG(rs1imm);
-            //         uint32_t writeval = rs1;
-
-            //         // https://raw.githubusercontent.com/riscv/virtual-memory/main/specs/663-Svpbmt.pdf
-            //         // Generally, support for Zicsr
-            //         switch (csrno) {
-            //             case 0x340:
-            //                 rval = CSR(mscratch);
-            //                 break;
-            //             case 0x305:
-            //                 rval = CSR(mtvec);
-            //                 break;
-            //             case 0x304:
-            //                 rval = CSR(mie);
-            //                 break;
-            //             case 0xC00:
-            //                 rval = CSR(cyclel);
-            //                 break;
-            //             case 0x344:
-            //                 rval = CSR(mip);
-            //                 break;
-            //             case 0x341:
-            //                 rval = CSR(mepc);
-            //                 break;
-            //             case 0x300:
-            //                 rval = CSR(mstatus);
-            //                 break; // mstatus
-            //             case 0x342:
-            //                 rval = CSR(mcause);
-            //                 break;
-            //             case 0x343:
-            //                 rval = CSR(mtval);
-            //                 break;
-            //             case 0xf11:
-            //                 rval = 0xff0ff0ff;
-            //                 break; // mvendorid
-            //             case 0x301:
-            //                 rval = 0x40401101;
-            //                 break; // misa (XLEN=32, IMA+X)
-            //             // case 0x3B0: rval = 0; break; //pmpaddr0
-            //             // case 0x3a0: rval = 0; break; //pmpcfg0
-            //             // case 0xf12: rval = 0x00000000; break; //marchid
-            //             // case 0xf13: rval = 0x00000000; break; //mimpid
-            //             // case 0xf14: rval = 0x00000000; break; //mhartid
-            //             default:
-            //                 otherCSRRead(csrno, rval);
-            //                 break;
-            //         }
-
-            //         switch (microop) {
-            //             case 0b001:
-            //                 writeval = rs1;
-            //                 break; // CSRRW
-            //             case 0b010:
-            //                 writeval = rval | rs1;
-            //                 break; // CSRRS
-            //             case 0b011:
-            //                 writeval = rval & ~rs1;
-            //                 break; // CSRRC
-            //             case 0b101:
-            //                 writeval = rs1imm;
-            //                 break; // CSRRWI
-            //             case 0b110:
-            //                 writeval = rval | rs1imm;
-            //                 break; // CSRRSI
-            //             case 0b111:
-            //                 writeval = rval & ~rs1imm;
-            //                 break; // CSRRCI
-            //         }
-
-            //         switch (csrno) {
-            //             case 0x340:
-            //                 SETCSR(mscratch, writeval);
-            //                 break;
-            //             case 0x305:
-            //                 SETCSR(mtvec, writeval);
-            //                 break;
-            //             case 0x304:
-            //                 SETCSR(mie, writeval);
-            //                 break;
-            //             case 0x344:
-            //                 SETCSR(mip, writeval);
-            //                 break;
-            //             case 0x341:
-            //                 SETCSR(mepc, writeval);
-            //                 break;
-            //             case 0x300:
-            //                 SETCSR(mstatus, writeval);
-            //                 break; // mstatus
-            //             case 0x342:
-            //                 SETCSR(mcause, writeval);
-            //                 break;
-            //             case 0x343:
-            //                 SETCSR(mtval, writeval);
-            //                 break;
-            //             // case 0x3a0: break; //pmpcfg0
-            //             // case 0x3B0: break; //pmpaddr0
-            //             // case 0xf11: break; //mvendorid
-            //             // case 0xf12: break; //marchid
-            //             // case 0xf13: break; //mimpid
-            //             // case 0xf14: break; //mhartid
-            //             // case 0x301: break; //misa
-            //             default:
-            //                 otherCSRWrite(csrno, writeval);
-            //                 break;
-            //         }
-            //     } else if (microop == 0b000) // "SYSTEM"
-            //     {
-            //         rdid = 0;
-            //         if (csrno == 0x105)       // WFI (Wait for interrupts)
-            //         {
-            //             CSR(mstatus) |= 8;    // Enable interrupts
-            //             CSR(extraflags) |= 4; // Infor environment we want to go to sleep.
-            //             SETCSR(pc, pc + 4);
-            //             return 1;
-            //         } else if (((csrno & 0xff) == 0x02)) // MRET
-            //         {
-            //             // https://raw.githubusercontent.com/riscv/virtual-memory/main/specs/663-Svpbmt.pdf
-            //             // Table 7.6. MRET then in mstatus/mstatush sets MPV=0, MPP=0, MIE=MPIE, and MPIE=1. La
-            //             //  Should also update mstatus to reflect correct mode.
-            //             uint32_t startmstatus = CSR(mstatus);
-            //             uint32_t startextraflags = CSR(extraflags);
-            //             SETCSR(mstatus, ((startmstatus & 0x80) >> 4) | ((startextraflags & 3) << 11) | 0x80);
-            //             SETCSR(extraflags, (startextraflags & ~3) | ((startmstatus >> 11) & 3));
-            //             pc = CSR(mepc) - 4;
-            //         } else {
-            //             switch (csrno) {
-            //                 case 0:
-            //                     trap = (CSR(extraflags) & 3) ? (11 + 1) : (8 + 1);
-            //                     break; // ECALL; 8 = "Environment call from U-mode"; 11 = "Environment call from
-            //                            // M-mode"
-            //                 case 1:
-            //                     trap = (3 + 1);
-            //                     break; // EBREAK 3 = "Breakpoint"
-            //                 default:
-            //                     trap = (2 + 1);
-            //                     break; // Illegal opcode.
-            //             }
-            //         }
-            //     } else
-            //         trap = (2 + 1); // Note micrrop 0b100 == undefined.
-            //     break;
-            // }
-            // case 0b0101111: // RV32A
-            // {
-            //     uint32_t rs1 = REG((ir >> 15) & 0x1f);
-            //     uint32_t rs2 = REG((ir >> 20) & 0x1f);
-            //     uint32_t irmid = (ir >> 27) & 0x1f;
-
-            //     rs1 -= MINIRV32_RAM_IMAGE_OFFSET;
-
-            //     // We don't implement load/store from UART or CLNT with RV32A here.
+            }
 
-            //     if (rs1 >= MINI_RV32_RAM_SIZE - 3) {
-            //         trap = (7 + 1); // Store/AMO access fault
-            //         rval = rs1 + MINIRV32_RAM_IMAGE_OFFSET;
-            //     } else {
-            //         rval = MINIRV32_LOAD4(rs1);
-
-            //         // Referenced a little bit of
-            //         // https://github.com/franzflasch/riscv_em/blob/master/src/core/core.c
-            //         uint32_t dowrite = 1;
-            //         switch (irmid) {
-            //             case 0b00010:
-            //                 dowrite = 0;
-            //                 CSR(extraflags) |= 8;
-            //                 break; // LR.W
-            //             case 0b00011:
-            //                 rval = !(CSR(extraflags) & 8);
-            //                 break; // SC.W (Lie and always say it's good)
-            //             case 0b00001:
-            //                 break; // AMOSWAP.W
-            //             case 0b00000:
-            //                 rs2 += rval;
-            //                 break; // AMOADD.W
-            //             case 0b00100:
-            //                 rs2 ^= rval;
-            //                 break; // AMOXOR.W
-            //             case 0b01100:
-            //                 rs2 &= rval;
-            //                 break; // AMOAND.W
-            //             case 0b01000:
-            //                 rs2 |= rval;
-            //                 break; // AMOOR.W
-            //             case 0b10000:
-            //                 rs2 = ((int32_t) rs2 < (int32_t) rval) ? rs2 : rval;
-            //                 break; // AMOMIN.W
-            //             case 0b10100:
-            //                 rs2 = ((int32_t) rs2 > (int32_t) rval) ? rs2 : rval;
-            //                 break; // AMOMAX.W
-            //             case 0b11000:
-            //                 rs2 = (rs2 < rval) ? rs2 : rval;
-            //                 break; // AMOMINU.W
-            //             case 0b11100:
-            //                 rs2 = (rs2 > rval) ? rs2 : rval;
-            //                 break; // AMOMAXU.W
-            //             default:
-            //                 trap = (2 + 1);
-            //                 dowrite = 0;
-            //                 break; // Not supported.
-            //         }
-            //         if (dowrite)
-            //             MINIRV32_STORE4(rs1, rs2);
-            //     }
-            //     break;
-            // }
-            default:
-                error(pc);
-                break;
+            rdid = 0;
+            Instruction inst(ir);
+            if (inst.isWfi()) {
+                fprintf(fp, "// WFI\n");
+                fprintf(fp, "trap_wait(core);\n");
+                generatePoll(pc + 4);
+            } else if (inst.isMret()) {
+                fprintf(fp, "// MRET\n");
+                fprintf(fp, "next_pc = trap_return(core);\n");
+                fprintf(fp, "goto lab_dispatch;\n");
+            } else if (ir == 0x00000073) {
+                fprintf(fp, "// ECALL\n");
+                generateTrap(pc, "(core.extraflags & 3) ? TRAP_ECALL_M : TRAP_ECALL_U", "0");
+            } else if (ir == 0x00100073) {
+                fprintf(fp, "// EBREAK\n");
+                generateTrap(pc, "TRAP_BREAKPOINT", "0");
+            } else {
+                generateTrap(pc, "TRAP_ILLEGAL_INSTRUCTION", "0");
+            }
+            break;
         }
-
-        if (rdid) {
-            // REGSET(rdid, rval); // Write back register.
-
-            // Add write reg
-            fprintf(fp, "core.regs[%d] = rval;\n", rdid);
+        case 0b0101111: // RV32A
+        {
+            // Atomic on the word in RAM, misaligned addresses and the devices fault
+            std::string addr = src(state, (ir >> 15) & 0x1f);
+            fprintf(fp, "if (!amo_aligned(%s)) {\n", addr.data());
+            generateTrap(pc, "TRAP_STORE_FAULT", addr);
+            fprintf(fp, "}\n");
+            fprintf(fp, "rval = amo_execute(core, 0x%x, %s - MINIRV32_RAM_IMAGE_OFFSET, %s);\n", ir, addr.data(),
+                    src(state, (ir >> 20) & 0x1f).data());
+            break;
         }
+        default:
+            error(pc);
+            break;
+    }
 
-        if (jal_pc) {
-            fprintf(fp, "%sgoto lab_%s;\n", if_jump.data(), dec2hex(jal_pc + 4).data());
-        } else if (jalr) {
-            // fprintf(fp, "CREATE_JUMP_TABLE(pc)\n");
-            fprintf(fp, "goto *jump_table[(pc - MINIRV32_RAM_IMAGE_OFFSET) / 4];\n");
-        }
+    if (rdid) {
+        // REGSET(rdid, rval); // Write back register.
 
-        // Write block end
-        fprintf(fp, "}\n\n");
+        // Add write reg
+        fprintf(fp, "%s = rval;\n", reg(rdid).data());
+    }
 
-        pc += 4;
+    Instruction inst(ir);
+    if (jal_pc) {
+        uint32_t target = jal_pc + 4;
+        if (inst.opcode() == Instruction::JAL && inst.rd() == 1 && analyzer->functions().count(target)) {
+            generateCall(pc, target);
+        } else {
+            uint32_t resume;
+            generateJump(target, if_jump, pollTarget(pc, ir, resume));
+        }
+    } else if (jalr) {
+        if (state.isKnown(inst.rs1())) {
+            // Target known statically
+            uint32_t target = (state.values[inst.rs1()] + inst.immI()) & ~1;
+            if (inst.rd() == 1 && analyzer->functions().count(target)) {
+                generateCall(pc, target);
+            } else if (inst.rd() == 1) {
+                generateCall(pc, 0);
+            } else {
+                generateJump(target, "");
+            }
+        } else if (inst.rd() == 1) {
+            generateCall(pc, 0);
+        } else if (inst.rd() == 0 && inst.rs1() == 1) {
+            // Return
+            fprintf(fp, "goto lab_exit;\n");
+        } else {
+            fprintf(fp, "goto lab_dispatch;\n");
+        }
     }
 
-    // Write function end
-    fprintf(fp, "    return 0;\n");
+    // Write instruction end
     fprintf(fp, "}\n");
-}
\ No newline at end of file
+}
+
@@ -3,17 +3,111 @@
 
 #include <cstdio>
 #include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <string_view>
+
+#include "analyzer.h"
+#include "profile.h"
 
 class Generator {
 public:
-    Generator(FILE *fp, const std::string &content);
+    Generator(FILE *fp, std::string_view content);
     ~Generator();
 
+    void setReadOnlyRanges(const std::vector<AddressRange> &ranges);
+    void setCodeRanges(const std::vector<AddressRange> &ranges);
+    void setEntry(uint32_t pc);
+
+    // Guest symbols, translated as function entries and named in the output
+    void setSymbols(const std::map<uint32_t, std::string> &symbols);
+
+    // Count block executions and taken branches, written to the file when run() returns
+    void setInstrument(const std::string &path);
+
+    // Lay out blocks and hint branches by the counts of an earlier instrumented run
+    void setProfile(const Profile *profile);
+
+    // Split the functions over several files compiled separately, sharing declarations through the header that
+    // the files and the main output include by `name`
+    void setShards(FILE *header, const std::string &name, const std::vector<FILE *> &files);
+
+    // Number of threads translating functions, the output doesn't depend on it
+    void setJobs(int jobs);
+
     void generate();
 
 private:
     FILE *fp;
-    std::string content;
+    std::string_view content;
+    int jobs;
+
+    FILE *headerFile;
+    std::string headerName;
+    std::vector<FILE *> shardFiles;
+
+    std::vector<AddressRange> readOnlyRanges;
+    std::vector<AddressRange> codeRanges;
+    uint32_t entry;
+    std::map<uint32_t, std::string> symbols;
+    std::string instrumentPath;
+    const Profile *profile;
+
+    // Counter indices of the instrumented build
+    std::map<uint32_t, int> blockIndex;
+    std::map<uint32_t, int> branchIndex;
+
+    // Whether interrupts are polled for, and the pcs dispatch enters, indirect targets plus the polls' resume points
+    bool polling;
+
+    // Whether the guest synchronizes with other harts, memory is read again after the poll points then
+    bool shared;
+    std::set<uint32_t> dispatchTargets;
+
+    const Analyzer *analyzer;
+    const Function *function;
+    uint32_t currentBlock;
+
+    // First instruction of the block not yet added to the cycle counter on the path through it
+    uint32_t retiredPc;
+    uint32_t usedRegs;
+    uint32_t writtenRegs;
+    bool hasError;
+    uint32_t errorPc;
+
+    static std::string reg(uint32_t n);
+    static std::string src(const RegState &state, uint32_t n);
+
+    void error(uint32_t pc);
+
+    void generateDeclarations(const std::string &linkage);
+    void generateFunctions();
+    void generateProfileWriter(const std::string &linkage);
+    std::vector<uint32_t> layout(const Function &func) const;
+    std::string branchJump(uint32_t pc, const std::string &cond);
+
+    void generateFunction(const Function &func);
+
+    // Calls the function at the target, or dispatches next_pc for 0
+    void generateCall(uint32_t pc, uint32_t target);
+    void writeBack();
+    void reload();
+
+    // Whether the instruction polls for interrupts or other harts, backward jumps and WFI, and where the guest resumes
+    // then
+    bool pollTarget(uint32_t pc, uint32_t ir, uint32_t &target) const;
+    void generatePoll(uint32_t pc);
+
+    // Counts the instructions from retiredPc up to `end` as retired
+    void generateRetire(uint32_t end);
+
+    // Enters the guest's trap handler, stops the guest without one
+    void generateTrap(uint32_t pc, const std::string &cause, const std::string &tval);
+
+    void generateInstruction(uint32_t pc, uint32_t ir, const RegState &state);
+    void generateJump(uint32_t target, const std::string &cond, bool poll = false);
 };
 
 #endif // GENERATOR_H
@@ -1,8 +1,17 @@
 #include <iostream>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
 
+#include "elf.h"
 #include "generator.h"
+#include "mapping.h"
+#include "specializer.h"
 
 #if defined(_WIN32) && ENABLE_WIDE
 #    include <Windows.h>
@@ -13,12 +22,108 @@ using PathChar = char;
 using PathString = std::string;
 #endif
 
+static const size_t OUTPUT_BUFFER_SIZE = 4 << 20;
+
+static int parseRegister(const std::string &name) {
+    static const char *const abiNames[] = {
+        "zero", "ra", "sp", "gp", "tp",  "t0",  "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+        "a6",   "a7", "s2", "s3", "s4",  "s5",  "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+    };
+    for (int i = 0; i < 32; ++i) {
+        if (name == abiNames[i] || name == "x" + std::to_string(i)) {
+            return i;
+        }
+    }
+    if (name == "fp") {
+        return 8;
+    }
+    return -1;
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 3) {
-        std::cout << "Usage: expander <input> <output>" << std::endl;
+        std::cout << "Usage: expander <input> <output> [options]" << std::endl;
+        std::cout << "Input is a raw image loaded at 0x80000000 or an ELF32 RISC-V executable" << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << "    --rodata <begin>:<end>    Treat the address range as read-only data" << std::endl;
+        std::cout << "    --specialize <pc>         Partially evaluate the routine at pc instead, also a symbol or "
+                     "entry for the entry of an executable"
+                  << std::endl;
+        std::cout << "    --reg <name>=<value>      Known register value on entry of the routine" << std::endl;
+        std::cout << "    --instrument <file>       Write block and branch counts to the file on exit" << std::endl;
+        std::cout << "    --profile <file>          Lay out and hint code by the counts of an instrumented run" << std::endl;
+        std::cout << "    --stats                   Report the translation throughput" << std::endl;
+        std::cout << "    --jobs <n>                Translate on n threads, all hardware threads by default" << std::endl;
+        std::cout << "    --shards <n>              Split functions into <output>_0.cpp ... <output>_<n-1>.cpp sharing "
+                     "<output>.h"
+                  << std::endl;
         return 0;
     }
 
+    // Parse options
+    std::vector<AddressRange> readOnlyRanges;
+    bool specialize = false;
+    std::string entryName;
+    std::vector<std::pair<int, uint32_t>> knownRegs;
+    std::string instrumentPath;
+    std::string profilePath;
+    int shards = 1;
+    bool stats = false;
+    int jobs = (int) std::thread::hardware_concurrency();
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--rodata" && i + 1 < argc) {
+            AddressRange range;
+            char *end = nullptr;
+            range.begin = strtoul(argv[++i], &end, 0);
+            if (*end != ':') {
+                std::cerr << "Invalid address range " << argv[i] << std::endl;
+                return -1;
+            }
+            range.end = strtoul(end + 1, &end, 0);
+            readOnlyRanges.push_back(range);
+        } else if (arg == "--specialize" && i + 1 < argc) {
+            specialize = true;
+            entryName = argv[++i];
+        } else if (arg == "--reg" && i + 1 < argc) {
+            std::string val = argv[++i];
+            auto pos = val.find('=');
+            int n = parseRegister(val.substr(0, pos));
+            if (pos == std::string::npos || n < 0) {
+                std::cerr << "Invalid register value " << val << std::endl;
+                return -1;
+            }
+            knownRegs.emplace_back(n, strtoul(val.data() + pos + 1, nullptr, 0));
+        } else if (arg == "--instrument" && i + 1 < argc) {
+            instrumentPath = argv[++i];
+        } else if (arg == "--profile" && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+            if (jobs < 1) {
+                std::cerr << "Invalid job count " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (arg == "--shards" && i + 1 < argc) {
+            shards = atoi(argv[++i]);
+            if (shards < 1) {
+                std::cerr << "Invalid shard count " << argv[i] << std::endl;
+                return -1;
+            }
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    // Specialized code goes into one function in the output
+    if (specialize && shards > 1) {
+        std::cerr << "Shards can't be used with --specialize" << std::endl;
+        return -1;
+    }
+
     // Get input and output file
     const PathChar *input_file = nullptr;
     const PathChar *output_file = nullptr;
@@ -37,48 +142,150 @@ int main(int argc, char *argv[]) {
 #endif
 
     // Open file
-    FILE *fp = nullptr;
-    size_t size = 0;
+    auto startTime = std::chrono::steady_clock::now();
 
-#if defined(_WIN32) && ENABLE_WIDE
-    if (_wfopen_s(&fp, input_file, L"rb") != 0) {
-        fp = nullptr;
-    }
-#else
-    fp = fopen(input_file, "rb");
-#endif
-    if (!fp) {
+    // Translated in place
+    FileMapping input;
+    if (!input.open(input_file)) {
         std::cerr << "Fail to open input file." << std::endl;
         return -1;
     }
+    std::string_view content = input.view();
 
-    // Read content
-    fseek(fp, 0, SEEK_END);
-    size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    auto buf = new char[size];
-    fread(buf, size, 1, fp);
-    fclose(fp);
+    // Executables bring their own layout, code ranges and symbols
+    ElfFile elf;
+    bool isElf = ElfFile::isElf(content);
+    if (isElf) {
+        if (!elf.load(content, 0x80000000)) {
+            std::cerr << "Unsupported ELF file, expecting a RISC-V executable loaded at 0x80000000." << std::endl;
+            return -1;
+        }
+        content = elf.content();
+        readOnlyRanges.insert(readOnlyRanges.end(), elf.readOnlyRanges.begin(), elf.readOnlyRanges.end());
+    }
 
-    std::string content(buf, size);
-    delete[] buf;
+    // Routine to specialize by address, by symbol or the entry of the executable
+    uint32_t entry = 0x80000000;
+    if (specialize && entryName != "entry") {
+        char *end = nullptr;
+        entry = strtoul(entryName.data(), &end, 0);
+        if (end == entryName.data() || *end) {
+            auto symbol = std::find_if(elf.symbols.begin(), elf.symbols.end(),
+                                       [&](const auto &item) { return item.second == entryName; });
+            if (symbol == elf.symbols.end()) {
+                std::cerr << "Unknown routine " << entryName << std::endl;
+                return -1;
+            }
+            entry = symbol->first;
+        }
+    } else if (isElf) {
+        entry = elf.entry();
+    }
 
     // Start analyze
+    // Generated line by line, so give stdio large buffers to write out in few calls
+    std::vector<std::unique_ptr<char[]>> buffers;
+    auto createFile = [&](const PathString &path) {
+        FILE *fp = nullptr;
 #if defined(_WIN32) && ENABLE_WIDE
-    if (_wfopen_s(&fp, output_file, L"w") != 0) {
-        fp = nullptr;
-    }
+        if (_wfopen_s(&fp, path.data(), L"w") != 0) {
+            fp = nullptr;
+        }
 #else
-    fp = fopen(output_file, "w");
+        fp = fopen(path.data(), "w");
 #endif
+        if (!fp) {
+            std::cerr << "Fail to create output file." << std::endl;
+            return fp;
+        }
+        buffers.emplace_back(new char[OUTPUT_BUFFER_SIZE]);
+        setvbuf(fp, buffers.back().get(), _IOFBF, OUTPUT_BUFFER_SIZE);
+        return fp;
+    };
+
+    FILE *fp = createFile(output_file);
     if (!fp) {
-        std::cerr << "Fail to create output file." << std::endl;
         return -1;
     }
 
-    Generator generator(fp, content);
-    generator.generate();
+    // Shards are named after the output without its extension
+    FILE *header = nullptr;
+    std::vector<FILE *> shardFiles;
+    std::string headerName;
+    if (shards > 1) {
+        PathString stem = output_file;
+        auto dot = stem.find_last_of('.');
+        if (dot != PathString::npos && stem.find_first_of(PathChar('/'), dot) == PathString::npos &&
+            stem.find_first_of(PathChar('\\'), dot) == PathString::npos) {
+            stem.resize(dot);
+        }
+
+        // Included from the same directory, so only the file name matters
+        std::string name = argv[2];
+        name = name.substr(name.find_last_of("/\\") + 1);
+        headerName = name.substr(0, name.find_last_of('.')) + ".h";
+
+        header = createFile(stem + PathChar('.') + PathChar('h'));
+        if (!header) {
+            return -1;
+        }
+        for (int i = 0; i < shards; ++i) {
+            std::string suffix = "_" + std::to_string(i) + ".cpp";
+            FILE *file = createFile(stem + PathString(suffix.begin(), suffix.end()));
+            if (!file) {
+                return -1;
+            }
+            shardFiles.push_back(file);
+        }
+    }
+
+    if (specialize) {
+        Specializer specializer(fp, content, 0x80000000);
+        specializer.setReadOnlyRanges(readOnlyRanges);
+        for (const auto &item : knownRegs) {
+            specializer.setRegister(item.first, item.second);
+        }
+        specializer.generate(entry);
+    } else {
+        Profile profile;
+        Generator generator(fp, content);
+        generator.setReadOnlyRanges(readOnlyRanges);
+        if (isElf) {
+            generator.setCodeRanges(elf.codeRanges);
+            generator.setEntry(elf.entry());
+            generator.setSymbols(elf.symbols);
+        }
+        generator.setInstrument(instrumentPath);
+        generator.setJobs(jobs);
+        if (header) {
+            generator.setShards(header, headerName, shardFiles);
+        }
+        if (!profilePath.empty()) {
+            if (profile.load(profilePath, content)) {
+                generator.setProfile(&profile);
+            } else {
+                std::cerr << "Ignoring profile " << profilePath << ", not recorded for this image" << std::endl;
+            }
+        }
+        generator.generate();
+    }
 
+    // Everything generated is counted, the input by its file size
+    size_t written = 0;
+    shardFiles.push_back(fp);
+    if (header) {
+        shardFiles.push_back(header);
+    }
+    for (FILE *file : shardFiles) {
+        written += ftell(file);
+        fclose(file);
+    }
+
+    if (stats) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        double inputMB = input.view().size() / 1e6;
+        fprintf(stderr, "Translated %.2f MB into %.2f MB in %.3f s, %.2f MB/s\n", inputMB, written / 1e6, seconds,
+                seconds > 0 ? inputMB / seconds : 0.0);
+    }
     return 0;
 }
\ No newline at end of file
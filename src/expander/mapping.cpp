@@ -0,0 +1,92 @@
+#include "mapping.h"
+
+#ifdef _WIN32
+#    include <Windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+FileMapping::FileMapping() : data(nullptr), size(0) {
+}
+
+FileMapping::~FileMapping() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool FileMapping::open(const char *path) {
+    close();
+    return map(CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+}
+
+bool FileMapping::open(const wchar_t *path) {
+    close();
+    return map(CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+}
+
+bool FileMapping::map(void *file) {
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    bool ok = GetFileSizeEx(file, &fileSize);
+    if (ok && fileSize.QuadPart > 0) {
+        // The view keeps the mapping alive after both handles are closed
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        data = mapping ? (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        ok = data != nullptr;
+        size = ok ? (size_t) fileSize.QuadPart : 0;
+    }
+    CloseHandle(file);
+    return ok;
+}
+
+void FileMapping::close() {
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    data = nullptr;
+    size = 0;
+}
+
+#else
+
+bool FileMapping::open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size > 0) {
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = addr != MAP_FAILED;
+        if (ok) {
+            data = (const char *) addr;
+            size = st.st_size;
+            madvise(addr, size, MADV_WILLNEED);
+        }
+    }
+    ::close(fd);
+    return ok;
+}
+
+void FileMapping::close() {
+    if (data) {
+        munmap((void *) data, size);
+    }
+    data = nullptr;
+    size = 0;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <cstddef>
+#include <string_view>
+
+// Read-only view of a whole file mapped into memory
+class FileMapping {
+public:
+    FileMapping();
+    ~FileMapping();
+
+    FileMapping(const FileMapping &) = delete;
+    FileMapping &operator=(const FileMapping &) = delete;
+
+    bool open(const char *path);
+#ifdef _WIN32
+    bool open(const wchar_t *path);
+#endif
+
+    std::string_view view() const {
+        return std::string_view(data, size);
+    }
+
+private:
+    const char *data;
+    size_t size;
+
+#ifdef _WIN32
+    bool map(void *file);
+#endif
+    void close();
+};
+
+#endif // MAPPING_H
@@ -0,0 +1,50 @@
+#include "parallel.h"
+
+TaskPool::TaskPool(size_t count, int threads, std::function<void(int, size_t)> task)
+    : task(std::move(task)), queues(threads < 1 ? 1 : threads) {
+    for (size_t i = 0; i < count; ++i) {
+        queues[i % queues.size()].tasks.push_back(i);
+    }
+    for (int worker = 0; worker < (int) queues.size(); ++worker) {
+        this->threads.emplace_back([this, worker]() {
+            size_t i;
+            while (next(worker, i)) {
+                this->task(worker, i);
+            }
+        });
+    }
+}
+
+TaskPool::~TaskPool() {
+    join();
+}
+
+void TaskPool::join() {
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+}
+
+bool TaskPool::next(int worker, size_t &i) {
+    {
+        std::lock_guard<std::mutex> guard(queues[worker].lock);
+        if (!queues[worker].tasks.empty()) {
+            i = queues[worker].tasks.front();
+            queues[worker].tasks.pop_front();
+            return true;
+        }
+    }
+
+    // Nothing is ever queued again, so all queues found empty means the work is done
+    for (size_t k = 1; k < queues.size(); ++k) {
+        auto &victim = queues[(worker + k) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            i = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,37 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs task(worker, i) for every i in [0, count) on its own threads. Tasks are dealt round-robin so that low
+// indices finish first; a thread that runs out steals the highest index left in another thread's queue.
+class TaskPool {
+public:
+    TaskPool(size_t count, int threads, std::function<void(int, size_t)> task);
+    ~TaskPool();
+
+    TaskPool(const TaskPool &) = delete;
+    TaskPool &operator=(const TaskPool &) = delete;
+
+    // Waits for all tasks
+    void join();
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    std::function<void(int, size_t)> task;
+    std::vector<Queue> queues;
+    std::vector<std::thread> threads;
+
+    bool next(int worker, size_t &i);
+};
+
+#endif // PARALLEL_H
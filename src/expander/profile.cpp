@@ -0,0 +1,60 @@
+#include "profile.h"
+
+#include <cstdio>
+#include <cstring>
+
+Profile::Profile() {
+}
+
+Profile::~Profile() {
+}
+
+bool Profile::load(const std::string &path, std::string_view content) {
+    FILE *fp = fopen(path.data(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    char magic[4];
+    uint32_t header[4];
+    bool ok = fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, "RVPF", 4) == 0 &&
+              fread(header, sizeof(header), 1, fp) == 1 && header[0] == VERSION && header[1] == checksum(content);
+
+    auto readRecords = [&](uint32_t n, std::map<uint32_t, uint64_t> &out) {
+        for (uint32_t i = 0; ok && i < n; ++i) {
+            uint32_t pc;
+            uint64_t count;
+            ok = fread(&pc, sizeof(pc), 1, fp) == 1 && fread(&count, sizeof(count), 1, fp) == 1;
+            out[pc] = count;
+        }
+    };
+    if (ok) {
+        readRecords(header[2], blocks);
+        readRecords(header[3], taken);
+    }
+    fclose(fp);
+
+    if (!ok) {
+        blocks.clear();
+        taken.clear();
+    }
+    return ok;
+}
+
+uint64_t Profile::blockCount(uint32_t pc) const {
+    auto it = blocks.find(pc);
+    return it == blocks.end() ? 0 : it->second;
+}
+
+uint64_t Profile::takenCount(uint32_t pc) const {
+    auto it = taken.find(pc);
+    return it == taken.end() ? 0 : it->second;
+}
+
+uint32_t Profile::checksum(std::string_view content) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : content) {
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,39 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+
+// Execution counts written by an instrumented build (--instrument), all fields little endian:
+//
+//     char     magic[4]     "RVPF"
+//     uint32_t version      1
+//     uint32_t checksum     Profile::checksum() of the image
+//     uint32_t blockCount
+//     uint32_t branchCount
+//     { uint32_t pc; uint64_t count; } blocks[blockCount]     Blocks that ran at least once
+//     { uint32_t pc; uint64_t taken; } branches[branchCount]  Branches taken at least once
+class Profile {
+public:
+    static const uint32_t VERSION = 1;
+
+    Profile();
+    ~Profile();
+
+    // Returns false if the file can't be read or wasn't recorded for the image
+    bool load(const std::string &path, std::string_view content);
+
+    uint64_t blockCount(uint32_t pc) const;
+    uint64_t takenCount(uint32_t pc) const;
+
+    // FNV-1a hash of the image
+    static uint32_t checksum(std::string_view content);
+
+private:
+    std::map<uint32_t, uint64_t> blocks;
+    std::map<uint32_t, uint64_t> taken;
+};
+
+#endif // PROFILE_H
@@ -0,0 +1,881 @@
+#include "specializer.h"
+
+#include <cstdarg>
+#include <cstring>
+
+#include "decoder.h"
+
+// Limits that keep specialization finite, once a budget is used up every new state is generalized
+static const int MAX_VARIANTS = 32;               // Specialized copies of a pc that carry runtime values
+static const size_t MAX_STEPS = 1 << 22;          // Instructions evaluated in total
+static const size_t MAX_STATE_BYTES = 256u << 20; // Memory held by the states labels are specialized on
+static const size_t MAX_CODE_BYTES = 16u << 20;   // Residual code
+static const size_t MAX_TRACKED = 1 << 16;        // Memory bytes and words known in a single state
+
+static const uint32_t SYSCON_ADDRESS = 0x11100000;
+
+// Device registers of the runtime
+static const uint32_t MMIO_BEGIN = 0x10000000;
+static const uint32_t MMIO_END = 0x12000000;
+
+// Registers preserved or returned by a routine under the standard calling convention,
+// ra, sp, gp, tp, s0, s1, a0, a1 and s2-s11
+static const uint32_t ABI_LIVE_OUT =
+    (1u << 1) | (1u << 2) | (1u << 3) | (1u << 4) | (1u << 8) | (1u << 9) | (1u << 10) | (1u << 11) | (0x3ffu << 18);
+
+static const uint16_t BYTE_PENDING = 0x100;
+
+// Rough heap bytes of a copy of the state or of its key
+static size_t footprint(const SpecState &state) {
+    return sizeof(SpecState) + (state.memory.size() + state.words.size()) * 64;
+}
+
+// Whether the state carries runtime values, either in a register or through a branch decided at runtime
+static bool hasDynamic(const SpecState &state) {
+    for (const auto &reg : state.regs) {
+        if (reg.kind == SpecValue::Dynamic) {
+            return true;
+        }
+    }
+    return state.forked;
+}
+
+static bool sameState(const SpecState &a, const SpecState &b) {
+    for (uint32_t i = 0; i < 32; ++i) {
+        if (!(a.regs[i] == b.regs[i])) {
+            return false;
+        }
+    }
+    if (a.memory != b.memory || a.words.size() != b.words.size()) {
+        return false;
+    }
+    for (auto i = a.words.begin(), j = b.words.begin(); i != a.words.end(); ++i, ++j) {
+        if (i->first != j->first || !(i->second.value == j->second.value) || i->second.pending != j->second.pending) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static SpecValue addValue(const SpecValue &val, uint32_t imm) {
+    if (val.kind == SpecValue::Dynamic) {
+        return val;
+    }
+    SpecValue res = val;
+    res.value += imm;
+    return res;
+}
+
+static uint64_t memKey(const SpecValue &addr) {
+    return addr.kind == SpecValue::Const ? addr.value : ((uint64_t) 2 << 32) | addr.value;
+}
+
+static uint64_t memKeyOffset(uint64_t key, uint32_t ofs) {
+    return (key & 0xffffffff00000000) | (uint32_t) (key + ofs);
+}
+
+// C++ expression of an OP or OP-IMM instruction over the locals rs1 and rs2
+static std::string aluExpression(uint32_t ir) {
+    uint32_t is_reg = !!(ir & 0b100000);
+    if (is_reg && (ir & 0x02000000)) {
+        switch ((ir >> 12) & 7) {
+            case 0b000:
+                return "rs1 * rs2";
+            case 0b001:
+                return "(uint32_t) (((int64_t) ((int32_t) rs1) * (int64_t) ((int32_t) rs2)) >> 32)";
+            case 0b010:
+                return "(uint32_t) (((int64_t) ((int32_t) rs1) * (uint64_t) rs2) >> 32)";
+            case 0b011:
+                return "(uint32_t) (((uint64_t) rs1 * (uint64_t) rs2) >> 32)";
+            case 0b100:
+                return "(rs2 == 0) ? 0xffffffff : ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1) ? rs1 "
+                       ": (uint32_t) ((int32_t) rs1 / (int32_t) rs2)";
+            case 0b101:
+                return "(rs2 == 0) ? 0xffffffff : rs1 / rs2";
+            case 0b110:
+                return "(rs2 == 0) ? rs1 : ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1) ? 0 "
+                       ": (uint32_t) ((int32_t) rs1 % (int32_t) rs2)";
+            default:
+                return "(rs2 == 0) ? rs1 : rs1 % rs2";
+        }
+    }
+    switch ((ir >> 12) & 7) {
+        case 0b000:
+            return (is_reg && (ir & 0x40000000)) ? "rs1 - rs2" : "rs1 + rs2";
+        case 0b001:
+            return "rs1 << (rs2 & 0x1F)";
+        case 0b010:
+            return "(uint32_t) ((int32_t) rs1 < (int32_t) rs2)";
+        case 0b011:
+            return "(uint32_t) (rs1 < rs2)";
+        case 0b100:
+            return "rs1 ^ rs2";
+        case 0b101:
+            return (ir & 0x40000000) ? "(uint32_t) (((int32_t) rs1) >> (rs2 & 0x1F))" : "rs1 >> (rs2 & 0x1F)";
+        case 0b110:
+            return "rs1 | rs2";
+        default:
+            return "rs1 & rs2";
+    }
+}
+
+std::vector<uint32_t> SpecState::key(uint32_t pc) const {
+    std::vector<uint32_t> res;
+    res.reserve(1 + 32 * 3 + memory.size() * 3 + words.size() * 6);
+    res.push_back(pc);
+    for (const auto &reg : regs) {
+        res.push_back(reg.kind);
+        res.push_back(reg.base);
+        res.push_back(reg.value);
+    }
+    for (const auto &item : memory) {
+        res.push_back(item.first >> 32);
+        res.push_back((uint32_t) item.first);
+        res.push_back(item.second);
+    }
+    for (const auto &item : words) {
+        res.push_back(item.first >> 32);
+        res.push_back((uint32_t) item.first);
+        res.push_back(item.second.value.kind);
+        res.push_back(item.second.value.base);
+        res.push_back(item.second.value.value);
+        res.push_back(item.second.pending);
+    }
+    return res;
+}
+
+Specializer::Specializer(FILE *fp, std::string_view content, uint32_t base)
+    : fp(fp), content(content), base(base), usedEntry(0), usedLocals(0), steps(0), stateBytes(0), codeBytes(0) {
+}
+
+Specializer::~Specializer() {
+}
+
+void Specializer::setReadOnlyRanges(const std::vector<AddressRange> &ranges) {
+    readOnlyRanges = ranges;
+}
+
+void Specializer::setRegister(uint32_t n, uint32_t val) {
+    if (n > 0 && n < 32) {
+        knownRegs[n] = val;
+    }
+}
+
+void Specializer::generate(uint32_t entry) {
+    lines.clear();
+    lineLabels.clear();
+    referenced.clear();
+    labels.clear();
+    variants.clear();
+    references.clear();
+    worklist.clear();
+    usedEntry = 0;
+    usedLocals = 0;
+    steps = 0;
+    stateBytes = 0;
+    codeBytes = 0;
+    unrolled.clear();
+
+    // Every register holds its value on entry unless given
+    SpecState state;
+    state.regs[0] = SpecValue::constant(0);
+    for (uint32_t i = 1; i < 32; ++i) {
+        state.regs[i] = SpecValue::entry(i, 0);
+    }
+    for (const auto &item : knownRegs) {
+        state.regs[item.first] = SpecValue::constant(item.second);
+    }
+
+    execute(entry, state);
+    while (!worklist.empty()) {
+        Pending pending = std::move(worklist.back());
+        worklist.pop_back();
+
+        lines.push_back("spec_" + std::to_string(pending.label) + ":");
+        lineLabels.push_back(pending.label);
+        execute(pending.pc, std::move(pending.state));
+    }
+
+    // Function name
+    fprintf(fp, "#include \"jit.h\"\n");
+    fprintf(fp, "#include \"rv32core.h\"\n");
+    fprintf(fp, "#include \"rv32macros.h\"\n");
+    fprintf(fp, "\n\n");
+
+    fprintf(fp, "static inline bool is_mmio(uint32_t addy) {\n"
+                "    return addy - (MMIO_BEGIN - MINIRV32_RAM_IMAGE_OFFSET) < MMIO_END - MMIO_BEGIN;\n"
+                "}\n\n\n");
+
+    // The guest continues in the JIT where the specialized code leaves it
+    fprintf(fp, "static int resume(RV32Core &core) {\n"
+                "    int code = -1;\n"
+                "    jit_run(core, [](uint32_t) { return false; }, code);\n"
+                "    return code;\n"
+                "}\n\n");
+
+    fprintf(fp, "int run(RV32Core &core) {\n");
+    fprintf(fp, "    // Specialized from 0x%08x\n", entry);
+    fprintf(fp, "    uint8_t *const image = core.image;\n");
+
+    // Only the entry is specialized, a core resumed from a snapshot runs in the JIT
+    fprintf(fp, "    if (core.pc) {\n"
+                "        return resume(core);\n"
+                "    }\n");
+    for (int i = 1; i < 32; ++i) {
+        if (usedEntry & (1u << i)) {
+            fprintf(fp, "    const uint32_t e%d = core.regs[%d];\n", i, i);
+        }
+    }
+    for (int i = 1; i < 32; ++i) {
+        if (usedLocals & (1u << i)) {
+            fprintf(fp, "    uint32_t x%d = 0;\n", i);
+        }
+    }
+    fprintf(fp, "\n");
+
+    for (size_t i = 0; i < lines.size(); ++i) {
+        int label = lineLabels[i];
+        if (label < 0) {
+            fprintf(fp, "    %s\n", lines[i].data());
+        } else if (referenced[label]) {
+            fprintf(fp, "%s\n", lines[i].data());
+        }
+    }
+    fprintf(fp, "}\n");
+}
+
+void Specializer::line(const char *fmt, ...) {
+    char buf[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    lines.push_back(buf);
+    lineLabels.push_back(-1);
+    codeBytes += lines.back().size();
+}
+
+void Specializer::append(const std::string &code, const char *indent) {
+    size_t pos = 0;
+    while (pos < code.size()) {
+        size_t end = code.find('\n', pos);
+        if (end == std::string::npos) {
+            end = code.size();
+        }
+        if (end > pos) {
+            lines.push_back(indent + code.substr(pos, end - pos));
+            lineLabels.push_back(-1);
+            codeBytes += lines.back().size();
+        }
+        pos = end + 1;
+    }
+}
+
+std::string Specializer::expr(uint32_t n, const SpecValue &val) {
+    char buf[32];
+    switch (val.kind) {
+        case SpecValue::Const:
+            snprintf(buf, sizeof(buf), "0x%x", val.value);
+            break;
+        case SpecValue::Entry:
+            usedEntry |= 1u << val.base;
+            if (val.value == 0) {
+                snprintf(buf, sizeof(buf), "e%d", val.base);
+            } else {
+                snprintf(buf, sizeof(buf), "(e%d + 0x%x)", val.base, val.value);
+            }
+            break;
+        default:
+            usedLocals |= 1u << n;
+            snprintf(buf, sizeof(buf), "x%d", n);
+            break;
+    }
+    return buf;
+}
+
+std::string Specializer::memExpr(uint64_t key) {
+    char buf[32];
+    if (key >> 32) {
+        usedEntry |= 1u << 2;
+        snprintf(buf, sizeof(buf), "(e2 + 0x%x)", (uint32_t) key);
+    } else {
+        snprintf(buf, sizeof(buf), "0x%x", (uint32_t) key);
+    }
+    return buf;
+}
+
+bool Specializer::trackable(const SpecValue &addr) const {
+    // Absolute addresses in RAM, or in the stack frame. The stack is assumed not to alias
+    // any absolute address.
+    return (addr.kind == SpecValue::Const && addr.value >= base) ||
+           (addr.kind == SpecValue::Entry && addr.base == 2);
+}
+
+bool Specializer::loadReadOnly(uint32_t addr, uint32_t size, uint32_t &val) const {
+    uint32_t ofs = addr - base;
+    if (ofs > content.size() || content.size() - ofs < size) {
+        return false;
+    }
+    for (const auto &range : readOnlyRanges) {
+        if (range.contains(addr, size)) {
+            val = 0;
+            memcpy(&val, content.data() + ofs, size);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Specializer::execute(uint32_t pc, SpecState state) {
+    while (true) {
+        ++steps;
+
+        uint32_t ofs = pc - base;
+        if ((pc & 3) || ofs > content.size() || content.size() - ofs < 4) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "0x%x", pc);
+            exitDynamic(state, buf);
+            return;
+        }
+
+        uint32_t ir;
+        memcpy(&ir, content.data() + ofs, sizeof(ir));
+
+        Instruction inst(ir);
+        uint32_t rd = inst.rd();
+        SpecValue rs1 = state.regs[inst.rs1()];
+        SpecValue rs2 = state.regs[inst.rs2()];
+        SpecValue rval = SpecValue::dynamic();
+        uint32_t next = pc + 4;
+        bool jump = false;
+
+        switch (inst.opcode()) {
+            case Instruction::LUI:
+                rval = SpecValue::constant(inst.immU());
+                break;
+            case Instruction::AUIPC:
+                rval = SpecValue::constant(pc + inst.immU());
+                break;
+            case Instruction::JAL:
+                rval = SpecValue::constant(pc + 4);
+                next = pc + inst.immJ();
+                jump = true;
+                break;
+            case Instruction::JALR: {
+                SpecValue target = addValue(rs1, inst.immI());
+                if (target.kind == SpecValue::Const) {
+                    rval = SpecValue::constant(pc + 4);
+                    next = target.value & ~1;
+                    jump = true;
+                    break;
+                }
+                if (target.kind == SpecValue::Entry && target.base == 1 && target.value == 0 && rd == 0) {
+                    // Return from the routine
+                    writeBack(state, true);
+                    line("return (int) %s;", expr(10, state.regs[10]).data());
+                    return;
+                }
+                std::string targetExpr = "((" + expr(inst.rs1(), rs1) + " + 0x";
+                char buf[16];
+                snprintf(buf, sizeof(buf), "%x", inst.immI());
+                targetExpr += std::string(buf) + ") & ~1)";
+                if (rd) {
+                    state.regs[rd] = SpecValue::constant(pc + 4);
+                }
+                exitDynamic(state, targetExpr);
+                return;
+            }
+            case Instruction::BRANCH: {
+                uint32_t funct3 = inst.funct3();
+                if (funct3 == 0b010 || funct3 == 0b011) {
+                    rd = 0;
+                    break; // Illegal, handled below
+                }
+                uint32_t target = pc + inst.immB();
+                if (rs1.kind == SpecValue::Const && rs2.kind == SpecValue::Const) {
+                    if (Analyzer::branchTaken(funct3, rs1.value, rs2.value)) {
+                        next = target;
+                    }
+                    jump = true;
+                    rd = 0;
+                    break;
+                }
+                if (rs1.kind == SpecValue::Entry && rs2.kind == SpecValue::Entry && rs1.base == rs2.base &&
+                    funct3 <= 0b001) {
+                    if ((rs1.value == rs2.value) == (funct3 == 0b000)) {
+                        next = target;
+                    }
+                    jump = true;
+                    rd = 0;
+                    break;
+                }
+
+                // Decided at runtime, both successors are specialized on the current state
+                static const char *const conds[] = {
+                    "%s == %s", "%s != %s", "", "", "(int32_t) %s < (int32_t) %s", "(int32_t) %s >= (int32_t) %s",
+                    "%s < %s",  "%s >= %s",
+                };
+                char cond[128];
+                snprintf(cond, sizeof(cond), conds[funct3], expr(inst.rs1(), rs1).data(),
+                         expr(inst.rs2(), rs2).data());
+                state.forked = true;
+                std::string taken = jumpTo(target, state);
+                std::string notTaken = jumpTo(pc + 4, state);
+                line("if (%s) {", cond);
+                append(taken, "    ");
+                line("}");
+                append(notTaken);
+                return;
+            }
+            case Instruction::LOAD: {
+                uint32_t funct3 = inst.funct3();
+                uint32_t size = 1u << (funct3 & 3);
+                if (size > 4 || funct3 >= 0b110) {
+                    break; // Illegal, handled below
+                }
+
+                SpecValue addr = addValue(rs1, inst.immI());
+                uint32_t val = 0;
+                bool known = addr.kind == SpecValue::Const && loadReadOnly(addr.value, size, val);
+                if (!known && trackable(addr) && size == 4 && state.words.count(memKey(addr))) {
+                    rval = state.words.at(memKey(addr)).value;
+                    break;
+                }
+                if (!known && trackable(addr)) {
+                    uint64_t key = memKey(addr);
+                    known = true;
+                    for (uint32_t i = 0; i < size; ++i) {
+                        auto it = state.memory.find(memKeyOffset(key, i));
+                        if (it == state.memory.end()) {
+                            known = false;
+                            break;
+                        }
+                        val |= (uint32_t) (it->second & 0xff) << (i * 8);
+                    }
+                }
+                if (known) {
+                    if (funct3 == 0b000) {
+                        val = (int8_t) val;
+                    } else if (funct3 == 0b001) {
+                        val = (int16_t) val;
+                    }
+                    rval = SpecValue::constant(val);
+                    break;
+                }
+                if (!rd) {
+                    break;
+                }
+
+                std::string code;
+                flush(state, false, code);
+                append(code);
+
+                // Device registers, on a fault the JIT runs the load again and takes the trap
+                if (addr.kind == SpecValue::Const && addr.value >= MMIO_BEGIN && addr.value < MMIO_END) {
+                    static const char *const types[] = {"int8_t", "int16_t", "uint32_t", "", "uint8_t", "uint16_t"};
+                    line("{");
+                    line("uint32_t val = 0;");
+                    line("if (MINIRV32_HANDLE_MEM_LOAD_CONTROL(core, 0x%x, val) != MMIO_OK) {", addr.value);
+                    writeBack(state, false);
+                    line("    core.pc = 0x%x;", pc);
+                    line("    return resume(core);");
+                    line("}");
+                    line("x%d = (uint32_t) (%s) val;", rd, types[funct3]);
+                    line("}");
+                    usedLocals |= 1u << rd;
+                    break;
+                }
+
+                static const char *const loads[] = {
+                    "(uint32_t) (int8_t) MINIRV32_LOAD1", "(uint32_t) (int16_t) MINIRV32_LOAD2", "MINIRV32_LOAD4", "",
+                    "MINIRV32_LOAD1",                     "MINIRV32_LOAD2",
+                };
+                usedLocals |= 1u << rd;
+                if (addr.kind == SpecValue::Const || trackable(addr)) {
+                    line("x%d = %s((%s + 0x%x - MINIRV32_RAM_IMAGE_OFFSET));", rd, loads[funct3],
+                         expr(inst.rs1(), rs1).data(), inst.immI());
+                    break;
+                }
+
+                // Pointers only known at runtime may lead to the devices
+                static const char *const types[] = {"int8_t", "int16_t", "uint32_t", "", "uint8_t", "uint16_t"};
+                line("{");
+                line("uint32_t addy = %s + 0x%x - MINIRV32_RAM_IMAGE_OFFSET;", expr(inst.rs1(), rs1).data(),
+                     inst.immI());
+                line("if (is_mmio(addy)) {");
+                line("uint32_t val = 0;");
+                line("if (MINIRV32_HANDLE_MEM_LOAD_CONTROL(core, addy + MINIRV32_RAM_IMAGE_OFFSET, val) != MMIO_OK) {");
+                writeBack(state, false);
+                line("    core.pc = 0x%x;", pc);
+                line("    return resume(core);");
+                line("}");
+                line("x%d = (uint32_t) (%s) val;", rd, types[funct3]);
+                line("} else {");
+                line("x%d = %s(addy);", rd, loads[funct3]);
+                line("}");
+                line("}");
+                break;
+            }
+            case Instruction::STORE: {
+                uint32_t funct3 = inst.funct3();
+                if (funct3 > 0b010) {
+                    rd = 0;
+                    break; // Illegal, handled below
+                }
+                uint32_t size = 1u << funct3;
+                rd = 0;
+
+                SpecValue addr = addValue(rs1, inst.immS());
+                if (addr.kind == SpecValue::Const && addr.value == SYSCON_ADDRESS) {
+                    // SYSCON (reboot, poweroff, etc.)
+                    std::string val = expr(inst.rs2(), rs2);
+                    writeBack(state, false);
+                    line("core.pc = 0x%x;", pc);
+                    line("return (int) %s;", val.data());
+                    return;
+                }
+
+                static const char *const stores[] = {"MINIRV32_STORE1", "MINIRV32_STORE2", "MINIRV32_STORE4"};
+                if (trackable(addr)) {
+                    uint64_t key = memKey(addr);
+
+                    // Past the limit everything known goes to memory and is forgotten
+                    if (state.memory.size() + state.words.size() >= MAX_TRACKED) {
+                        std::string code;
+                        flush(state, false, code);
+                        state.memory.clear();
+                        state.words.clear();
+                        append(code);
+                    }
+
+                    // Words partially overwritten have to be in memory first
+                    for (uint64_t word : {memKeyOffset(key, 0) & ~3ull, memKeyOffset(key, size - 1) & ~3ull}) {
+                        auto it = state.words.find(word);
+                        if (it == state.words.end()) {
+                            continue;
+                        }
+                        if (it->second.pending && (word != key || size != 4)) {
+                            line("MINIRV32_STORE4((%s - MINIRV32_RAM_IMAGE_OFFSET), %s);", memExpr(word).data(),
+                                 expr(0, it->second.value).data());
+                        }
+                        state.words.erase(it);
+                    }
+
+                    if (size == 4 && (key & 3) == 0 && rs2.kind == SpecValue::Entry) {
+                        for (uint32_t i = 0; i < size; ++i) {
+                            state.memory.erase(memKeyOffset(key, i));
+                        }
+                        state.words[key] = {rs2, true};
+                        break;
+                    }
+
+                    for (uint32_t i = 0; i < size; ++i) {
+                        if (rs2.kind == SpecValue::Const) {
+                            state.memory[memKeyOffset(key, i)] = ((rs2.value >> (i * 8)) & 0xff) | BYTE_PENDING;
+                        } else {
+                            state.memory.erase(memKeyOffset(key, i));
+                        }
+                    }
+                    if (rs2.kind != SpecValue::Const) {
+                        line("%s((%s - MINIRV32_RAM_IMAGE_OFFSET), %s);", stores[funct3], memExpr(key).data(),
+                             expr(inst.rs2(), rs2).data());
+                    }
+                    break;
+                }
+
+                // The address may alias anything tracked so far
+                std::string code;
+                flush(state, false, code);
+                state.memory.clear();
+                state.words.clear();
+                append(code);
+
+                std::string val = expr(inst.rs2(), rs2);
+                line("{");
+                line("uint32_t addy = %s + 0x%x - MINIRV32_RAM_IMAGE_OFFSET;", expr(inst.rs1(), rs1).data(),
+                     inst.immS());
+                line("if (is_mmio(addy)) {");
+                line("int res = MINIRV32_HANDLE_MEM_STORE_CONTROL(core, addy + MINIRV32_RAM_IMAGE_OFFSET, %s);",
+                     val.data());
+                line("if (res != MMIO_OK) {");
+                writeBack(state, false);
+                line("    core.pc = 0x%x;", pc);
+                line("    return res == MMIO_STOP ? (int) %s : resume(core);", val.data());
+                line("}");
+                line("} else {");
+                line("%s(addy, %s);", stores[funct3], val.data());
+                line("}");
+                line("}");
+                break;
+            }
+            case Instruction::OP_IMM:
+            case Instruction::OP: {
+                bool is_reg = inst.opcode() == Instruction::OP;
+                SpecValue a = rs1;
+                SpecValue b = is_reg ? rs2 : SpecValue::constant(inst.immI());
+                bool isAdd = inst.funct3() == 0 && !(is_reg && (ir & 0x42000000));
+                bool isSub = inst.funct3() == 0 && is_reg && (ir & 0xfe000000) == 0x40000000;
+
+                if (a.kind == SpecValue::Const && b.kind == SpecValue::Const) {
+                    rval = SpecValue::constant(Analyzer::evalAlu(ir, a.value, b.value));
+                } else if (isAdd && a.kind == SpecValue::Entry && b.kind == SpecValue::Const) {
+                    rval = addValue(a, b.value);
+                } else if (isAdd && a.kind == SpecValue::Const && b.kind == SpecValue::Entry) {
+                    rval = addValue(b, a.value);
+                } else if (isSub && a.kind == SpecValue::Entry && b.kind == SpecValue::Const) {
+                    rval = addValue(a, -b.value);
+                } else if (isSub && a.kind == SpecValue::Entry && b.kind == SpecValue::Entry && a.base == b.base) {
+                    rval = SpecValue::constant(a.value - b.value);
+                } else if (rd) {
+                    line("{ uint32_t rs1 = %s; uint32_t rs2 = %s; x%d = %s; }", expr(inst.rs1(), a).data(),
+                         is_reg ? expr(inst.rs2(), b).data() : expr(0, b).data(), rd, aluExpression(ir).data());
+                    usedLocals |= 1u << rd;
+                }
+                break;
+            }
+            case Instruction::MISC_MEM:
+                rd = 0; // Fences are ignored
+                break;
+            default:
+                rd = 0;
+                break;
+        }
+
+        // Instructions without a residual form leave the specialized code
+        bool legal = true;
+        switch (inst.opcode()) {
+            case Instruction::LUI:
+            case Instruction::AUIPC:
+            case Instruction::JAL:
+            case Instruction::JALR:
+            case Instruction::OP:
+            case Instruction::OP_IMM:
+            case Instruction::MISC_MEM:
+                break;
+            case Instruction::BRANCH:
+                legal = inst.funct3() != 0b010 && inst.funct3() != 0b011;
+                break;
+            case Instruction::LOAD:
+                legal = inst.funct3() != 0b011 && inst.funct3() < 0b110;
+                break;
+            case Instruction::STORE:
+                legal = inst.funct3() <= 0b010;
+                break;
+            default:
+                legal = false;
+                break;
+        }
+        if (!legal) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "0x%x", pc);
+            exitDynamic(state, buf);
+            return;
+        }
+
+        if (rd) {
+            state.regs[rd] = rval;
+        }
+
+        if (jump) {
+            // Share the code if the state has been seen before
+            std::string code;
+            bool created;
+            int label = lookup(next, state, code, created, true);
+            if (label < 0) {
+                pc = next;
+                continue;
+            }
+            append(code);
+            if (!created) {
+                referenced[label] = true;
+                line("goto spec_%d;", label);
+                return;
+            }
+            lines.push_back("spec_" + std::to_string(label) + ":");
+            lineLabels.push_back(label);
+        }
+        pc = next;
+    }
+}
+
+bool Specializer::exhausted() const {
+    return steps > MAX_STEPS || stateBytes > MAX_STATE_BYTES || codeBytes > MAX_CODE_BYTES;
+}
+
+int Specializer::lookup(uint32_t pc, SpecState &state, std::string &code, bool &created, bool unroll) {
+    // Fully static states are only limited by the budgets, so that loops with known trip counts are unrolled
+    // completely. Only the first one at a pc gets a label, a different one is another iteration and can only come
+    // back in an endless loop.
+    bool dynamic = hasDynamic(state);
+    if (unroll && !dynamic && !exhausted()) {
+        auto first = unrolled.find(pc);
+        if (first == unrolled.end()) {
+            unrolled.emplace(pc, state);
+            stateBytes += footprint(state);
+        } else if (!sameState(state, first->second)) {
+            created = false;
+            return -1;
+        }
+    }
+
+    auto it = labels.find(state.key(pc));
+    if (it != labels.end()) {
+        created = false;
+        return it->second;
+    }
+    int count = dynamic ? ++variants[pc] : 0;
+
+    bool full = count > 2 * MAX_VARIANTS || exhausted();
+    if (full || count > MAX_VARIANTS) {
+        auto ref = references.find(pc);
+        generalize(state, (full || ref == references.end()) ? nullptr : &ref->second, code);
+        references[pc] = state;
+        stateBytes += footprint(state);
+
+        it = labels.find(state.key(pc));
+        if (it != labels.end()) {
+            created = false;
+            return it->second;
+        }
+    } else if (references.emplace(pc, state).second) {
+        stateBytes += footprint(state);
+    }
+
+    int label = referenced.size();
+    referenced.push_back(false);
+    labels[state.key(pc)] = label;
+    stateBytes += footprint(state);
+    created = true;
+    return label;
+}
+
+std::string Specializer::jumpTo(uint32_t pc, SpecState state) {
+    std::string code;
+    bool created;
+    int label = lookup(pc, state, code, created, false);
+    if (created) {
+        worklist.push_back({label, pc, std::move(state)});
+    }
+    referenced[label] = true;
+    return code + "goto spec_" + std::to_string(label) + ";\n";
+}
+
+void Specializer::generalize(SpecState &state, const SpecState *ref, std::string &code) {
+    // Keep what the state has in common with the reference, everything else is left to runtime
+    char buf[128];
+    for (auto it = state.words.begin(); it != state.words.end();) {
+        auto other = ref ? ref->words.find(it->first) : state.words.end();
+        if (ref && other != ref->words.end() && other->second.value == it->second.value &&
+            other->second.pending == it->second.pending) {
+            ++it;
+            continue;
+        }
+        if (it->second.pending) {
+            snprintf(buf, sizeof(buf), "MINIRV32_STORE4((%s - MINIRV32_RAM_IMAGE_OFFSET), %s);\n",
+                     memExpr(it->first).data(), expr(0, it->second.value).data());
+            code += buf;
+        }
+        it = state.words.erase(it);
+    }
+    for (auto it = state.memory.begin(); it != state.memory.end();) {
+        auto other = ref ? ref->memory.find(it->first) : state.memory.end();
+        if (ref && other != ref->memory.end() && other->second == it->second) {
+            ++it;
+            continue;
+        }
+        if (it->second & BYTE_PENDING) {
+            snprintf(buf, sizeof(buf), "MINIRV32_STORE1((%s - MINIRV32_RAM_IMAGE_OFFSET), 0x%x);\n",
+                     memExpr(it->first).data(), it->second & 0xff);
+            code += buf;
+        }
+        it = state.memory.erase(it);
+    }
+
+    for (uint32_t i = 1; i < 32; ++i) {
+        SpecValue &val = state.regs[i];
+        if (val.kind == SpecValue::Dynamic || (ref && val == ref->regs[i])) {
+            continue;
+        }
+        code += "x" + std::to_string(i) + " = " + expr(i, val) + ";\n";
+        val = SpecValue::dynamic();
+        usedLocals |= 1u << i;
+    }
+}
+
+void Specializer::flush(SpecState &state, bool dropFrame, std::string &code) {
+    char buf[128];
+    for (auto &item : state.words) {
+        if (!item.second.pending) {
+            continue;
+        }
+        item.second.pending = false;
+
+        uint32_t addr = item.first;
+        if (dropFrame && (item.first >> 32) && (int32_t) addr < 0) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf), "MINIRV32_STORE4((%s - MINIRV32_RAM_IMAGE_OFFSET), %s);\n",
+                 memExpr(item.first).data(), expr(0, item.second.value).data());
+        code += buf;
+    }
+    for (auto it = state.memory.begin(); it != state.memory.end(); ++it) {
+        if (!(it->second & BYTE_PENDING)) {
+            continue;
+        }
+        it->second &= ~BYTE_PENDING;
+
+        // Stores below sp are dead after returning
+        uint32_t addr = it->first;
+        if (dropFrame && (it->first >> 32) && (int32_t) addr < 0) {
+            continue;
+        }
+
+        // Merge aligned words
+        if ((addr & 3) == 0) {
+            uint32_t word = it->second & 0xff;
+            auto next = std::next(it);
+            int n = 1;
+            for (; n < 4 && next != state.memory.end() && next->first == memKeyOffset(it->first, n) &&
+                   (next->second & BYTE_PENDING);
+                 ++n, ++next) {
+                word |= (uint32_t) (next->second & 0xff) << (n * 8);
+            }
+            if (n == 4) {
+                snprintf(buf, sizeof(buf), "MINIRV32_STORE4((%s - MINIRV32_RAM_IMAGE_OFFSET), 0x%x);\n",
+                         memExpr(it->first).data(), word);
+                code += buf;
+                for (int i = 0; i < 3; ++i) {
+                    ++it;
+                    it->second &= ~BYTE_PENDING;
+                }
+                continue;
+            }
+        }
+        snprintf(buf, sizeof(buf), "MINIRV32_STORE1((%s - MINIRV32_RAM_IMAGE_OFFSET), 0x%x);\n",
+                 memExpr(it->first).data(), it->second & 0xff);
+        code += buf;
+    }
+}
+
+void Specializer::writeBack(SpecState &state, bool abiReturn) {
+    std::string code;
+    flush(state, abiReturn, code);
+    append(code);
+
+    for (uint32_t i = 1; i < 32; ++i) {
+        if (abiReturn && !(ABI_LIVE_OUT & (1u << i))) {
+            continue; // Temporaries are dead after returning
+        }
+        if (state.regs[i] == SpecValue::entry(i, 0)) {
+            continue;
+        }
+        line("core.regs[%d] = %s;", i, expr(i, state.regs[i]).data());
+    }
+}
+
+void Specializer::exitDynamic(SpecState &state, const std::string &pc) {
+    writeBack(state, false);
+    line("core.pc = %s;", pc.data());
+    line("return resume(core);");
+}
@@ -0,0 +1,130 @@
+#ifndef SPECIALIZER_H
+#define SPECIALIZER_H
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "analyzer.h"
+
+// Abstract value of a register during specialization
+struct SpecValue {
+    enum Kind {
+        Dynamic, // Only known at runtime, lives in the local xN
+        Const,   // Known at translation time
+        Entry,   // Value of register `base` on entry plus `value`
+    };
+
+    Kind kind;
+    uint32_t base;
+    uint32_t value;
+
+    static SpecValue dynamic() {
+        return {Dynamic, 0, 0};
+    }
+
+    static SpecValue constant(uint32_t val) {
+        return {Const, 0, val};
+    }
+
+    static SpecValue entry(uint32_t reg, uint32_t ofs) {
+        return {Entry, reg, ofs};
+    }
+
+    bool operator==(const SpecValue &other) const {
+        return kind == other.kind && base == other.base && value == other.value;
+    }
+};
+
+struct SpecState {
+    SpecValue regs[32];
+
+    // Memory bytes known at translation time, the key is (base << 32 | address) where base is 0 for
+    // absolute addresses and 2 for addresses relative to sp on entry. Bit 8 of the value marks a store
+    // that hasn't been emitted yet.
+    std::map<uint64_t, uint16_t> memory;
+
+    // Aligned words holding entry-relative values, e.g. spilled callee-saved registers
+    struct Word {
+        SpecValue value;
+        bool pending;
+    };
+    std::map<uint64_t, Word> words;
+
+    // Reached through a branch decided at runtime, the copies of a pc are limited from then on
+    bool forked = false;
+
+    std::vector<uint32_t> key(uint32_t pc) const;
+};
+
+// Partial evaluator of a single routine on a known initial state
+class Specializer {
+public:
+    Specializer(FILE *fp, std::string_view content, uint32_t base);
+    ~Specializer();
+
+    void setReadOnlyRanges(const std::vector<AddressRange> &ranges);
+
+    void setRegister(uint32_t n, uint32_t val);
+
+    void generate(uint32_t entry);
+
+private:
+    FILE *fp;
+    std::string_view content;
+    uint32_t base;
+
+    std::vector<AddressRange> readOnlyRanges;
+    std::map<uint32_t, uint32_t> knownRegs;
+
+    struct Pending {
+        int label;
+        uint32_t pc;
+        SpecState state;
+    };
+
+    // Residual code, label lines are only written if referenced
+    std::vector<std::string> lines;
+    std::vector<int> lineLabels;
+    std::vector<bool> referenced;
+
+    std::map<std::vector<uint32_t>, int> labels;
+    std::map<uint32_t, int> variants;
+    std::map<uint32_t, SpecState> references;
+    std::vector<Pending> worklist;
+
+    // First fully static state at each pc a label was made for
+    std::map<uint32_t, SpecState> unrolled;
+
+    uint32_t usedEntry;
+    uint32_t usedLocals;
+    size_t steps;
+    size_t stateBytes;
+    size_t codeBytes;
+
+    void line(const char *fmt, ...);
+    void append(const std::string &code, const char *indent = "");
+    std::string expr(uint32_t n, const SpecValue &val);
+    std::string memExpr(uint64_t key);
+
+    void execute(uint32_t pc, SpecState state);
+
+    // Whether a budget that keeps the specialization finite is used up
+    bool exhausted() const;
+
+    // Label of the code specialized on the state at the pc, which is created if there's none yet. With `unroll`, a
+    // fully static state on another iteration of a loop gets -1 instead, the code goes on without a label.
+    int lookup(uint32_t pc, SpecState &state, std::string &code, bool &created, bool unroll);
+    std::string jumpTo(uint32_t pc, SpecState state);
+    void generalize(SpecState &state, const SpecState *ref, std::string &code);
+
+    void flush(SpecState &state, bool dropFrame, std::string &code);
+    void writeBack(SpecState &state, bool abiReturn);
+    void exitDynamic(SpecState &state, const std::string &pc);
+
+    bool trackable(const SpecValue &addr) const;
+    bool loadReadOnly(uint32_t addr, uint32_t size, uint32_t &val) const;
+};
+
+#endif // SPECIALIZER_H
@@ -0,0 +1,132 @@
+#ifndef ATOMICS_H
+#define ATOMICS_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "rv32core.h"
+#include "rv32macros.h"
+
+// RAM words accessed in place as host atomics, shared by the harts running on other threads
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free,
+              "RAM words can't be used as atomics");
+
+static const uint32_t RESERVATION_VALID = 0x8;
+
+// Reservation sets are 64 byte granules, hashed by their host address onto versions so that guests running side by
+// side don't share them
+static const uint32_t RESERVATION_GRANULE_SHIFT = 6;
+static const uint32_t RESERVATION_VERSIONS = 4096;
+
+// Bumped by every store to a granule while any hart holds a reservation, and by a successful SC.W
+extern std::atomic<uint32_t> amo_versions[RESERVATION_VERSIONS];
+
+// Harts holding a reservation, stores leave the versions alone while there are none
+extern std::atomic<uint32_t> amo_reservations;
+
+static inline std::atomic<uint32_t> &amo_word(uint8_t *image, uint32_t ofs) {
+    return *reinterpret_cast<std::atomic<uint32_t> *>(image + ofs);
+}
+
+static inline std::atomic<uint32_t> &amo_version(uint8_t *image, uint32_t ofs) {
+    return amo_versions[((uintptr_t) (image + ofs) >> RESERVATION_GRANULE_SHIFT) % RESERVATION_VERSIONS];
+}
+
+// Breaks the reservations on the granules of a store of `size` bytes to the RAM offset, after it's done
+static inline void amo_store(uint8_t *image, uint32_t ofs, uint32_t size) {
+    if (amo_reservations.load()) {
+        amo_version(image, ofs).fetch_add(1);
+        if ((ofs ^ (ofs + size - 1)) >> RESERVATION_GRANULE_SHIFT) {
+            amo_version(image, ofs + size - 1).fetch_add(1);
+        }
+    }
+}
+
+// Drops the reservation of the hart, on SC.W or once it stops
+static inline void amo_release(RV32Core &core) {
+    if (core.extraflags & RESERVATION_VALID) {
+        core.extraflags &= ~RESERVATION_VALID;
+        amo_reservations.fetch_sub(1);
+    }
+}
+
+// Whether the word at the address can be accessed atomically, inside the RAM and aligned
+static inline bool amo_aligned(uint32_t addr) {
+    uint32_t ofs = addr - MINIRV32_RAM_IMAGE_OFFSET;
+    return ofs < MINI_RV32_RAM_SIZE - 3 && !(ofs & 3);
+}
+
+// Executes the RV32A instruction on the aligned word at the RAM offset with `src`, the value of rs2, and
+// returns the value for rd. All orderings are sequentially consistent, which covers any aq and rl bits. SC.W
+// succeeds if no store bumped the version of the granule since LR.W and the word still holds the value LR.W read.
+// The value catches the stores that were under way when the reservation was taken and didn't see it yet.
+static inline uint32_t amo_execute(RV32Core &core, uint32_t ir, uint32_t ofs, uint32_t src) {
+    std::atomic<uint32_t> &word = amo_word(core.image, ofs);
+    uint32_t val;
+    switch (ir >> 27) {
+        case 0b00010: // LR.W
+            if (!(core.extraflags & RESERVATION_VALID)) {
+                core.extraflags |= RESERVATION_VALID;
+                amo_reservations.fetch_add(1);
+            }
+            core.reservation = ofs;
+            core.reservedVersion = amo_version(core.image, ofs).load();
+            val = word.load();
+            core.reservedValue = val;
+            return val;
+        case 0b00011: { // SC.W
+            bool reserved = (core.extraflags & RESERVATION_VALID) && core.reservation == ofs;
+            amo_release(core);
+            uint32_t version = core.reservedVersion;
+            val = core.reservedValue;
+
+            // Taking the next version breaks the reservations of the other harts on the granule
+            if (!reserved || !amo_version(core.image, ofs).compare_exchange_strong(version, version + 1)) {
+                return 1;
+            }
+            return word.compare_exchange_strong(val, src) ? 0 : 1;
+        }
+        default:
+            amo_store(core.image, ofs, 4);
+            break;
+    }
+    switch (ir >> 27) {
+        case 0b00001: // AMOSWAP.W
+            return word.exchange(src);
+        case 0b00000: // AMOADD.W
+            return word.fetch_add(src);
+        case 0b00100: // AMOXOR.W
+            return word.fetch_xor(src);
+        case 0b01100: // AMOAND.W
+            return word.fetch_and(src);
+        case 0b01000: // AMOOR.W
+            return word.fetch_or(src);
+        default:
+            break;
+    }
+
+    // Minimum and maximum have no host instruction, retried until no other hart changed the word in between
+    val = word.load();
+    for (;;) {
+        uint32_t res;
+        switch (ir >> 27) {
+            case 0b10000: // AMOMIN.W
+                res = (int32_t) src < (int32_t) val ? src : val;
+                break;
+            case 0b10100: // AMOMAX.W
+                res = (int32_t) src > (int32_t) val ? src : val;
+                break;
+            case 0b11000: // AMOMINU.W
+                res = src < val ? src : val;
+                break;
+            default: // AMOMAXU.W
+                res = src > val ? src : val;
+                break;
+        }
+        if (word.compare_exchange_weak(val, res)) {
+            return val;
+        }
+    }
+}
+
+#endif // ATOMICS_H
@@ -0,0 +1,187 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+#include "jit.h"
+#include "parallel.h"
+#include "ram.h"
+#include "rv32macros.h"
+
+namespace fs = std::filesystem;
+
+struct BatchResult {
+    bool started; // The input was read and fit into RAM with the image
+    bool finished;
+    int exit_code;
+    uint32_t fault;
+};
+
+static bool readFile(const fs::path &path, std::string &data) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !in.bad();
+}
+
+static bool listInputs(const std::string &inputs, std::vector<fs::path> &paths) {
+    std::error_code ec;
+    if (fs::is_directory(inputs, ec)) {
+        for (const auto &entry : fs::directory_iterator(inputs, ec)) {
+            if (entry.is_regular_file(ec)) {
+                paths.push_back(entry.path());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+        return !ec;
+    }
+
+    std::ifstream manifest(inputs);
+    if (!manifest) {
+        return false;
+    }
+    fs::path base = fs::path(inputs).parent_path();
+    std::string line;
+    while (std::getline(manifest, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            paths.push_back(base / line);
+        }
+    }
+    return true;
+}
+
+// Where the instances start, the core and the RAM once the image is loaded or the guest asked for the snapshot
+struct BatchStart {
+    RV32Core core;
+    RamSnapshot ram;
+    size_t reserved; // Bytes at the start of RAM the input can't overlap
+};
+
+static bool boot(int (*run)(RV32Core &), std::string_view content, const BatchOptions &options, BatchStart &start) {
+    GuestRam ram = {};
+    if (!ram_allocate(ram, options.guard)) {
+        std::cerr << "Failed to allocate RAM." << std::endl;
+        return false;
+    }
+    ram_load(ram, content.data(), content.size());
+
+    if (options.snapshot) {
+        std::string output;
+        int exit_code = 0;
+        uint32_t fault = 0;
+        start.core.image = ram.image;
+        mmio_capture(&output);
+        bool finished = ram_run(ram, run, start.core, exit_code, fault);
+        mmio_capture(nullptr);
+        if (!finished || !mmio_snapshot_requested()) {
+            std::cerr << "The guest stopped without writing to SNAPSHOT." << std::endl;
+            ram_release(ram);
+            return false;
+        }
+        start.core.pc += 4;
+    }
+
+    bool ok = ram_snapshot(ram, start.ram);
+    if (!ok) {
+        std::cerr << "Failed to take a snapshot of the RAM." << std::endl;
+    }
+    start.reserved = content.size();
+    ram_release(ram);
+    return ok;
+}
+
+static void runInstance(int (*run)(RV32Core &), const BatchStart &start, GuestRam &ram, const fs::path &path,
+                        std::string &output, BatchResult &res) {
+    res = {};
+    std::string input;
+    if (!readFile(path, input) || input.size() + 4 > ram_amt) {
+        return;
+    }
+    // A word is left after the input, the interpreter and the JIT check any access against the last word of RAM
+    uint32_t ofs = (uint32_t) (ram_amt - 4 - input.size()) & ~3u;
+    if (ofs < start.reserved || !ram_restore(ram, start.ram)) {
+        return;
+    }
+    memcpy(ram.image + ofs, input.data(), input.size());
+
+    RV32Core core = start.core;
+    core.image = ram.image;
+    core.regs[11] = ofs + MINIRV32_RAM_IMAGE_OFFSET;
+    core.regs[12] = (uint32_t) input.size();
+
+    // Code the previous instance left translated may have been modified in its RAM
+    jit_flush();
+    mmio_capture(&output);
+    res.started = true;
+    res.finished = ram_run(ram, run, core, res.exit_code, res.fault);
+    mmio_capture(nullptr);
+}
+
+int batch_run(int (*run)(RV32Core &), std::string_view content, const BatchOptions &options) {
+    std::vector<fs::path> paths;
+    if (!listInputs(options.inputs, paths)) {
+        std::cerr << "Failed to read the inputs." << std::endl;
+        return -1;
+    }
+    if (!options.output.empty()) {
+        std::error_code ec;
+        fs::create_directories(options.output, ec);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    BatchStart initial = {};
+    if (!boot(run, content, options, initial)) {
+        return -1;
+    }
+
+    // Each worker resets its RAM to the snapshot for the next instance
+    int workers = options.jobs < 1 ? 1 : options.jobs;
+    std::vector<GuestRam> rams(workers, GuestRam{});
+    std::vector<BatchResult> results(paths.size());
+    TaskPool pool(paths.size(), workers, [&](int worker, size_t i) {
+        std::string text;
+        results[i] = {};
+        if (rams[worker].image || ram_allocate(rams[worker], options.guard)) {
+            runInstance(run, initial, rams[worker], paths[i], text, results[i]);
+        }
+        if (!options.output.empty() && results[i].started) {
+            std::ofstream out(fs::path(options.output) / (paths[i].filename().string() + ".out"), std::ios::binary);
+            out.write(text.data(), (std::streamsize) text.size());
+        }
+    });
+    pool.join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    for (auto &ram : rams) {
+        ram_release(ram);
+    }
+    ram_snapshot_release(initial.ram);
+
+    int failed = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const BatchResult &res = results[i];
+        std::string name = paths[i].string();
+        if (!res.started) {
+            printf("%s: can't be loaded\n", name.data());
+        } else if (res.finished) {
+            printf("%s: %d\n", name.data(), res.exit_code);
+        } else {
+            printf("%s: access fault at %08x\n", name.data(), res.fault);
+        }
+        failed += !res.started || !res.finished;
+    }
+    printf("instances: %d, failed: %d\n", (int) paths.size(), failed);
+    std::cout << "timeout: " << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() << std::endl;
+    return failed ? 1 : 0;
+}
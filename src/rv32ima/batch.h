@@ -0,0 +1,30 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <string_view>
+
+#include "rv32core.h"
+
+struct BatchOptions {
+    // A directory, whose files are taken in name order, or a manifest listing a file per line relative to it
+    std::string inputs;
+
+    // Instances running at a time
+    int jobs;
+
+    // Directory the UART output of an instance goes to as <input name>.out, dropped if empty
+    std::string output;
+
+    bool guard;
+
+    // Run the guest without input until it writes to SNAPSHOT and start the instances from there
+    bool snapshot;
+};
+
+// Runs an instance of the guest per input on a thread pool sharing the translated code. Each instance starts from a
+// snapshot of the RAM with `content` at the start and the input at the end, its address in a1 and its size in a2.
+// Prints the results in input order and returns the exit code of the process.
+int batch_run(int (*run)(RV32Core &), std::string_view content, const BatchOptions &options);
+
+#endif // BATCH_H
@@ -0,0 +1,233 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#include "devices.h"
+#include "jit.h"
+#include "ram.h"
+
+#if defined(__linux__)
+#    include <linux/perf_event.h>
+#    include <sys/ioctl.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+// Host counters of the thread running the guest, in user mode only
+static const int COUNTERS = 3;
+static const char *const COUNTER_NAMES[COUNTERS] = {"instructions", "branch-misses", "L1i misses"};
+static const char *const COUNTER_KEYS[COUNTERS] = {"instructions", "branch_misses", "l1i_misses"};
+
+// Opens the counters disabled, leaving -1 for those the kernel or the CPU doesn't provide
+static void countersOpen(int fds[COUNTERS]) {
+    std::fill(fds, fds + COUNTERS, -1);
+#if defined(__linux__)
+    static const uint32_t types[COUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE};
+    static const uint64_t configs[COUNTERS] = {
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_L1I | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    };
+    for (int i = 0; i < COUNTERS; ++i) {
+        perf_event_attr attr = {};
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+static void countersStart(const int fds[COUNTERS]) {
+#if defined(__linux__)
+    for (int i = 0; i < COUNTERS; ++i) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+// Reads the counts since countersStart(), -1 for the counters that aren't open
+static void countersStop(const int fds[COUNTERS], int64_t values[COUNTERS]) {
+    std::fill(values, values + COUNTERS, -1);
+#if defined(__linux__)
+    for (int i = 0; i < COUNTERS; ++i) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t count;
+            if (read(fds[i], &count, sizeof(count)) == sizeof(count)) {
+                values[i] = (int64_t) count;
+            }
+        }
+    }
+#endif
+}
+
+static void countersClose(int fds[COUNTERS]) {
+#if defined(__linux__)
+    for (int i = 0; i < COUNTERS; ++i) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+#endif
+}
+
+// Of sorted samples, the mean of the middle two for an even count
+template <typename T> static double median(const std::vector<T> &sorted) {
+    size_t n = sorted.size();
+    return n % 2 ? (double) sorted[n / 2] : ((double) sorted[n / 2 - 1] + (double) sorted[n / 2]) / 2;
+}
+
+// Of sorted samples, by nearest rank
+template <typename T> static T percentile(const std::vector<T> &sorted, double p) {
+    size_t rank = (size_t) std::ceil(p * (double) sorted.size());
+    return sorted[rank ? rank - 1 : 0];
+}
+
+int bench_run(int (*run)(RV32Core &), std::string_view content, const BenchOptions &options) {
+    GuestRam ram = {};
+    RamSnapshot initial = {};
+    if (!ram_allocate(ram, options.guard)) {
+        std::cerr << "Failed to allocate RAM." << std::endl;
+        return -1;
+    }
+    ram_load(ram, content.data(), content.size());
+    if (!ram_snapshot(ram, initial)) {
+        std::cerr << "Failed to take a snapshot of the RAM." << std::endl;
+        ram_release(ram);
+        return -1;
+    }
+
+    int fds[COUNTERS];
+    countersOpen(fds);
+
+    std::vector<int64_t> times;
+    std::vector<uint64_t> instructions;
+    std::vector<int64_t> counts[COUNTERS];
+    std::string output;
+    int exit_code = 0;
+    bool varies = false;
+    for (int i = 0; i < options.warmup + options.iterations; ++i) {
+        // Every run starts from the loaded image with nothing translated yet
+        RV32Core core;
+        core.image = ram.image;
+        if (i && !ram_restore(ram, initial)) {
+            std::cerr << "Failed to reset the RAM." << std::endl;
+            break;
+        }
+        jit_flush();
+        output.clear();
+        mmio_capture(&output);
+
+        int ret = 0;
+        uint32_t fault = 0;
+        int64_t values[COUNTERS];
+        countersStart(fds);
+        auto start = std::chrono::steady_clock::now();
+        bool finished = ram_run(ram, run, core, ret, fault);
+        auto end = std::chrono::steady_clock::now();
+        countersStop(fds, values);
+        mmio_capture(nullptr);
+        if (!finished) {
+            printf("Access fault at %08x\n", fault);
+            break;
+        }
+
+        uint64_t retired = ((uint64_t) core.cycleh << 32) | core.cyclel;
+        if (i == 0) {
+            exit_code = ret;
+        } else if (ret != exit_code || retired != instructions.back()) {
+            varies = true;
+        }
+        instructions.push_back(retired);
+        if (i < options.warmup) {
+            continue;
+        }
+        times.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        for (int c = 0; c < COUNTERS; ++c) {
+            counts[c].push_back(values[c]);
+        }
+    }
+    countersClose(fds);
+    ram_snapshot_release(initial);
+    ram_release(ram);
+    if ((int) times.size() != options.iterations) {
+        return 1;
+    }
+
+    std::vector<int64_t> samples = times;
+    std::sort(times.begin(), times.end());
+    double median_ns = median(times);
+    uint64_t retired = instructions.back();
+    double mips = median_ns > 0 ? (double) retired * 1e3 / median_ns : 0;
+    double host[COUNTERS];
+    for (int c = 0; c < COUNTERS; ++c) {
+        std::sort(counts[c].begin(), counts[c].end());
+        host[c] = counts[c].front() < 0 ? -1 : median(counts[c]);
+    }
+
+    // The report goes to stdout unless the JSON does
+    if (options.json != "-") {
+        std::cout << exit_code << std::endl;
+        printf("iterations: %d, warm-up: %d\n", options.iterations, options.warmup);
+        printf("time: min %.1f us, median %.1f us, p99 %.1f us\n", (double) times.front() / 1e3, median_ns / 1e3,
+               (double) percentile(times, 0.99) / 1e3);
+        printf("guest instructions: %llu, MIPS: %.2f\n", (unsigned long long) retired, mips);
+        for (int c = 0; c < COUNTERS; ++c) {
+            if (host[c] < 0) {
+                printf("%s: unavailable\n", COUNTER_NAMES[c]);
+            } else {
+                printf("%s: %.0f\n", COUNTER_NAMES[c], host[c]);
+            }
+        }
+    }
+    if (varies) {
+        std::cerr << "The exit code or the instruction count differed between runs." << std::endl;
+    }
+
+    if (!options.json.empty()) {
+        FILE *out = options.json == "-" ? stdout : fopen(options.json.data(), "w");
+        if (!out) {
+            std::cerr << "Failed to open " << options.json << "." << std::endl;
+            return 1;
+        }
+        fprintf(out, "{\n");
+        fprintf(out, "  \"exit_code\": %d,\n", exit_code);
+        fprintf(out, "  \"iterations\": %d,\n", options.iterations);
+        fprintf(out, "  \"warmup\": %d,\n", options.warmup);
+        fprintf(out, "  \"guest_instructions\": %llu,\n", (unsigned long long) retired);
+        fprintf(out, "  \"time_ns\": {\"min\": %lld, \"median\": %.1f, \"p99\": %lld},\n", (long long) times.front(),
+                median_ns, (long long) percentile(times, 0.99));
+        fprintf(out, "  \"mips\": %.3f,\n", mips);
+        fprintf(out, "  \"host\": {");
+        for (int c = 0; c < COUNTERS; ++c) {
+            fprintf(out, c ? ", \"%s\": " : "\"%s\": ", COUNTER_KEYS[c]);
+            if (host[c] < 0) {
+                fprintf(out, "null");
+            } else {
+                fprintf(out, "%.0f", host[c]);
+            }
+        }
+        fprintf(out, "},\n");
+        fprintf(out, "  \"samples_ns\": [");
+        for (size_t i = 0; i < samples.size(); ++i) {
+            fprintf(out, i ? ", %lld" : "%lld", (long long) samples[i]);
+        }
+        fprintf(out, "]\n}\n");
+        if (out != stdout) {
+            fclose(out);
+        }
+    }
+    return varies ? 1 : 0;
+}
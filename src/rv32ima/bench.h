@@ -0,0 +1,25 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <string_view>
+
+#include "rv32core.h"
+
+struct BenchOptions {
+    // Measured runs, after the warm-up ones
+    int iterations;
+    int warmup;
+
+    // File the results are written to as JSON, stdout for "-", dropped if empty
+    std::string json;
+
+    bool guard;
+};
+
+// Runs the guest from the start `warmup` + `iterations` times, resetting the RAM and the core in between, and reports
+// the wall time of the measured runs on a monotonic clock, the guest instructions they retired and the host counters
+// perf_event_open could read. Returns the exit code of the process.
+int bench_run(int (*run)(RV32Core &), std::string_view content, const BenchOptions &options);
+
+#endif // BENCH_H
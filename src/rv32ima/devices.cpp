@@ -0,0 +1,210 @@
+#include "devices.h"
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+
+#if defined(_WIN32)
+#    include <conio.h>
+#    include <io.h>
+#else
+#    include <poll.h>
+#    include <unistd.h>
+#endif
+
+static const uint32_t UART_DATA = 0x10000000;
+static const uint32_t UART_LSR = 0x10000005;
+static const uint32_t CLINT_TIMERMATCHL = 0x11004000;
+static const uint32_t CLINT_TIMERMATCHH = 0x11004004;
+static const uint32_t CLINT_TIMERL = 0x1100bff8;
+static const uint32_t CLINT_TIMERH = 0x1100bffc;
+static const uint32_t SYSCON = 0x11100000;
+static const uint32_t SNAPSHOT = 0x11100004;
+
+// Line status: transmitter always empty, bit 0 once a byte was received
+static const uint32_t LSR_THR_EMPTY = 0x60;
+static const uint32_t LSR_DATA_READY = 0x01;
+
+// Guest output collected until it's full, a line on a terminal, the guest waits for input or stops
+static char output[64 << 10];
+static size_t outputSize = 0;
+static int lineBuffered = -1;
+
+static int pending = -1; // Received byte not read by the guest yet
+static bool inputClosed = false;
+
+// LSR reads left before stdin is polled again, guests spin on it before every byte they send
+static const int LSR_POLL_INTERVAL = 256;
+static int lsrCountdown = 0;
+
+// Held around the UART state, which the harts share
+static std::mutex uartLock;
+
+// Output of the guest on this thread when it's captured instead
+static thread_local std::string *capture = nullptr;
+
+static thread_local bool snapshotRequested = false;
+
+static void flushOutput() {
+    if (outputSize) {
+        fwrite(output, 1, outputSize, stdout);
+        fflush(stdout);
+        outputSize = 0;
+    }
+}
+
+static void uartWrite(char c) {
+    if (lineBuffered < 0) {
+#if defined(_WIN32)
+        lineBuffered = _isatty(_fileno(stdout)) ? 1 : 0;
+#else
+        lineBuffered = isatty(STDOUT_FILENO) ? 1 : 0;
+#endif
+    }
+    output[outputSize++] = c;
+    if (outputSize == sizeof(output) || (c == '\n' && lineBuffered)) {
+        flushOutput();
+    }
+}
+
+static bool uartPoll() {
+    if (pending >= 0 || inputClosed) {
+        return pending >= 0;
+    }
+#if defined(_WIN32)
+    if (_kbhit()) {
+        pending = _getch();
+    }
+#else
+    struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&fd, 1, 0) > 0) {
+        unsigned char c;
+        if (read(STDIN_FILENO, &c, 1) == 1) {
+            pending = c;
+        } else {
+            inputClosed = true;
+        }
+    }
+#endif
+    return pending >= 0;
+}
+
+// mtime counts microseconds since the start
+static const auto timerStart = std::chrono::steady_clock::now();
+
+static uint64_t timer() {
+    auto elapsed = std::chrono::steady_clock::now() - timerStart;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+MmioResult mmio_load(RV32Core &core, uint32_t addr, uint32_t &value) {
+    if (addr < MMIO_BEGIN || addr >= MMIO_END) {
+        return MMIO_FAULT;
+    }
+    value = 0;
+
+    // Each hart's mtimecmp is 8 bytes after the previous one's
+    if (addr - CLINT_TIMERMATCHL == core.hartid * 8) {
+        value = core.timermatchl;
+        return MMIO_OK;
+    } else if (addr - CLINT_TIMERMATCHH == core.hartid * 8) {
+        value = core.timermatchh;
+        return MMIO_OK;
+    }
+    switch (addr) {
+        case UART_DATA: {
+            if (capture) {
+                break;
+            }
+            std::lock_guard<std::mutex> lock(uartLock);
+            if (pending < 0) {
+                // The guest waits for input, it should see its prompt first
+                flushOutput();
+            }
+            if (uartPoll()) {
+                value = (uint32_t) pending;
+                pending = -1;
+            }
+            break;
+        }
+        case UART_LSR: {
+            if (capture) {
+                value = LSR_THR_EMPTY;
+                break;
+            }
+            std::lock_guard<std::mutex> lock(uartLock);
+            if (pending < 0 && --lsrCountdown <= 0) {
+                // Keep polling right away while input arrives, otherwise the guest spins waiting for it
+                if (uartPoll()) {
+                    lsrCountdown = 0;
+                } else {
+                    lsrCountdown = LSR_POLL_INTERVAL;
+                    flushOutput();
+                }
+            }
+            value = LSR_THR_EMPTY | (pending >= 0 ? LSR_DATA_READY : 0);
+            break;
+        }
+        case CLINT_TIMERL:
+            value = (uint32_t) mmio_timer(core);
+            break;
+        case CLINT_TIMERH:
+            value = (uint32_t) (mmio_timer(core) >> 32);
+            break;
+    }
+    return MMIO_OK;
+}
+
+MmioResult mmio_store(RV32Core &core, uint32_t addr, uint32_t value) {
+    if (addr < MMIO_BEGIN || addr >= MMIO_END) {
+        return MMIO_FAULT;
+    }
+    if (addr - CLINT_TIMERMATCHL == core.hartid * 8) {
+        core.timermatchl = value;
+        return MMIO_OK;
+    } else if (addr - CLINT_TIMERMATCHH == core.hartid * 8) {
+        core.timermatchh = value;
+        return MMIO_OK;
+    }
+    switch (addr) {
+        case UART_DATA: {
+            if (capture) {
+                capture->push_back((char) value);
+                break;
+            }
+            std::lock_guard<std::mutex> lock(uartLock);
+            uartWrite((char) value);
+            break;
+        }
+        case SYSCON:
+            // Reboot, poweroff, etc.
+            mmio_flush();
+            return MMIO_STOP;
+        case SNAPSHOT:
+            snapshotRequested = true;
+            return MMIO_STOP;
+    }
+    return MMIO_OK;
+}
+
+uint64_t mmio_timer(RV32Core &core) {
+    uint64_t now = timer();
+    core.timerl = (uint32_t) now;
+    core.timerh = (uint32_t) (now >> 32);
+    return now;
+}
+
+void mmio_flush() {
+    std::lock_guard<std::mutex> lock(uartLock);
+    flushOutput();
+}
+
+bool mmio_snapshot_requested() {
+    bool requested = snapshotRequested;
+    snapshotRequested = false;
+    return requested;
+}
+
+void mmio_capture(std::string *output) {
+    capture = output;
+}
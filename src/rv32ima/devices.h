@@ -0,0 +1,40 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include <cstdint>
+#include <string>
+
+#include "rv32core.h"
+
+// Memory mapped devices below the RAM, laid out like mini-rv32ima's:
+//   0x10000000 8250 UART, 0x11004000 CLINT mtimecmp, 0x1100bff8 CLINT mtime, 0x11100000 SYSCON
+// plus 0x11100004 SNAPSHOT, which stops the guest to take a snapshot it resumes from after the store.
+// The harts share the UART, each finds its own mtimecmp at 0x11004000 + 8 * mhartid.
+static const uint32_t MMIO_BEGIN = 0x10000000;
+static const uint32_t MMIO_END = 0x12000000;
+
+enum MmioResult {
+    MMIO_OK = 0,
+    MMIO_FAULT = 1, // Nothing there, an access fault
+    MMIO_STOP = 2,  // SYSCON or SNAPSHOT was written, the guest stops with the value as its exit code
+};
+
+// Accesses outside of RAM, only reached once the address failed the RAM check
+MmioResult mmio_load(RV32Core &core, uint32_t addr, uint32_t &value);
+MmioResult mmio_store(RV32Core &core, uint32_t addr, uint32_t value);
+
+// Reads mtime, microseconds since the start, into the timer of the core
+uint64_t mmio_timer(RV32Core &core);
+
+// Writes the UART output buffered so far to stdout. Called when the guest waits for input, idles in WFI or
+// stops.
+void mmio_flush();
+
+// Whether the guest on this thread stopped at SNAPSHOT, cleared by the call
+bool mmio_snapshot_requested();
+
+// Collects the UART output of the guest running on this thread in `output` instead of writing it to stdout, until
+// called with nullptr. The guest receives no input meanwhile.
+void mmio_capture(std::string *output);
+
+#endif // DEVICES_H
@@ -0,0 +1,647 @@
+#include "interpreter.h"
+
+#include <vector>
+
+#include "atomics.h"
+#include "decoder.h"
+#include "rv32macros.h"
+#include "traps.h"
+
+// Handlers of the interpreter, one per operation
+enum OpKind {
+    OP_LUI,
+    OP_AUIPC,
+    OP_JAL,
+    OP_JALR,
+    OP_BEQ,
+    OP_BNE,
+    OP_BLT,
+    OP_BGE,
+    OP_BLTU,
+    OP_BGEU,
+    OP_LB,
+    OP_LH,
+    OP_LW,
+    OP_LBU,
+    OP_LHU,
+    OP_SB,
+    OP_SH,
+    OP_SW,
+    OP_ADDI,
+    OP_SLTI,
+    OP_SLTIU,
+    OP_XORI,
+    OP_ORI,
+    OP_ANDI,
+    OP_SLLI,
+    OP_SRLI,
+    OP_SRAI,
+    OP_ADD,
+    OP_SUB,
+    OP_SLL,
+    OP_SLT,
+    OP_SLTU,
+    OP_XOR,
+    OP_SRL,
+    OP_SRA,
+    OP_OR,
+    OP_AND,
+    OP_MUL,
+    OP_MULH,
+    OP_MULHSU,
+    OP_MULHU,
+    OP_DIV,
+    OP_DIVU,
+    OP_REM,
+    OP_REMU,
+    OP_AMO,
+    OP_FENCE,
+    OP_FENCE_I,
+    OP_SYSTEM,
+    OP_ILLEGAL,
+    OP_REDECODE,
+    OP_PAGE_END,
+    OP_COUNT,
+};
+
+// Predecoded instruction, the handler is the address of its label in interpret()
+struct DecodedOp {
+    const void *handler;
+    uint32_t imm; // Absolute target for jumps and branches
+    uint8_t rd;   // 32 for x0, a scratch register that is never read
+    uint8_t rs1;
+    uint8_t rs2;
+    bool entry;   // Translated code can be entered here
+};
+
+static const uint32_t PAGE_SIZE = 4096;
+static const uint32_t PAGE_OPS = PAGE_SIZE / 4;
+
+struct DecodedPage {
+    uint32_t base;
+    bool valid;
+
+    // The extra op moves on to the next page
+    DecodedOp ops[PAGE_OPS + 1];
+};
+
+// Pages indexed by RAM offset / PAGE_SIZE, each hart decodes its own
+static thread_local std::vector<DecodedPage *> pages;
+
+// Handler of ops overwritten since they were decoded, set once the first page is decoded
+static const void *redecodeHandler = nullptr;
+
+static OpKind decode(uint32_t pc, uint32_t ir, DecodedOp &op) {
+    Instruction inst(ir);
+    op.rd = inst.rd() ? inst.rd() : 32;
+    op.rs1 = inst.rs1();
+    op.rs2 = inst.rs2();
+    op.imm = inst.immI();
+
+    if (!inst.isValid()) {
+        return OP_ILLEGAL;
+    }
+
+    uint32_t funct7 = ir >> 25;
+    switch (inst.opcode()) {
+        case Instruction::LUI:
+            op.imm = inst.immU();
+            return OP_LUI;
+        case Instruction::AUIPC:
+            op.imm = pc + inst.immU();
+            return OP_AUIPC;
+        case Instruction::JAL:
+            op.imm = pc + inst.immJ();
+            return OP_JAL;
+        case Instruction::JALR:
+            return OP_JALR;
+        case Instruction::BRANCH: {
+            static const OpKind kinds[] = {OP_BEQ, OP_BNE, OP_ILLEGAL, OP_ILLEGAL,
+                                           OP_BLT, OP_BGE, OP_BLTU,    OP_BGEU};
+            op.imm = pc + inst.immB();
+            return kinds[inst.funct3()];
+        }
+        case Instruction::LOAD: {
+            static const OpKind kinds[] = {OP_LB, OP_LH, OP_LW, OP_ILLEGAL, OP_LBU, OP_LHU};
+            return kinds[inst.funct3()];
+        }
+        case Instruction::STORE: {
+            static const OpKind kinds[] = {OP_SB, OP_SH, OP_SW};
+            op.imm = inst.immS();
+            return kinds[inst.funct3()];
+        }
+        case Instruction::OP_IMM: {
+            static const OpKind kinds[] = {OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU, OP_XORI, OP_SRLI, OP_ORI, OP_ANDI};
+            if (inst.funct3() == 0b001 || inst.funct3() == 0b101) {
+                op.imm &= 0x1f;
+            }
+            if (inst.funct3() == 0b101 && funct7) {
+                return OP_SRAI;
+            }
+            return kinds[inst.funct3()];
+        }
+        case Instruction::OP: {
+            static const OpKind kinds[] = {OP_ADD, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_OR, OP_AND};
+            static const OpKind mulKinds[] = {OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU,
+                                              OP_DIV, OP_DIVU, OP_REM,    OP_REMU};
+            if (funct7 == 1) {
+                return mulKinds[inst.funct3()];
+            }
+            if (funct7) {
+                return inst.funct3() == 0 ? OP_SUB : OP_SRA;
+            }
+            return kinds[inst.funct3()];
+        }
+        case Instruction::MISC_MEM:
+            return inst.funct3() == 0b001 ? OP_FENCE_I : OP_FENCE;
+        case Instruction::AMO:
+            op.imm = ir;
+            return OP_AMO;
+        case Instruction::SYSTEM:
+            op.imm = ir;
+            return OP_SYSTEM;
+        default:
+            return OP_ILLEGAL;
+    }
+}
+
+static DecodedPage *decodePage(const uint8_t *image, uint32_t ofs, const void *const *labels,
+                               EntryPredicate translated) {
+    uint32_t index = ofs / PAGE_SIZE;
+    if (pages.size() <= index) {
+        pages.resize(index + 1, nullptr);
+    }
+    DecodedPage *page = pages[index];
+    if (!page) {
+        page = new DecodedPage();
+        pages[index] = page;
+    }
+
+    page->base = (ofs & ~(PAGE_SIZE - 1)) + MINIRV32_RAM_IMAGE_OFFSET;
+    for (uint32_t i = 0; i < PAGE_OPS; ++i) {
+        uint32_t pc = page->base + i * 4;
+        uint32_t cur = pc - MINIRV32_RAM_IMAGE_OFFSET;
+        DecodedOp &op = page->ops[i];
+        OpKind kind = cur < ram_amt - 3 ? decode(pc, MINIRV32_LOAD4(cur), op) : OP_ILLEGAL;
+        op.handler = labels[kind];
+        op.entry = translated(pc);
+    }
+    page->ops[PAGE_OPS].handler = labels[OP_PAGE_END];
+    page->ops[PAGE_OPS].entry = false;
+    page->valid = true;
+    redecodeHandler = labels[OP_REDECODE];
+    return page;
+}
+
+// Stores to predecoded code take effect at once, the ops they overlap are decoded again when they're run
+static inline void invalidateOps(uint32_t ofs, uint32_t size) {
+    for (uint32_t cur : {ofs, ofs + size - 1}) {
+        uint32_t index = cur / PAGE_SIZE;
+        if (index < pages.size() && pages[index] && pages[index]->valid) {
+            pages[index]->ops[(cur % PAGE_SIZE) / 4].handler = redecodeHandler;
+        }
+    }
+}
+
+void interpret_flush() {
+    for (auto page : pages) {
+        if (page) {
+            page->valid = false;
+        }
+    }
+}
+
+bool interpret_amo(RV32Core &core, uint32_t *regs, uint32_t ir) {
+    Instruction inst(ir);
+    if (!inst.isValid() || !amo_aligned(regs[inst.rs1()])) {
+        return false;
+    }
+    uint32_t ofs = regs[inst.rs1()] - MINIRV32_RAM_IMAGE_OFFSET;
+    uint32_t rval = amo_execute(core, ir, ofs, regs[inst.rs2()]);
+    if ((ir >> 27) != 0b00010) {
+        invalidateOps(ofs, 4);
+    }
+    if (inst.rd()) {
+        regs[inst.rd()] = rval;
+    }
+    return true;
+}
+
+bool interpret_system(RV32Core &core, uint32_t *regs, uint32_t ir, uint32_t pc) {
+    Instruction inst(ir);
+    core.pc = pc + 4;
+    uint32_t cause = TRAP_ILLEGAL_INSTRUCTION;
+    if (inst.funct3() & 3) {
+        uint32_t rval = csr_access(core, ir, (inst.funct3() & 4) ? inst.rs1() : regs[inst.rs1()]);
+        if (inst.rd()) {
+            regs[inst.rd()] = rval;
+        }
+        core_retire(core, 1);
+        return true;
+    }
+    if (inst.funct3() == 0) {
+        switch (ir >> 20) {
+            case 0x000: // ECALL
+                cause = (core.extraflags & 3) ? TRAP_ECALL_M : TRAP_ECALL_U;
+                break;
+            case 0x001: // EBREAK
+                cause = TRAP_BREAKPOINT;
+                break;
+            case 0x105: // WFI
+                trap_wait(core);
+                core_retire(core, 1);
+                return true;
+            case 0x302: // MRET
+                core.pc = trap_return(core);
+                core_retire(core, 1);
+                return true;
+        }
+    }
+    core.pc = pc;
+    return trap_take(core, cause, 0);
+}
+
+int interpret_mmio(RV32Core &core, uint32_t *regs, uint32_t ir) {
+    Instruction inst(ir);
+    if (inst.opcode() == Instruction::STORE) {
+        return MINIRV32_HANDLE_MEM_STORE_CONTROL(core, regs[inst.rs1()] + inst.immS(), regs[inst.rs2()]);
+    }
+    uint32_t val = 0;
+    int res = MINIRV32_HANDLE_MEM_LOAD_CONTROL(core, regs[inst.rs1()] + inst.immI(), val);
+    if (res != MMIO_OK || !inst.rd()) {
+        return res;
+    }
+    switch (inst.funct3()) {
+        case 0b000:
+            val = (int8_t) val;
+            break;
+        case 0b001:
+            val = (int16_t) val;
+            break;
+        case 0b100:
+            val = (uint8_t) val;
+            break;
+        case 0b101:
+            val = (uint16_t) val;
+            break;
+    }
+    regs[inst.rd()] = val;
+    return res;
+}
+
+bool interpret(RV32Core &core, EntryPredicate translated, int &exit_code) {
+    static const void *const labels[] = {
+        &&op_lui,  &&op_auipc, &&op_jal,    &&op_jalr,  &&op_beq,    &&op_bne,     &&op_blt,
+        &&op_bge,  &&op_bltu,  &&op_bgeu,   &&op_lb,    &&op_lh,     &&op_lw,      &&op_lbu,
+        &&op_lhu,  &&op_sb,    &&op_sh,     &&op_sw,    &&op_addi,   &&op_slti,    &&op_sltiu,
+        &&op_xori, &&op_ori,   &&op_andi,   &&op_slli,  &&op_srli,   &&op_srai,    &&op_add,
+        &&op_sub,  &&op_sll,   &&op_slt,    &&op_sltu,  &&op_xor,    &&op_srl,     &&op_sra,
+        &&op_or,   &&op_and,   &&op_mul,    &&op_mulh,  &&op_mulhsu, &&op_mulhu,   &&op_div,
+        &&op_divu, &&op_rem,   &&op_remu,   &&op_amo,   &&op_fence,  &&op_fence_i, &&op_system,
+        &&op_illegal, &&op_redecode, &&op_page_end,
+    };
+    static_assert(sizeof(labels) / sizeof(labels[0]) == OP_COUNT, "Missing handler");
+
+    uint8_t *const image = core.image;
+
+    // x0 reads as zero, writes to it go to the scratch register 32
+    uint32_t regs[33];
+    regs[0] = 0;
+    for (int i = 1; i < 32; ++i) {
+        regs[i] = core.regs[i];
+    }
+
+    DecodedPage *page = nullptr;
+    const DecodedOp *op = nullptr;
+    const DecodedOp *block = nullptr; // First op since the instructions were last counted
+    uint32_t pc = core.pc;
+    uint32_t target = 0;
+    bool first = true;
+
+    // Trap raised by a fault
+    uint32_t cause = 0;
+    uint32_t tval = 0;
+
+#define PC()   (page->base + (uint32_t) (op - page->ops) * 4)
+#define NEXT() goto *(++op)->handler
+#define RD     regs[op->rd]
+#define RS1    regs[op->rs1]
+#define RS2    regs[op->rs2]
+
+    // Counts the ops run since the block was entered, plus the current one if it retired
+#define RETIRE(n) core_retire(core, (uint32_t) (op - block) + (n))
+#define JUMP(addr)                                                                                                     \
+    do {                                                                                                               \
+        RETIRE(1);                                                                                                     \
+        target = (addr);                                                                                               \
+        goto lab_jump;                                                                                                 \
+    } while (0)
+#define FAULT(at, trap, value)                                                                                         \
+    do {                                                                                                               \
+        RETIRE(0);                                                                                                     \
+        pc = (at);                                                                                                     \
+        cause = (trap);                                                                                                \
+        tval = (value);                                                                                                \
+        goto lab_fault;                                                                                                \
+    } while (0)
+
+    target = pc;
+
+lab_jump: {
+    block = op;
+
+    // Interrupts are taken between blocks
+    if ((core.mstatus & 8) && !first && interrupt_take(core, target)) {
+        target = core.pc;
+    }
+
+    // Translated code takes over at its entries, except where the interpreter was asked to start
+    uint32_t ofs = target - MINIRV32_RAM_IMAGE_OFFSET;
+    if (ofs >= ram_amt - 3 || (target & 3)) {
+        FAULT(target, (target & 3) ? TRAP_FETCH_MISALIGNED : TRAP_FETCH_FAULT, target);
+    }
+    page = ofs / PAGE_SIZE < pages.size() ? pages[ofs / PAGE_SIZE] : nullptr;
+    if (!page || !page->valid) {
+        page = decodePage(image, ofs, labels, translated);
+    }
+    op = &page->ops[(ofs % PAGE_SIZE) / 4];
+    block = op;
+    if (op->entry && !first) {
+        core.pc = target;
+        goto lab_leave;
+    }
+    first = false;
+    goto *op->handler;
+}
+
+op_page_end:
+    RETIRE(0);
+    target = page->base + PAGE_SIZE;
+    goto lab_jump;
+
+op_lui:
+    RD = op->imm;
+    NEXT();
+op_auipc:
+    RD = op->imm;
+    NEXT();
+op_jal:
+    RD = PC() + 4;
+    JUMP(op->imm);
+op_jalr: {
+    uint32_t addr = (RS1 + op->imm) & ~1;
+    RD = PC() + 4;
+    JUMP(addr);
+}
+
+op_beq:
+    if (RS1 == RS2)
+        JUMP(op->imm);
+    NEXT();
+op_bne:
+    if (RS1 != RS2)
+        JUMP(op->imm);
+    NEXT();
+op_blt:
+    if ((int32_t) RS1 < (int32_t) RS2)
+        JUMP(op->imm);
+    NEXT();
+op_bge:
+    if ((int32_t) RS1 >= (int32_t) RS2)
+        JUMP(op->imm);
+    NEXT();
+op_bltu:
+    if (RS1 < RS2)
+        JUMP(op->imm);
+    NEXT();
+op_bgeu:
+    if (RS1 >= RS2)
+        JUMP(op->imm);
+    NEXT();
+
+#define LOAD(expr, type)                                                                                               \
+    do {                                                                                                               \
+        uint32_t ofs = RS1 + op->imm - MINIRV32_RAM_IMAGE_OFFSET;                                                      \
+        if (ofs >= ram_amt - 3) {                                                                                      \
+            uint32_t val = 0;                                                                                          \
+            if (MINIRV32_HANDLE_MEM_LOAD_CONTROL(core, ofs + MINIRV32_RAM_IMAGE_OFFSET, val) != MMIO_OK) {             \
+                FAULT(PC(), TRAP_LOAD_FAULT, ofs + MINIRV32_RAM_IMAGE_OFFSET);                                         \
+            }                                                                                                          \
+            RD = (uint32_t) (type) val;                                                                                \
+        } else {                                                                                                       \
+            RD = expr;                                                                                                 \
+        }                                                                                                              \
+    } while (0)
+
+op_lb:
+    LOAD((int8_t) MINIRV32_LOAD1(ofs), int8_t);
+    NEXT();
+op_lh:
+    LOAD((int16_t) MINIRV32_LOAD2(ofs), int16_t);
+    NEXT();
+op_lw:
+    LOAD(MINIRV32_LOAD4(ofs), uint32_t);
+    NEXT();
+op_lbu:
+    LOAD(MINIRV32_LOAD1(ofs), uint8_t);
+    NEXT();
+op_lhu:
+    LOAD(MINIRV32_LOAD2(ofs), uint16_t);
+    NEXT();
+
+#define STORE(store, size)                                                                                             \
+    do {                                                                                                               \
+        uint32_t ofs = RS1 + op->imm - MINIRV32_RAM_IMAGE_OFFSET;                                                      \
+        if (ofs >= ram_amt - 3) {                                                                                      \
+            int res = MINIRV32_HANDLE_MEM_STORE_CONTROL(core, ofs + MINIRV32_RAM_IMAGE_OFFSET, RS2);                   \
+            if (res == MMIO_OK) {                                                                                      \
+                NEXT();                                                                                                \
+            }                                                                                                          \
+            if (res == MMIO_STOP) {                                                                                    \
+                /* SYSCON (reboot, poweroff, etc.) */                                                                  \
+                exit_code = RS2;                                                                                       \
+                core.pc = PC();                                                                                        \
+                RETIRE(1);                                                                                             \
+                goto lab_stop;                                                                                         \
+            }                                                                                                          \
+            FAULT(PC(), TRAP_STORE_FAULT, ofs + MINIRV32_RAM_IMAGE_OFFSET);                                            \
+        }                                                                                                              \
+        store;                                                                                                         \
+        amo_store(image, ofs, size);                                                                                   \
+        invalidateOps(ofs, size);                                                                                      \
+    } while (0)
+
+op_sb:
+    STORE(MINIRV32_STORE1(ofs, RS2), 1);
+    NEXT();
+op_sh:
+    STORE(MINIRV32_STORE2(ofs, RS2), 2);
+    NEXT();
+op_sw:
+    STORE(MINIRV32_STORE4(ofs, RS2), 4);
+    NEXT();
+
+op_addi:
+    RD = RS1 + op->imm;
+    NEXT();
+op_slti:
+    RD = (int32_t) RS1 < (int32_t) op->imm;
+    NEXT();
+op_sltiu:
+    RD = RS1 < op->imm;
+    NEXT();
+op_xori:
+    RD = RS1 ^ op->imm;
+    NEXT();
+op_ori:
+    RD = RS1 | op->imm;
+    NEXT();
+op_andi:
+    RD = RS1 & op->imm;
+    NEXT();
+op_slli:
+    RD = RS1 << op->imm;
+    NEXT();
+op_srli:
+    RD = RS1 >> op->imm;
+    NEXT();
+op_srai:
+    RD = (int32_t) RS1 >> op->imm;
+    NEXT();
+
+op_add:
+    RD = RS1 + RS2;
+    NEXT();
+op_sub:
+    RD = RS1 - RS2;
+    NEXT();
+op_sll:
+    RD = RS1 << (RS2 & 0x1f);
+    NEXT();
+op_slt:
+    RD = (int32_t) RS1 < (int32_t) RS2;
+    NEXT();
+op_sltu:
+    RD = RS1 < RS2;
+    NEXT();
+op_xor:
+    RD = RS1 ^ RS2;
+    NEXT();
+op_srl:
+    RD = RS1 >> (RS2 & 0x1f);
+    NEXT();
+op_sra:
+    RD = (int32_t) RS1 >> (RS2 & 0x1f);
+    NEXT();
+op_or:
+    RD = RS1 | RS2;
+    NEXT();
+op_and:
+    RD = RS1 & RS2;
+    NEXT();
+
+op_mul:
+    RD = RS1 * RS2;
+    NEXT();
+op_mulh:
+    RD = ((int64_t) (int32_t) RS1 * (int64_t) (int32_t) RS2) >> 32;
+    NEXT();
+op_mulhsu:
+    RD = ((int64_t) (int32_t) RS1 * (uint64_t) RS2) >> 32;
+    NEXT();
+op_mulhu:
+    RD = ((uint64_t) RS1 * (uint64_t) RS2) >> 32;
+    NEXT();
+op_div: {
+    uint32_t rs1 = RS1, rs2 = RS2;
+    if (rs2 == 0)
+        RD = -1;
+    else
+        RD = ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1) ? rs1 : ((int32_t) rs1 / (int32_t) rs2);
+    NEXT();
+}
+op_divu:
+    RD = RS2 ? RS1 / RS2 : 0xffffffff;
+    NEXT();
+op_rem: {
+    uint32_t rs1 = RS1, rs2 = RS2;
+    if (rs2 == 0)
+        RD = rs1;
+    else
+        RD = ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1) ? 0 : ((uint32_t) ((int32_t) rs1 % (int32_t) rs2));
+    NEXT();
+}
+op_remu:
+    RD = RS2 ? RS1 % RS2 : RS1;
+    NEXT();
+
+op_amo:
+    if (!interpret_amo(core, regs, op->imm)) {
+        FAULT(PC(), TRAP_STORE_FAULT, RS1);
+    }
+    NEXT();
+
+op_fence:
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    NEXT();
+op_fence_i:
+    interpret_flush();
+    JUMP(PC() + 4);
+
+op_system:
+    // Counters read by the instruction are up to date, it counts itself unless it traps
+    RETIRE(0);
+    if (!interpret_system(core, regs, op->imm, PC())) {
+        pc = PC();
+        goto lab_unhandled;
+    }
+    target = core.pc;
+    goto lab_jump;
+
+op_illegal:
+    FAULT(PC(), TRAP_ILLEGAL_INSTRUCTION, 0);
+
+op_redecode: {
+    DecodedOp &cur = page->ops[op - page->ops];
+    uint32_t ofs = PC() - MINIRV32_RAM_IMAGE_OFFSET;
+    cur.handler = labels[ofs < ram_amt - 3 ? decode(PC(), MINIRV32_LOAD4(ofs), cur) : OP_ILLEGAL];
+    cur.entry = translated(PC());
+    goto *cur.handler;
+}
+
+#undef PC
+#undef NEXT
+#undef RD
+#undef RS1
+#undef RS2
+#undef RETIRE
+#undef JUMP
+#undef FAULT
+#undef LOAD
+#undef STORE
+
+lab_fault:
+    // Unsupported instruction or access outside of RAM, taken by the guest's trap handler if it has one
+    core.pc = pc;
+    if (trap_take(core, cause, tval)) {
+        target = core.pc;
+        goto lab_jump;
+    }
+
+lab_unhandled:
+    // Stops the guest without a trap handler
+    core.pc = pc;
+    exit_code = -1;
+
+lab_stop:
+    for (int i = 1; i < 32; ++i) {
+        core.regs[i] = regs[i];
+    }
+    return false;
+
+lab_leave:
+    for (int i = 1; i < 32; ++i) {
+        core.regs[i] = regs[i];
+    }
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include "rv32core.h"
+
+// Whether translated code can be entered at the pc
+typedef bool (*EntryPredicate)(uint32_t pc);
+
+// Executes the guest from core.pc until control transfers to a pc accepted by `translated`, then returns
+// true with core.pc set to it. Returns false when the guest stops, with the exit code in `exit_code`. The retired
+// instructions are added to core.cyclel/cycleh.
+bool interpret(RV32Core &core, EntryPredicate translated, int &exit_code);
+
+// Drops all predecoded instructions, needed once code in RAM was modified (FENCE.I)
+void interpret_flush();
+
+// Executes the RV32A instruction on the registers, returns false on an access fault or an unknown operation
+bool interpret_amo(RV32Core &core, uint32_t *regs, uint32_t ir);
+
+// Executes the SYSTEM instruction at the pc, a CSR access, MRET, WFI or a trap, and sets core.pc to where the guest
+// continues. Counts the instruction as retired unless it traps. Returns false if a trap has no handler.
+bool interpret_system(RV32Core &core, uint32_t *regs, uint32_t ir, uint32_t pc);
+
+// Executes the load or store on the devices once its address missed the RAM, returns a MmioResult
+int interpret_mmio(RV32Core &core, uint32_t *regs, uint32_t ir);
+
+#endif // INTERPRETER_H
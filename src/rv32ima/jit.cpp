@@ -0,0 +1,675 @@
+#include "jit.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+
+#    include <sys/mman.h>
+
+#    include <cstddef>
+#    include <initializer_list>
+#    include <unordered_map>
+
+#    include "atomics.h"
+#    include "decoder.h"
+#    include "rv32macros.h"
+#    include "traps.h"
+
+// Returned by translated code in rax:rdx
+struct JitResult {
+    uint64_t value; // Next pc, or the exit code for EXIT_SYSCON
+    uint64_t site;  // Jump to patch once the next block is translated, or one of the reasons below
+};
+
+enum ExitReason {
+    EXIT_INDIRECT = 0,
+    EXIT_FAULT = 1,
+    EXIT_SYSCON = 2,
+    EXIT_FENCE_I = 3,
+    EXIT_SYSTEM = 4,
+};
+
+// Saves the callee-saved registers, points rbx at the guest registers and r12 at the guest RAM, then jumps to
+// the block
+typedef JitResult (*EnterFunc)(uint32_t *regs, uint8_t *ram, const uint8_t *code);
+
+static const size_t BUFFER_SIZE = 16 << 20;
+static const size_t BLOCK_RESERVE = 16 << 10; // Upper bound of a single block
+static const int MAX_BLOCK_INSTRUCTIONS = 64;
+
+enum HostReg {
+    EAX = 0,
+    ECX = 1,
+    EDX = 2,
+    ESI = 6,
+    EDI = 7,
+};
+
+// Group 1 opcode extensions of 81 /digit
+enum AluDigit {
+    ALU_ADD = 0,
+    ALU_OR = 1,
+    ALU_AND = 4,
+    ALU_SUB = 5,
+    ALU_XOR = 6,
+    ALU_CMP = 7,
+};
+
+// Shift opcode extensions of C1/D3 /digit
+enum ShiftDigit {
+    SHIFT_SHL = 4,
+    SHIFT_SHR = 5,
+    SHIFT_SAR = 7,
+};
+
+// Condition codes of Jcc/SETcc
+enum Cond {
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_L = 0xc,
+    CC_GE = 0xd,
+};
+
+// Each hart translates into a buffer of its own
+static thread_local uint8_t *buffer = nullptr;
+static thread_local uint8_t *codeBegin = nullptr;
+static thread_local uint8_t *cur = nullptr;
+static thread_local const uint8_t *epilogue = nullptr;
+static thread_local EnterFunc enter = nullptr;
+
+// Translation cache keyed by guest pc, the generation changes whenever it's flushed
+static thread_local std::unordered_map<uint32_t, const uint8_t *> blocks;
+static thread_local uint32_t generation = 0;
+
+// Pc of the block being translated, its exits count the instructions run from there
+static thread_local uint32_t blockStart = 0;
+
+static_assert(offsetof(RV32Core, cycleh) == offsetof(RV32Core, cyclel) + 4, "cycle isn't a 64-bit counter");
+
+static void emit8(uint8_t val) {
+    *cur++ = val;
+}
+
+static void emit32(uint32_t val) {
+    memcpy(cur, &val, 4);
+    cur += 4;
+}
+
+static void emit64(uint64_t val) {
+    memcpy(cur, &val, 8);
+    cur += 8;
+}
+
+static void emitBytes(std::initializer_list<uint8_t> bytes) {
+    for (uint8_t b : bytes) {
+        emit8(b);
+    }
+}
+
+// rbx points to the core, which starts with the guest registers
+static_assert(offsetof(RV32Core, regs) == 0, "The registers aren't at the start of the core");
+
+// mov r32, [rbx + 4 * n]
+static void loadReg(int host, uint32_t n) {
+    if (n == 0) {
+        emitBytes({0x31, (uint8_t) (0xc0 | (host << 3) | host)}); // xor r32, r32
+        return;
+    }
+    emitBytes({0x8b, (uint8_t) (0x83 | (host << 3))});
+    emit32(n * 4);
+}
+
+// mov [rbx + 4 * n], r32
+static void storeReg(uint32_t n, int host) {
+    if (n == 0) {
+        return;
+    }
+    emitBytes({0x89, (uint8_t) (0x83 | (host << 3))});
+    emit32(n * 4);
+}
+
+// mov dword [rbx + 4 * n], imm32
+static void storeImm(uint32_t n, uint32_t imm) {
+    if (n == 0) {
+        return;
+    }
+    emitBytes({0xc7, 0x83});
+    emit32(n * 4);
+    emit32(imm);
+}
+
+// op eax, imm32
+static void aluImm(AluDigit digit, uint32_t imm) {
+    emitBytes({0x81, (uint8_t) (0xc0 | (digit << 3))});
+    emit32(imm);
+}
+
+// op eax, ecx
+static void aluReg(AluDigit digit) {
+    static const uint8_t opcodes[] = {0x01, 0x09, 0, 0, 0x21, 0x29, 0x31, 0x39};
+    emitBytes({opcodes[digit], 0xc8});
+}
+
+// op eax, imm8
+static void shiftImm(ShiftDigit digit, uint32_t imm) {
+    emitBytes({0xc1, (uint8_t) (0xc0 | (digit << 3)), (uint8_t) (imm & 0x1f)});
+}
+
+// op eax, cl
+static void shiftReg(ShiftDigit digit) {
+    emitBytes({0xd3, (uint8_t) (0xc0 | (digit << 3))});
+}
+
+// setcc al; movzx eax, al
+static void setCond(Cond cc) {
+    emitBytes({0x0f, (uint8_t) (0x90 | cc), 0xc0, 0x0f, 0xb6, 0xc0});
+}
+
+static void jumpTo(const uint8_t *target) {
+    emit8(0xe9);
+    emit32((uint32_t) (target - (cur + 4)));
+}
+
+// Jcc rel32 to be bound later, returns the displacement to patch
+static uint8_t *jumpIf(Cond cc) {
+    emitBytes({0x0f, (uint8_t) (0x80 | cc)});
+    emit32(0);
+    return cur - 4;
+}
+
+static void bind(uint8_t *rel) {
+    uint32_t disp = (uint32_t) (cur - (rel + 4));
+    memcpy(rel, &disp, 4);
+}
+
+static void callHelper(const void *func) {
+    emitBytes({0x48, 0xb8}); // mov rax, imm64
+    emit64((uint64_t) func);
+    emitBytes({0xff, 0xd0}); // call rax
+}
+
+// add qword [rbx + cycle], the instructions of the block before `end`
+static void emitRetire(uint32_t end) {
+    uint32_t count = (end - blockStart) / 4;
+    if (count == 0) {
+        return;
+    }
+    emitBytes({0x48, 0x81, 0x83});
+    emit32(offsetof(RV32Core, cyclel));
+    emit32(count);
+}
+
+// Leaves with eax = value, edx = reason
+static void exitWith(uint32_t value, ExitReason reason) {
+    emit8(0xb8);
+    emit32(value);
+    emit8(0xba);
+    emit32(reason);
+    jumpTo(epilogue);
+}
+
+// Leaves for the block at the pc, the jump is patched to go there directly once it's translated
+static void exitTo(uint32_t pc) {
+    emit8(0xb8);
+    emit32(pc);
+    emitBytes({0x48, 0x8d, 0x15, 0, 0, 0, 0}); // lea rdx, [rip], the address of the jump below
+    jumpTo(epilogue);
+}
+
+// Backward jumps leave through jit_run() while interrupts are enabled, so loops of chained blocks are polled too
+static void exitBackward(uint32_t pc) {
+    emitBytes({0xf6, 0x83}); // test byte [rbx + mstatus], MIE
+    emit32(offsetof(RV32Core, mstatus));
+    emit8(0x08);
+    uint8_t *disabled = jumpIf(CC_E);
+    exitWith(pc, EXIT_INDIRECT);
+    bind(disabled);
+    exitTo(pc);
+}
+
+static uint32_t helperDiv(uint32_t rs1, uint32_t rs2) {
+    if (rs2 == 0)
+        return -1;
+    return ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1) ? rs1 : ((int32_t) rs1 / (int32_t) rs2);
+}
+
+static uint32_t helperDivu(uint32_t rs1, uint32_t rs2) {
+    return rs2 == 0 ? 0xffffffff : rs1 / rs2;
+}
+
+static uint32_t helperRem(uint32_t rs1, uint32_t rs2) {
+    if (rs2 == 0)
+        return rs1;
+    return ((int32_t) rs1 == INT32_MIN && (int32_t) rs2 == -1) ? 0 : ((uint32_t) ((int32_t) rs1 % (int32_t) rs2));
+}
+
+static uint32_t helperRemu(uint32_t rs1, uint32_t rs2) {
+    return rs2 == 0 ? rs1 : rs1 % rs2;
+}
+
+static bool init() {
+    void *mem = mmap(nullptr, BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    buffer = (uint8_t *) mem;
+    cur = buffer;
+
+    enter = (EnterFunc) cur;
+    emitBytes({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}); // push rbx, rbp, r12-r15
+    emitBytes({0x48, 0x83, 0xec, 0x08});                                     // sub rsp, 8
+    emitBytes({0x48, 0x89, 0xfb});                                           // mov rbx, rdi
+    emitBytes({0x49, 0x89, 0xf4});                                           // mov r12, rsi
+    emitBytes({0xff, 0xe2});                                                 // jmp rdx
+
+    epilogue = cur;
+    emitBytes({0x48, 0x83, 0xc4, 0x08});                                     // add rsp, 8
+    emitBytes({0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b}); // pop r15-r12, rbp, rbx
+    emit8(0xc3);                                                             // ret
+
+    codeBegin = cur;
+    return true;
+}
+
+void jit_flush() {
+    blocks.clear();
+    ++generation;
+    cur = codeBegin;
+    interpret_flush();
+}
+
+// Computes the guest address into eax as a RAM offset and leaves through `fault` unless it's in RAM
+static void emitAddress(const Instruction &inst, int32_t imm, uint8_t *&outOfRange) {
+    loadReg(EAX, inst.rs1());
+    aluImm(ALU_ADD, imm - MINIRV32_RAM_IMAGE_OFFSET);
+    aluImm(ALU_CMP, ram_amt - 3);
+    outOfRange = jumpIf(CC_AE);
+}
+
+// Leaves the access that missed the RAM to the devices. Continues after it, stops on SYSCON with the stored value or
+// leaves through a fault.
+static void emitMmio(uint32_t pc, const Instruction &inst) {
+    emitBytes({0x48, 0x89, 0xdf}); // mov rdi, rbx
+    emitBytes({0x48, 0x89, 0xde}); // mov rsi, rbx
+    emit8(0xba);                   // mov edx, ir
+    emit32(inst.ir);
+    callHelper((const void *) interpret_mmio);
+    emitBytes({0x85, 0xc0}); // test eax, eax
+    uint8_t *ok = jumpIf(CC_E);
+    aluImm(ALU_CMP, MMIO_STOP);
+    uint8_t *fault = jumpIf(CC_NE);
+    emitRetire(pc + 4);
+    emitBytes({0xc7, 0x83}); // mov dword [rbx + pc], pc, where the guest stopped
+    emit32(offsetof(RV32Core, pc));
+    emit32(pc);
+    loadReg(EAX, inst.rs2());
+    emit8(0xba);
+    emit32(EXIT_SYSCON);
+    jumpTo(epilogue);
+    bind(fault);
+    emitRetire(pc);
+    exitWith(pc, EXIT_FAULT);
+    bind(ok);
+}
+
+// Emits the instruction, returns false if it ends the block
+static bool emitInstruction(uint32_t pc, uint32_t ir) {
+    Instruction inst(ir);
+    uint32_t rd = inst.rd();
+
+    switch (inst.opcode()) {
+        case Instruction::LUI:
+            storeImm(rd, inst.immU());
+            return true;
+        case Instruction::AUIPC:
+            storeImm(rd, pc + inst.immU());
+            return true;
+        case Instruction::JAL:
+            storeImm(rd, pc + 4);
+            emitRetire(pc + 4);
+            if (inst.immJ() <= 0) {
+                exitBackward(pc + inst.immJ());
+            } else {
+                exitTo(pc + inst.immJ());
+            }
+            return false;
+        case Instruction::JALR:
+            emitRetire(pc + 4);
+            loadReg(EAX, inst.rs1());
+            aluImm(ALU_ADD, inst.immI());
+            emitBytes({0x83, 0xe0, 0xfe}); // and eax, -2
+            storeImm(rd, pc + 4);
+            emitBytes({0x31, 0xd2});       // xor edx, edx (EXIT_INDIRECT)
+            jumpTo(epilogue);
+            return false;
+        case Instruction::BRANCH: {
+            // Jump over the taken exit if the condition doesn't hold
+            static const Cond inverse[] = {CC_NE, CC_E, CC_E, CC_E, CC_GE, CC_L, CC_AE, CC_B};
+            emitRetire(pc + 4);
+            loadReg(EAX, inst.rs1());
+            loadReg(ECX, inst.rs2());
+            aluReg(ALU_CMP);
+            uint8_t *skip = jumpIf(inverse[inst.funct3()]);
+            if (inst.immB() <= 0) {
+                exitBackward(pc + inst.immB());
+            } else {
+                exitTo(pc + inst.immB());
+            }
+            bind(skip);
+            exitTo(pc + 4);
+            return false;
+        }
+        case Instruction::LOAD: {
+            uint8_t *outOfRange;
+            emitAddress(inst, inst.immI(), outOfRange);
+            switch (inst.funct3()) {
+                case 0b000:
+                    emitBytes({0x41, 0x0f, 0xbe, 0x0c, 0x04}); // movsx ecx, byte [r12 + rax]
+                    break;
+                case 0b001:
+                    emitBytes({0x41, 0x0f, 0xbf, 0x0c, 0x04}); // movsx ecx, word [r12 + rax]
+                    break;
+                case 0b010:
+                    emitBytes({0x41, 0x8b, 0x0c, 0x04}); // mov ecx, [r12 + rax]
+                    break;
+                case 0b100:
+                    emitBytes({0x41, 0x0f, 0xb6, 0x0c, 0x04}); // movzx ecx, byte [r12 + rax]
+                    break;
+                default:
+                    emitBytes({0x41, 0x0f, 0xb7, 0x0c, 0x04}); // movzx ecx, word [r12 + rax]
+                    break;
+            }
+            storeReg(rd, ECX);
+
+            emit8(0xe9);
+            emit32(0);
+            uint8_t *done = cur - 4;
+            bind(outOfRange);
+            emitMmio(pc, inst);
+            bind(done);
+            return true;
+        }
+        case Instruction::STORE: {
+            uint8_t *outOfRange;
+            emitAddress(inst, inst.immS(), outOfRange);
+            loadReg(ECX, inst.rs2());
+            switch (inst.funct3()) {
+                case 0b000:
+                    emitBytes({0x41, 0x88, 0x0c, 0x04}); // mov [r12 + rax], cl
+                    break;
+                case 0b001:
+                    emitBytes({0x66, 0x41, 0x89, 0x0c, 0x04}); // mov [r12 + rax], cx
+                    break;
+                default:
+                    emitBytes({0x41, 0x89, 0x0c, 0x04}); // mov [r12 + rax], ecx
+                    break;
+            }
+
+            // amo_store(), the call only while some hart holds a reservation
+            emitBytes({0x48, 0xba}); // mov rdx, &amo_reservations
+            emit64((uint64_t) &amo_reservations);
+            emitBytes({0x83, 0x3a, 0x00}); // cmp dword [rdx], 0
+            uint8_t *unreserved = jumpIf(CC_E);
+            emitBytes({0x4c, 0x89, 0xe7}); // mov rdi, r12
+            emitBytes({0x89, 0xc6});       // mov esi, eax
+            emit8(0xba);                   // mov edx, size
+            emit32(1u << inst.funct3());
+            callHelper((const void *) amo_store);
+            bind(unreserved);
+
+            emit8(0xe9);
+            emit32(0);
+            uint8_t *done = cur - 4;
+            bind(outOfRange);
+            emitMmio(pc, inst);
+            bind(done);
+            return true;
+        }
+        case Instruction::OP_IMM: {
+            if (rd == 0) {
+                return true;
+            }
+            uint32_t imm = inst.immI();
+            loadReg(EAX, inst.rs1());
+            switch (inst.funct3()) {
+                case 0b000:
+                    aluImm(ALU_ADD, imm);
+                    break;
+                case 0b001:
+                    shiftImm(SHIFT_SHL, imm);
+                    break;
+                case 0b010:
+                    aluImm(ALU_CMP, imm);
+                    setCond(CC_L);
+                    break;
+                case 0b011:
+                    aluImm(ALU_CMP, imm);
+                    setCond(CC_B);
+                    break;
+                case 0b100:
+                    aluImm(ALU_XOR, imm);
+                    break;
+                case 0b101:
+                    shiftImm((ir >> 30) ? SHIFT_SAR : SHIFT_SHR, imm);
+                    break;
+                case 0b110:
+                    aluImm(ALU_OR, imm);
+                    break;
+                default:
+                    aluImm(ALU_AND, imm);
+                    break;
+            }
+            storeReg(rd, EAX);
+            return true;
+        }
+        case Instruction::OP: {
+            if (rd == 0) {
+                return true;
+            }
+            if ((ir >> 25) == 1) {
+                static const void *const helpers[] = {nullptr, nullptr, nullptr, nullptr,
+                                                      (const void *) helperDiv, (const void *) helperDivu,
+                                                      (const void *) helperRem, (const void *) helperRemu};
+                if (inst.funct3() >= 0b100) {
+                    loadReg(EDI, inst.rs1());
+                    loadReg(ESI, inst.rs2());
+                    callHelper(helpers[inst.funct3()]);
+                    storeReg(rd, EAX);
+                    return true;
+                }
+                loadReg(EAX, inst.rs1());
+                loadReg(ECX, inst.rs2());
+                switch (inst.funct3()) {
+                    case 0b000:
+                        emitBytes({0x0f, 0xaf, 0xc1}); // imul eax, ecx
+                        break;
+                    case 0b001:
+                        emitBytes({0x48, 0x63, 0xc0, 0x48, 0x63, 0xc9}); // movsxd rax, eax; movsxd rcx, ecx
+                        emitBytes({0x48, 0x0f, 0xaf, 0xc1, 0x48, 0xc1, 0xe8, 0x20}); // imul rax, rcx; shr rax, 32
+                        break;
+                    case 0b010:
+                        emitBytes({0x48, 0x63, 0xc0});
+                        emitBytes({0x48, 0x0f, 0xaf, 0xc1, 0x48, 0xc1, 0xe8, 0x20});
+                        break;
+                    default:
+                        emitBytes({0x48, 0x0f, 0xaf, 0xc1, 0x48, 0xc1, 0xe8, 0x20});
+                        break;
+                }
+                storeReg(rd, EAX);
+                return true;
+            }
+
+            loadReg(EAX, inst.rs1());
+            loadReg(ECX, inst.rs2());
+            switch (inst.funct3()) {
+                case 0b000:
+                    aluReg((ir >> 30) ? ALU_SUB : ALU_ADD);
+                    break;
+                case 0b001:
+                    shiftReg(SHIFT_SHL);
+                    break;
+                case 0b010:
+                    aluReg(ALU_CMP);
+                    setCond(CC_L);
+                    break;
+                case 0b011:
+                    aluReg(ALU_CMP);
+                    setCond(CC_B);
+                    break;
+                case 0b100:
+                    aluReg(ALU_XOR);
+                    break;
+                case 0b101:
+                    shiftReg((ir >> 30) ? SHIFT_SAR : SHIFT_SHR);
+                    break;
+                case 0b110:
+                    aluReg(ALU_OR);
+                    break;
+                default:
+                    aluReg(ALU_AND);
+                    break;
+            }
+            storeReg(rd, EAX);
+            return true;
+        }
+        case Instruction::MISC_MEM:
+            if (inst.funct3() == 0b001) {
+                emitRetire(pc + 4);
+                exitWith(pc + 4, EXIT_FENCE_I);
+                return false;
+            }
+            emitBytes({0x0f, 0xae, 0xf0}); // mfence
+            return true;
+        case Instruction::AMO: {
+            emitBytes({0x48, 0x89, 0xdf}); // mov rdi, rbx
+            emitBytes({0x48, 0x89, 0xde}); // mov rsi, rbx
+            emit8(0xba);                   // mov edx, ir
+            emit32(ir);
+            callHelper((const void *) interpret_amo);
+            emitBytes({0x84, 0xc0}); // test al, al
+            uint8_t *done = jumpIf(CC_NE);
+            emitRetire(pc);
+            exitWith(pc, EXIT_FAULT);
+            bind(done);
+            return true;
+        }
+        default:
+            return true;
+    }
+}
+
+static const uint8_t *translate(const uint8_t *image, uint32_t start) {
+    if ((size_t) (buffer + BUFFER_SIZE - cur) < BLOCK_RESERVE) {
+        jit_flush();
+    }
+
+    const uint8_t *code = cur;
+    uint32_t pc = start;
+    blockStart = start;
+    for (int i = 0;; ++i, pc += 4) {
+        uint32_t ofs = pc - MINIRV32_RAM_IMAGE_OFFSET;
+        if (i == MAX_BLOCK_INSTRUCTIONS) {
+            emitRetire(pc);
+            exitTo(pc);
+            break;
+        }
+
+        // SYSTEM instructions run on their own in jit_run()
+        Instruction inst(ofs < ram_amt - 3 && !(pc & 3) ? MINIRV32_LOAD4(ofs) : 0);
+        if (!inst.isValid() || inst.opcode() == Instruction::SYSTEM) {
+            if (i == 0) {
+                exitWith(pc, inst.isValid() ? EXIT_SYSTEM : EXIT_FAULT);
+            } else {
+                emitRetire(pc);
+                exitTo(pc);
+            }
+            break;
+        }
+        if (!emitInstruction(pc, inst.ir)) {
+            break;
+        }
+    }
+
+    blocks[start] = code;
+    return code;
+}
+
+static const uint8_t *lookup(const uint8_t *image, uint32_t pc) {
+    auto it = blocks.find(pc);
+    return it != blocks.end() ? it->second : translate(image, pc);
+}
+
+bool jit_run(RV32Core &core, EntryPredicate translated, int &exit_code) {
+    if (!buffer && !init()) {
+        return interpret(core, translated, exit_code);
+    }
+
+    uint8_t *const image = core.image;
+    uint32_t pc = core.pc;
+    bool first = true;
+    for (;;) {
+        if ((core.mstatus & 8) && !first && interrupt_take(core, pc)) {
+            pc = core.pc;
+        }
+
+        // Translated code takes over at its entries, except where the JIT was asked to start
+        if (!first && translated(pc)) {
+            core.pc = pc;
+            return true;
+        }
+        first = false;
+
+        JitResult res = enter(core.regs, image, lookup(image, pc));
+        switch (res.site) {
+            case EXIT_INDIRECT:
+                pc = res.value;
+                break;
+            case EXIT_FAULT:
+                // The interpreter runs the instruction again and raises the trap
+                core.pc = res.value;
+                return interpret(core, translated, exit_code);
+            case EXIT_SYSTEM:
+                if (!interpret_system(core, core.regs, MINIRV32_LOAD4(res.value - MINIRV32_RAM_IMAGE_OFFSET),
+                                      (uint32_t) res.value)) {
+                    exit_code = -1;
+                    return false;
+                }
+                pc = core.pc;
+                break;
+            case EXIT_SYSCON:
+                exit_code = (int) res.value;
+                return false;
+            case EXIT_FENCE_I:
+                jit_flush();
+                pc = res.value;
+                break;
+            default: {
+                // Chain the exit to the next block unless it leaves for translated code
+                pc = res.value;
+                if (translated(pc)) {
+                    break;
+                }
+                uint32_t current = generation;
+                const uint8_t *next = lookup(image, pc);
+                if (generation == current) {
+                    uint8_t *site = (uint8_t *) res.site;
+                    uint32_t disp = (uint32_t) (next - (site + 5));
+                    memcpy(site + 1, &disp, 4);
+                }
+                break;
+            }
+        }
+    }
+}
+
+#else
+
+bool jit_run(RV32Core &core, EntryPredicate translated, int &exit_code) {
+    return interpret(core, translated, exit_code);
+}
+
+void jit_flush() {
+    interpret_flush();
+}
+
+#endif
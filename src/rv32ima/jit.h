@@ -0,0 +1,13 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "interpreter.h"
+
+// Same contract as interpret(), but translates basic blocks to host machine code on first use. Falls back to the
+// interpreter on hosts other than x86-64.
+bool jit_run(RV32Core &core, EntryPredicate translated, int &exit_code);
+
+// Drops all translated blocks
+void jit_flush();
+
+#endif // JIT_H
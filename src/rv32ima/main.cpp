@@ -1,41 +1,204 @@
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <string>
+#include <string_view>
 #include <iostream>
+#include <thread>
+#include <vector>
 
+#include "batch.h"
+#include "bench.h"
+#include "elf.h"
+#include "ram.h"
 #include "rv32core.h"
 #include "rv32macros.h"
 
 #include "binary_data.h"
 
-uint8_t *image = nullptr;
-
-uint32_t ram_amt = 64 * 1024 * 1024;
-
 extern int run(RV32Core &core);
 
+// Bounded by the mtimecmp registers of the CLINT
+static const int MAX_HARTS = 1024;
+
 static void DumpState(RV32Core *core, uint8_t *ram_image);
 
 static uint64_t GetTimeMicroseconds();
 
-int main(int argc, char *argv[]) {
-    // Allocate image space
-    image = new uint8_t[ram_amt];
-    memcpy(image, binary_data, sizeof(binary_data));
+// Parses a size in bytes with an optional K, M or G suffix, returns 0 if it's invalid
+static uint64_t parseSize(const char *str) {
+    char *end;
+    uint64_t size = strtoull(str, &end, 0);
+    switch (*end) {
+        case 'K':
+        case 'k':
+            size <<= 10, ++end;
+            break;
+        case 'M':
+        case 'm':
+            size <<= 20, ++end;
+            break;
+        case 'G':
+        case 'g':
+            size <<= 30, ++end;
+            break;
+    }
+    return end == str || *end ? 0 : size;
+}
 
-    RV32Core core;
+int main(int argc, char *argv[]) {
+    uint64_t ram_size = ram_amt;
+    bool guard = true;
+    int harts = 1;
+    BatchOptions batch = {};
+    batch.jobs = (int) std::thread::hardware_concurrency();
+    BenchOptions bench = {};
+    bench.warmup = 3;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--ram-size" && i + 1 < argc) {
+            ram_size = parseSize(argv[++i]);
+        } else if (arg == "--no-guard") {
+            guard = false;
+        } else if (arg == "--harts" && i + 1 < argc) {
+            harts = atoi(argv[++i]);
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch.inputs = argv[++i];
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            batch.jobs = atoi(argv[++i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            batch.output = argv[++i];
+        } else if (arg == "--snapshot") {
+            batch.snapshot = true;
+        } else if (arg == "--bench" && i + 1 < argc) {
+            bench.iterations = atoi(argv[++i]);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            bench.warmup = atoi(argv[++i]);
+        } else if (arg == "--json" && i + 1 < argc) {
+            bench.json = argv[++i];
+        } else {
+            std::cout << "Usage: " << argv[0] << " [--ram-size <bytes>[K|M|G]] [--no-guard] [--harts <n>]"
+                      << std::endl;
+            std::cout << "       " << argv[0]
+                      << " --batch <directory or manifest> [--jobs <n>] [--output <directory>] [--snapshot] "
+                         "[--ram-size <bytes>[K|M|G]] [--no-guard]"
+                      << std::endl;
+            std::cout << "       " << argv[0]
+                      << " --bench <iterations> [--warmup <n>] [--json <file or ->] [--ram-size <bytes>[K|M|G]] "
+                         "[--no-guard]"
+                      << std::endl;
+            std::cout << "RAM starts at 0x80000000 and defaults to 64M, pages are allocated once the guest uses them"
+                      << std::endl;
+            std::cout << "Translated code doesn't check addresses, accesses outside of RAM stop the guest unless "
+                         "--no-guard drops the inaccessible pages around it"
+                      << std::endl;
+            std::cout << "All harts start at the entry with their mhartid in a0, each on its own thread. The guest "
+                         "stops with hart 0"
+                      << std::endl;
+            std::cout << "A batch runs an instance per input file on n threads, all hardware threads by default. "
+                         "The input is placed at the end of RAM with its address in a1 and its size in a2, UART "
+                         "output goes to <input name>.out in the output directory"
+                      << std::endl;
+            std::cout << "With --snapshot the guest runs without input until it writes to SNAPSHOT at 0x11100004, "
+                         "then each instance resumes after that store from a copy-on-write snapshot of the RAM"
+                      << std::endl;
+            std::cout << "A benchmark runs the guest from the start after 3 warm-up runs by default, resetting its RAM "
+                         "in between and discarding its UART output. It reports the minimum, median and 99th "
+                         "percentile time, the guest instructions and host counters per run"
+                      << std::endl;
+            return -1;
+        }
+    }
+    if (harts < 1 || harts > MAX_HARTS || (harts > 1 && (!batch.inputs.empty() || bench.iterations))) {
+        std::cerr << "Invalid number of harts." << std::endl;
+        return -1;
+    }
+    if (bench.iterations < 0 || bench.warmup < 0 || (bench.iterations && !batch.inputs.empty())) {
+        std::cerr << "Invalid benchmark options." << std::endl;
+        return -1;
+    }
+    // The RAM ends at the top of the address space at most
+    if (ram_size < 4 || ram_size > 0x100000000ull - MINIRV32_RAM_IMAGE_OFFSET) {
+        std::cerr << "Invalid RAM size." << std::endl;
+        return -1;
+    }
+    ram_amt = (uint32_t) ram_size;
+
+    // Executables are laid out by their segments like the expander did, raw images are mapped as they are
+    std::string_view file((const char *) binary_data, binary_data_size);
+    ElfFile elf;
+    if (ElfFile::isElf(file)) {
+        if (!elf.load(file, MINIRV32_RAM_IMAGE_OFFSET) || elf.content().size() > ram_amt) {
+            std::cerr << "Executable doesn't fit into RAM." << std::endl;
+            return -1;
+        }
+        file = elf.content();
+    }
+    if (!batch.inputs.empty()) {
+        batch.guard = guard;
+        return batch_run(run, file, batch);
+    }
+    if (bench.iterations) {
+        bench.guard = guard;
+        return bench_run(run, file, bench);
+    }
+
+    GuestRam ram = {};
+    if (!ram_allocate(ram, guard)) {
+        std::cerr << "Failed to allocate RAM." << std::endl;
+        return -1;
+    }
+    ram_load(ram, file.data(), file.size());
+
+    std::vector<RV32Core> cores(harts);
+    for (int i = 0; i < harts; ++i) {
+        cores[i].hartid = i;
+        cores[i].regs[10] = i;
+        cores[i].image = ram.image;
+    }
 
     auto time1 = GetTimeMicroseconds();
-    int ret = run(core);
+
+    // The other harts run until they stop on their own or hart 0 stops the guest
+    for (int i = 1; i < harts; ++i) {
+        std::thread([&ram, &core = cores[i]]() {
+            int ret = 0;
+            uint32_t fault = 0;
+            if (!ram_run(ram, run, core, ret, fault)) {
+                mmio_flush();
+                printf("Hart %u: access fault at %08x\n", core.hartid, fault);
+            }
+        }).detach();
+    }
+
+    RV32Core &core = cores[0];
+    int ret = 0;
+    uint32_t fault = 0;
+    bool finished = ram_run(ram, run, core, ret, fault);
     auto time2 = GetTimeMicroseconds();
+    mmio_flush();
 
-    std::cout << ret << std::endl;
+    if (finished) {
+        std::cout << ret << std::endl;
+    } else {
+        printf("Access fault at %08x\n", fault);
+    }
 
-    // Remove image
-    delete[] image;
+    DumpState(&core, ram.image);
+    std::cout << "timeout: " << time2 - time1 << std::endl;
 
-    DumpState(&core, image);
+    // A guest stopped by an access outside of RAM fails the process
+    int status = finished ? 0 : EXIT_FAILURE;
 
-    std::cout << "timeout: " << time2 - time1 << std::endl;
-    return 0;
+    // Harts still running own the RAM until the process ends
+    if (harts > 1) {
+        fflush(stdout);
+        _Exit(status);
+    }
+
+    // Remove image
+    ram_release(ram);
+    return status;
 }
 
 static void DumpState(RV32Core *core, uint8_t *ram_image) {
@@ -60,30 +223,8 @@ static void DumpState(RV32Core *core, uint8_t *ram_image) {
            regs[27], regs[28], regs[29], regs[30], regs[31]);
 }
 
-#if defined(WINDOWS) || defined(WIN32) || defined(_WIN32)
-
-#    include <conio.h>
-#    include <windows.h>
-
-uint64_t GetTimeMicroseconds() {
-    static LARGE_INTEGER lpf;
-    LARGE_INTEGER li;
-
-    if (!lpf.QuadPart)
-        QueryPerformanceFrequency(&lpf);
-
-    QueryPerformanceCounter(&li);
-    return ((uint64_t) li.QuadPart * 1000000LL) / (uint64_t) lpf.QuadPart;
-}
-
-#else
-
-#    include <sys/time.h>
-
+// Monotonic, unlike the time of day
 static uint64_t GetTimeMicroseconds() {
-    struct timeval tv;
-    gettimeofday(&tv, 0);
-    return tv.tv_usec + ((uint64_t) (tv.tv_sec)) * 1000000LL;
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(now).count();
 }
-
-#endif
\ No newline at end of file
@@ -0,0 +1,261 @@
+#include "ram.h"
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "atomics.h"
+#include "rv32macros.h"
+
+#if defined(_WIN32)
+#    include <windows.h>
+#else
+#    include <csetjmp>
+#    include <csignal>
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <unistd.h>
+#endif
+
+uint32_t ram_amt = 64 * 1024 * 1024;
+
+std::atomic<uint32_t> amo_versions[RESERVATION_VERSIONS];
+std::atomic<uint32_t> amo_reservations(0);
+
+#if defined(__linux__)
+// Finds the file and offset backing the address among the mappings of the process
+static bool locate(uintptr_t addr, std::string &path, off_t &offset) {
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (!maps) {
+        return false;
+    }
+    bool found = false;
+    char line[4096];
+    while (!found && fgets(line, sizeof(line), maps)) {
+        unsigned long begin, end, ofs;
+        int name = 0;
+        if (sscanf(line, "%lx-%lx %*s %lx %*s %*s %n", &begin, &end, &ofs, &name) < 3 || !name || addr < begin ||
+            addr >= end || line[name] != '/') {
+            continue;
+        }
+        path.assign(line + name, strcspn(line + name, "\n"));
+        offset = ofs + (addr - begin);
+        found = true;
+    }
+    fclose(maps);
+    return found;
+}
+
+// Maps the whole pages of the data over the start of RAM, returns the number of bytes mapped
+static size_t mapFile(uint8_t *image, const void *data, size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t length = size & ~(page - 1);
+    std::string path;
+    off_t offset;
+    if (!length || ((uintptr_t) data & (page - 1)) || !locate((uintptr_t) data, path, offset)) {
+        return 0;
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    void *res = mmap(image, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset);
+    close(fd);
+    return res == MAP_FAILED ? 0 : length;
+}
+#else
+static size_t mapFile(uint8_t *, const void *, size_t) {
+    return 0;
+}
+#endif
+
+#if !defined(_WIN32) && UINTPTR_MAX > 0xffffffffu
+#    define RAM_GUARD_SUPPORTED
+#endif
+
+#if defined(RAM_GUARD_SUPPORTED)
+// Any RAM offset plus the widest access
+static const size_t WINDOW_SIZE = (1ull << 32) + 4096;
+
+// Per hart, the signal is delivered to the thread that faulted
+static thread_local sigjmp_buf *faultJump = nullptr;
+static thread_local const GuestRam *faultRam = nullptr;
+static thread_local uint32_t faultAddress = 0;
+
+static void onFault(int sig, siginfo_t *info, void *) {
+    uintptr_t addr = (uintptr_t) info->si_addr;
+    uintptr_t image = faultRam ? (uintptr_t) faultRam->image : 0;
+    if (faultJump && addr >= image && addr - image < faultRam->reserved) {
+        faultAddress = (uint32_t) (addr - image) + MINIRV32_RAM_IMAGE_OFFSET;
+        siglongjmp(*faultJump, 1);
+    }
+    // Not the guest's, crash on return like without the handler
+    signal(sig, SIG_DFL);
+}
+
+static bool allocateGuarded(GuestRam &ram, uint32_t size) {
+    void *res = mmap(nullptr, WINDOW_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (res == MAP_FAILED) {
+        return false;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    if (mprotect(res, (size + page - 1) & ~(page - 1), PROT_READ | PROT_WRITE) != 0) {
+        munmap(res, WINDOW_SIZE);
+        return false;
+    }
+
+    struct sigaction action = {};
+    action.sa_sigaction = onFault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, nullptr);
+    sigaction(SIGBUS, &action, nullptr);
+
+    ram.image = (uint8_t *) res;
+    ram.reserved = WINDOW_SIZE;
+    return true;
+}
+#endif
+
+bool ram_allocate(GuestRam &ram, bool guard) {
+    uint32_t size = ram_amt;
+#if defined(RAM_GUARD_SUPPORTED)
+    if (guard && allocateGuarded(ram, size)) {
+        return true;
+    }
+#endif
+    ram.reserved = size;
+#if defined(_WIN32)
+    ram.image = (uint8_t *) VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void *res = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    ram.image = res == MAP_FAILED ? nullptr : (uint8_t *) res;
+#endif
+    return ram.image != nullptr;
+}
+
+bool ram_guarded(const GuestRam &ram) {
+    return ram.reserved > ram_amt;
+}
+
+bool ram_run(const GuestRam &ram, int (*run)(RV32Core &), RV32Core &core, int &exit_code, uint32_t &address) {
+#if defined(RAM_GUARD_SUPPORTED)
+    sigjmp_buf jump;
+    if (sigsetjmp(jump, 1)) {
+        faultJump = nullptr;
+        address = faultAddress;
+        amo_release(core);
+        return false;
+    }
+    faultRam = &ram;
+    faultJump = &jump;
+    exit_code = run(core);
+    faultJump = nullptr;
+#else
+    exit_code = run(core);
+#endif
+    amo_release(core);
+    return true;
+}
+
+void ram_load(GuestRam &ram, const void *data, size_t size) {
+    if (size > ram_amt) {
+        size = ram_amt;
+    }
+    size_t mapped = mapFile(ram.image, data, size);
+    memcpy(ram.image + mapped, (const uint8_t *) data + mapped, size - mapped);
+}
+
+void ram_release(GuestRam &ram) {
+    if (!ram.image) {
+        return;
+    }
+#if defined(_WIN32)
+    VirtualFree(ram.image, 0, MEM_RELEASE);
+#else
+    munmap(ram.image, ram.reserved);
+#endif
+    ram.image = nullptr;
+}
+
+#if defined(__linux__)
+#    define RAM_SNAPSHOT_MAPPED
+
+// The RAM in whole pages, the mapping always covers them
+static size_t mappedSize() {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return ((size_t) ram_amt + page - 1) & ~(page - 1);
+}
+
+static bool isZero(const uint8_t *data, size_t size) {
+    const uint64_t *words = (const uint64_t *) data;
+    for (size_t i = 0; i < size / 8; ++i) {
+        if (words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Writes the pages with data to a memory file, the others stay holes reading as zeros
+static int snapshotFile(const uint8_t *image) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = mappedSize();
+    int fd = memfd_create("rv32ima-snapshot", MFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    bool ok = ftruncate(fd, (off_t) size) == 0;
+    for (size_t ofs = 0; ok && ofs < size; ofs += page) {
+        if (!isZero(image + ofs, page)) {
+            ok = pwrite(fd, image + ofs, page, (off_t) ofs) == (ssize_t) page;
+        }
+    }
+    if (!ok) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+#endif
+
+bool ram_snapshot(const GuestRam &ram, RamSnapshot &snapshot) {
+    snapshot.copy = nullptr;
+#if defined(RAM_SNAPSHOT_MAPPED)
+    snapshot.fd = snapshotFile(ram.image);
+    if (snapshot.fd >= 0) {
+        return true;
+    }
+#else
+    snapshot.fd = -1;
+#endif
+    snapshot.copy = new (std::nothrow) uint8_t[ram_amt];
+    if (!snapshot.copy) {
+        return false;
+    }
+    memcpy(snapshot.copy, ram.image, ram_amt);
+    return true;
+}
+
+bool ram_restore(GuestRam &ram, const RamSnapshot &snapshot) {
+#if defined(RAM_SNAPSHOT_MAPPED)
+    if (snapshot.fd >= 0) {
+        void *res = mmap(ram.image, mappedSize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, snapshot.fd, 0);
+        return res != MAP_FAILED;
+    }
+#endif
+    memcpy(ram.image, snapshot.copy, ram_amt);
+    return true;
+}
+
+void ram_snapshot_release(RamSnapshot &snapshot) {
+#if defined(RAM_SNAPSHOT_MAPPED)
+    if (snapshot.fd >= 0) {
+        close(snapshot.fd);
+    }
+#endif
+    delete[] snapshot.copy;
+    snapshot.fd = -1;
+    snapshot.copy = nullptr;
+}
@@ -0,0 +1,49 @@
+#ifndef RAM_H
+#define RAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "rv32core.h"
+
+// RAM of one guest, shared by its harts
+struct GuestRam {
+    uint8_t *image;
+    size_t reserved; // Bytes reserved from the image, the whole window reachable through a 32 bit offset when guarded
+};
+
+// Reserves ram_amt bytes of zeroed guest RAM. Pages are only allocated once the guest touches them. With `guard` on
+// 64 bit POSIX hosts the RAM starts a 4 GB window of otherwise inaccessible pages, so any 32 bit offset from the
+// image faults instead of reaching host memory.
+bool ram_allocate(GuestRam &ram, bool guard);
+
+// Whether the RAM is guarded, false if the host couldn't reserve the window
+bool ram_guarded(const GuestRam &ram);
+
+// Calls run() on the hart of the guest and returns true with its result. Returns false with the guest address if the
+// guard caught an access outside of RAM, leaving the registers of the translated code unsaved. Harts of the same or
+// other guests may run on other threads at the same time.
+bool ram_run(const GuestRam &ram, int (*run)(RV32Core &), RV32Core &core, int &exit_code, uint32_t &address);
+
+// Places the bytes at the start of RAM. Whole pages of a page aligned file mapping, like the embedded binary, are
+// mapped copy-on-write instead of copied.
+void ram_load(GuestRam &ram, const void *data, size_t size);
+
+void ram_release(GuestRam &ram);
+
+// Contents of a guest's RAM to reset it to, the pages in a memory file on Linux and a copy elsewhere
+struct RamSnapshot {
+    int fd;
+    uint8_t *copy;
+};
+
+// Takes a snapshot of the RAM, its pages of zeros take no memory
+bool ram_snapshot(const GuestRam &ram, RamSnapshot &snapshot);
+
+// Resets the RAM to the snapshot. On Linux the snapshot is mapped over it copy-on-write, which only drops the pages
+// modified since and copies them again once they're written, instead of copying the whole RAM.
+bool ram_restore(GuestRam &ram, const RamSnapshot &snapshot);
+
+void ram_snapshot_release(RamSnapshot &snapshot);
+
+#endif // RAM_H
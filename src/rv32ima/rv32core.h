@@ -33,9 +33,31 @@ struct RV32Core {
     // Bit 3 = Load/Store has a reservation.
     uint32_t extraflags;
 
+    // RAM offset, value and granule version of the LR.W reservation
+    uint32_t reservation;
+    uint32_t reservedValue;
+    uint32_t reservedVersion;
+
+    // mhartid, the index of the hart among those sharing the RAM
+    uint32_t hartid;
+
+    // Guest calls the translation runs as nested host calls
+    uint32_t depth;
+
+    // Start of the guest's RAM, the harts of a guest share it
+    uint8_t *image;
+
     RV32Core() {
         memset(this, 0, sizeof(RV32Core));
+        extraflags = 3; // Starts in machine mode
     }
 };
 
+// cycle counts retired instructions like instret, the halves are added to as one 64-bit counter
+static inline void core_retire(RV32Core &core, uint32_t count) {
+    uint64_t cycle = (((uint64_t) core.cycleh << 32) | core.cyclel) + count;
+    core.cyclel = (uint32_t) cycle;
+    core.cycleh = (uint32_t) (cycle >> 32);
+}
+
 #endif // RV32CORE_H
@@ -3,17 +3,23 @@
 
 #include <stdint.h>
 
-extern uint8_t *image;
+#include "devices.h"
 
+// Size of the RAM of all guests
 extern uint32_t ram_amt;
 
 #ifndef MINIRV32_CUSTOM_MEMORY_BUS
-#    define MINIRV32_STORE4(ofs, val) *(uint32_t *) (image + ofs) = val
-#    define MINIRV32_STORE2(ofs, val) *(uint16_t *) (image + ofs) = val
-#    define MINIRV32_STORE1(ofs, val) *(uint8_t *) (image + ofs) = val
-#    define MINIRV32_LOAD4(ofs)       *(uint32_t *) (image + ofs)
-#    define MINIRV32_LOAD2(ofs)       *(uint16_t *) (image + ofs)
-#    define MINIRV32_LOAD1(ofs)       *(uint8_t *) (image + ofs)
+// Relative to the `image` in scope, a local taken from RV32Core::image
+#    define MINIRV32_STORE4(ofs, val) *(uint32_t *) (image + (ofs)) = val
+#    define MINIRV32_STORE2(ofs, val) *(uint16_t *) (image + (ofs)) = val
+#    define MINIRV32_STORE1(ofs, val) *(uint8_t *) (image + (ofs)) = val
+#    define MINIRV32_LOAD4(ofs)       *(uint32_t *) (image + (ofs))
+#    define MINIRV32_LOAD2(ofs)       *(uint16_t *) (image + (ofs))
+#    define MINIRV32_LOAD1(ofs)       *(uint8_t *) (image + (ofs))
+
+// Devices, only reached by accesses that missed the RAM. Both return a MmioResult.
+#    define MINIRV32_HANDLE_MEM_STORE_CONTROL(core, addy, val) mmio_store(core, addy, val)
+#    define MINIRV32_HANDLE_MEM_LOAD_CONTROL(core, addy, rval) mmio_load(core, addy, rval)
 #endif
 
 #define MINI_RV32_RAM_SIZE ram_amt
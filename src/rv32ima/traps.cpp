@@ -0,0 +1,178 @@
+#include "traps.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "devices.h"
+#include "rv32macros.h"
+
+static const uint32_t MSTATUS_MIE = 0x8;
+static const uint32_t MSTATUS_MPIE = 0x80;
+static const uint32_t MIP_MTIP = 0x80;
+
+// Reading the clock costs more than the polls, the timer is only read again after this many
+static const int TIMER_POLLS = 256;
+static thread_local int timerCountdown = 0;
+
+// Longest WFI sleep in microseconds
+static const uint64_t MAX_WAIT = 10000;
+
+static uint64_t timerMatch(const RV32Core &core) {
+    return ((uint64_t) core.timermatchh << 32) | core.timermatchl;
+}
+
+// The timer interrupt is pending while mtime is at or past mtimecmp, by the last time read
+static void updatePending(RV32Core &core) {
+    uint64_t now = ((uint64_t) core.timerh << 32) | core.timerl;
+    uint64_t match = timerMatch(core);
+    if (match && now >= match) {
+        core.mip |= MIP_MTIP;
+    } else {
+        core.mip &= ~MIP_MTIP;
+    }
+}
+
+uint32_t csr_access(RV32Core &core, uint32_t ir, uint32_t src) {
+    uint32_t csrno = ir >> 20;
+    uint32_t *csr = nullptr;
+    uint32_t rval = 0;
+    switch (csrno) {
+        case 0x300: // mstatus
+            csr = &core.mstatus;
+            break;
+        case 0x304: // mie
+            csr = &core.mie;
+            break;
+        case 0x305: // mtvec
+            csr = &core.mtvec;
+            break;
+        case 0x340: // mscratch
+            csr = &core.mscratch;
+            break;
+        case 0x341: // mepc
+            csr = &core.mepc;
+            break;
+        case 0x342: // mcause
+            csr = &core.mcause;
+            break;
+        case 0x343: // mtval
+            csr = &core.mtval;
+            break;
+        case 0x344: // mip
+            updatePending(core);
+            csr = &core.mip;
+            break;
+        case 0xb00: // mcycle
+        case 0xb02: // minstret
+            csr = &core.cyclel;
+            break;
+        case 0xb80: // mcycleh
+        case 0xb82: // minstreth
+            csr = &core.cycleh;
+            break;
+        case 0xc00: // cycle
+        case 0xc02: // instret
+            rval = core.cyclel;
+            break;
+        case 0xc80: // cycleh
+        case 0xc82: // instreth
+            rval = core.cycleh;
+            break;
+        case 0xc01: // time
+            rval = (uint32_t) mmio_timer(core);
+            break;
+        case 0xc81: // timeh
+            rval = (uint32_t) (mmio_timer(core) >> 32);
+            break;
+        case 0x301: // misa, XLEN=32, IMA+X
+            rval = 0x40401101;
+            break;
+        case 0xf11: // mvendorid
+            rval = 0xff0ff0ff;
+            break;
+        case 0xf14: // mhartid
+            rval = core.hartid;
+            break;
+        default:
+            break;
+    }
+    if (!csr) {
+        return rval;
+    }
+
+    rval = *csr;
+    switch ((ir >> 12) & 3) {
+        case 0b01: // CSRRW, CSRRWI
+            *csr = src;
+            break;
+        case 0b10: // CSRRS, CSRRSI
+            *csr = rval | src;
+            break;
+        case 0b11: // CSRRC, CSRRCI
+            *csr = rval & ~src;
+            break;
+    }
+    return rval;
+}
+
+bool trap_take(RV32Core &core, uint32_t cause, uint32_t tval) {
+    uint32_t base = core.mtvec & ~3u;
+    if (base - MINIRV32_RAM_IMAGE_OFFSET >= ram_amt) {
+        return false;
+    }
+    core.mepc = core.pc;
+    core.mcause = cause;
+    core.mtval = tval;
+
+    // MPIE = MIE, MPP = privilege, MIE = 0, then machine mode
+    core.mstatus = ((core.mstatus & MSTATUS_MIE) << 4) | ((core.extraflags & 3) << 11);
+    core.extraflags |= 3;
+
+    // Vectored mode only applies to interrupts
+    core.pc = ((cause & 0x80000000) && (core.mtvec & 1)) ? base + 4 * (cause & 0x7fffffff) : base;
+    return true;
+}
+
+uint32_t trap_return(RV32Core &core) {
+    // MIE = MPIE, MPIE = 1, back to the privilege in MPP
+    uint32_t mstatus = core.mstatus;
+    uint32_t extraflags = core.extraflags;
+    core.mstatus = ((mstatus & MSTATUS_MPIE) >> 4) | ((extraflags & 3) << 11) | MSTATUS_MPIE;
+    core.extraflags = (extraflags & ~3u) | ((mstatus >> 11) & 3);
+    return core.mepc;
+}
+
+void trap_wait(RV32Core &core) {
+    // The guest is idle, whatever it printed is complete
+    mmio_flush();
+
+    // Nothing else raises interrupts, without the timer WFI doesn't wait
+    uint64_t match = timerMatch(core);
+    timerCountdown = 0;
+    if (!(core.mie & MIP_MTIP) || !match) {
+        return;
+    }
+    uint64_t now = mmio_timer(core);
+    if (now < match) {
+        std::this_thread::sleep_for(std::chrono::microseconds(std::min(match - now, MAX_WAIT)));
+        mmio_timer(core);
+    }
+    updatePending(core);
+}
+
+bool interrupt_take(RV32Core &core, uint32_t pc) {
+    if (!(core.mstatus & MSTATUS_MIE) || !(core.mie & MIP_MTIP)) {
+        return false;
+    }
+    if (--timerCountdown <= 0) {
+        timerCountdown = TIMER_POLLS;
+        mmio_timer(core);
+    }
+    updatePending(core);
+    if (!(core.mip & MIP_MTIP)) {
+        return false;
+    }
+    core.pc = pc;
+    return trap_take(core, TRAP_TIMER_INTERRUPT, 0);
+}
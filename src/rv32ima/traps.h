@@ -0,0 +1,39 @@
+#ifndef TRAPS_H
+#define TRAPS_H
+
+#include <cstdint>
+
+#include "rv32core.h"
+
+// mcause values, interrupts have the top bit set
+enum TrapCause : uint32_t {
+    TRAP_FETCH_MISALIGNED = 0,
+    TRAP_FETCH_FAULT = 1,
+    TRAP_ILLEGAL_INSTRUCTION = 2,
+    TRAP_BREAKPOINT = 3,
+    TRAP_LOAD_FAULT = 5,
+    TRAP_STORE_FAULT = 7,
+    TRAP_ECALL_U = 8,
+    TRAP_ECALL_M = 11,
+    TRAP_TIMER_INTERRUPT = 0x80000007,
+};
+
+// Executes the Zicsr instruction with `src`, the value of rs1 or the immediate, and returns the old value of the
+// CSR. Unknown CSRs read as zero and ignore writes like in mini-rv32ima.
+uint32_t csr_access(RV32Core &core, uint32_t ir, uint32_t src);
+
+// Enters the trap handler at mtvec for the exception or interrupt at core.pc, which goes to mepc. Returns false if
+// mtvec doesn't point into RAM, the guest has no handler and stops instead.
+bool trap_take(RV32Core &core, uint32_t cause, uint32_t tval);
+
+// MRET, returns the pc to continue at
+uint32_t trap_return(RV32Core &core);
+
+// WFI, sleeps until the timer interrupt is due, but only for a while so the devices are checked again
+void trap_wait(RV32Core &core);
+
+// Polled at block boundaries once mstatus.MIE is set. Enters the handler of a pending timer interrupt with `pc` as
+// the instruction to resume at, returns true with core.pc at the handler.
+bool interrupt_take(RV32Core &core, uint32_t pc);
+
+#endif // TRAPS_H
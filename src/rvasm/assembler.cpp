@@ -0,0 +1,925 @@
+#include "assembler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+static const char *const ABI_NAMES[] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0",  "a1",  "a2", "a3", "a4", "a5",
+    "a6",   "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+static const std::map<std::string, uint32_t> CSR_NAMES = {
+    {"mstatus", 0x300},  {"misa", 0x301},      {"mie", 0x304},      {"mtvec", 0x305},     {"mscratch", 0x340},
+    {"mepc", 0x341},     {"mcause", 0x342},    {"mtval", 0x343},    {"mip", 0x344},       {"mcycle", 0xb00},
+    {"minstret", 0xb02}, {"mcycleh", 0xb80},   {"minstreth", 0xb82}, {"cycle", 0xc00},    {"time", 0xc01},
+    {"instret", 0xc02},  {"cycleh", 0xc80},    {"timeh", 0xc81},    {"instreth", 0xc82},  {"mvendorid", 0xf11},
+    {"mhartid", 0xf14},
+};
+
+// Encoding of the base instructions, pseudo-instructions are rewritten to these
+struct OpInfo {
+    char format; // R, I, H (shift), L (load), S, B, U, J, C (CSR), K (CSR immediate), A (atomic)
+    uint32_t opcode;
+    uint32_t funct3;
+    uint32_t funct7;
+};
+
+static const std::map<std::string, OpInfo> OPS = {
+    {"add", {'R', 0x33, 0, 0x00}},     {"sub", {'R', 0x33, 0, 0x20}},     {"sll", {'R', 0x33, 1, 0x00}},
+    {"slt", {'R', 0x33, 2, 0x00}},     {"sltu", {'R', 0x33, 3, 0x00}},    {"xor", {'R', 0x33, 4, 0x00}},
+    {"srl", {'R', 0x33, 5, 0x00}},     {"sra", {'R', 0x33, 5, 0x20}},     {"or", {'R', 0x33, 6, 0x00}},
+    {"and", {'R', 0x33, 7, 0x00}},     {"mul", {'R', 0x33, 0, 0x01}},     {"mulh", {'R', 0x33, 1, 0x01}},
+    {"mulhsu", {'R', 0x33, 2, 0x01}},  {"mulhu", {'R', 0x33, 3, 0x01}},   {"div", {'R', 0x33, 4, 0x01}},
+    {"divu", {'R', 0x33, 5, 0x01}},    {"rem", {'R', 0x33, 6, 0x01}},     {"remu", {'R', 0x33, 7, 0x01}},
+    {"addi", {'I', 0x13, 0, 0}},       {"slti", {'I', 0x13, 2, 0}},       {"sltiu", {'I', 0x13, 3, 0}},
+    {"xori", {'I', 0x13, 4, 0}},       {"ori", {'I', 0x13, 6, 0}},        {"andi", {'I', 0x13, 7, 0}},
+    {"slli", {'H', 0x13, 1, 0x00}},    {"srli", {'H', 0x13, 5, 0x00}},    {"srai", {'H', 0x13, 5, 0x20}},
+    {"lb", {'L', 0x03, 0, 0}},         {"lh", {'L', 0x03, 1, 0}},         {"lw", {'L', 0x03, 2, 0}},
+    {"lbu", {'L', 0x03, 4, 0}},        {"lhu", {'L', 0x03, 5, 0}},        {"sb", {'S', 0x23, 0, 0}},
+    {"sh", {'S', 0x23, 1, 0}},         {"sw", {'S', 0x23, 2, 0}},         {"beq", {'B', 0x63, 0, 0}},
+    {"bne", {'B', 0x63, 1, 0}},        {"blt", {'B', 0x63, 4, 0}},        {"bge", {'B', 0x63, 5, 0}},
+    {"bltu", {'B', 0x63, 6, 0}},       {"bgeu", {'B', 0x63, 7, 0}},       {"lui", {'U', 0x37, 0, 0}},
+    {"auipc", {'U', 0x17, 0, 0}},      {"jal", {'J', 0x6f, 0, 0}},        {"jalr", {'I', 0x67, 0, 0}},
+    {"csrrw", {'C', 0x73, 1, 0}},      {"csrrs", {'C', 0x73, 2, 0}},      {"csrrc", {'C', 0x73, 3, 0}},
+    {"csrrwi", {'K', 0x73, 5, 0}},     {"csrrsi", {'K', 0x73, 6, 0}},     {"csrrci", {'K', 0x73, 7, 0}},
+    {"lr.w", {'A', 0x2f, 2, 0x02}},    {"sc.w", {'A', 0x2f, 2, 0x03}},    {"amoswap.w", {'A', 0x2f, 2, 0x01}},
+    {"amoadd.w", {'A', 0x2f, 2, 0x00}}, {"amoxor.w", {'A', 0x2f, 2, 0x04}}, {"amoand.w", {'A', 0x2f, 2, 0x0c}},
+    {"amoor.w", {'A', 0x2f, 2, 0x08}}, {"amomin.w", {'A', 0x2f, 2, 0x10}}, {"amomax.w", {'A', 0x2f, 2, 0x14}},
+    {"amominu.w", {'A', 0x2f, 2, 0x18}}, {"amomaxu.w", {'A', 0x2f, 2, 0x1c}},
+};
+
+// Instructions without operands
+static const std::map<std::string, uint32_t> FIXED = {
+    {"ecall", 0x00000073}, {"ebreak", 0x00100073}, {"mret", 0x30200073},
+    {"wfi", 0x10500073},   {"fence.i", 0x0000100f}, {"nop", 0x00000013},
+};
+
+// Pseudo-instructions standing for a single instruction. The operands are given ones for a to c, z for zero, r for ra,
+// m for -1 and digits for themselves.
+struct Pseudo {
+    const char *op;
+    const char *operands;
+};
+
+static const std::map<std::string, Pseudo> PSEUDOS = {
+    {"mv", {"addi", "ab0"}},      {"not", {"xori", "abm"}},     {"neg", {"sub", "azb"}},
+    {"seqz", {"sltiu", "ab1"}},   {"snez", {"sltu", "azb"}},    {"sltz", {"slt", "abz"}},
+    {"sgtz", {"slt", "azb"}},     {"beqz", {"beq", "azb"}},     {"bnez", {"bne", "azb"}},
+    {"blez", {"bge", "zab"}},     {"bgez", {"bge", "azb"}},     {"bltz", {"blt", "azb"}},
+    {"bgtz", {"blt", "zab"}},     {"bgt", {"blt", "bac"}},      {"ble", {"bge", "bac"}},
+    {"bgtu", {"bltu", "bac"}},    {"bleu", {"bgeu", "bac"}},    {"j", {"jal", "za"}},
+    {"call", {"jal", "ra"}},      {"tail", {"jal", "za"}},      {"csrr", {"csrrs", "abz"}},
+    {"csrw", {"csrrw", "zab"}},   {"csrs", {"csrrs", "zab"}},   {"csrc", {"csrrc", "zab"}},
+    {"csrwi", {"csrrwi", "zab"}}, {"csrsi", {"csrrsi", "zab"}}, {"csrci", {"csrrci", "zab"}},
+};
+
+// Directives without an effect on the flat image
+static const char *const IGNORED[] = {
+    ".text", ".data", ".rodata", ".bss", ".section", ".globl", ".global", ".local", ".type", ".size", ".option",
+    ".file", ".ident", ".attribute",
+};
+
+static std::string trim(const std::string &str) {
+    size_t begin = 0, end = str.size();
+    while (begin < end && isspace((unsigned char) str[begin])) {
+        ++begin;
+    }
+    while (end > begin && isspace((unsigned char) str[end - 1])) {
+        --end;
+    }
+    return str.substr(begin, end - begin);
+}
+
+static bool isSymbolChar(char c, bool first) {
+    return isalpha((unsigned char) c) || c == '_' || c == '.' || c == '$' || (!first && isdigit((unsigned char) c));
+}
+
+// Skips the string or character literal starting at `i`, returns the index after it
+static size_t skipLiteral(const std::string &str, size_t i) {
+    char quote = str[i++];
+    while (i < str.size() && str[i] != quote) {
+        i += str[i] == '\\' ? 2 : 1;
+    }
+    return i + 1;
+}
+
+static std::string stripComment(const std::string &line) {
+    for (size_t i = 0; i < line.size();) {
+        if (line[i] == '"' || line[i] == '\'') {
+            i = skipLiteral(line, i);
+        } else if (line[i] == '#' || (line[i] == '/' && i + 1 < line.size() && line[i + 1] == '/')) {
+            return line.substr(0, i);
+        } else {
+            ++i;
+        }
+    }
+    return line;
+}
+
+// Operands separated by commas outside of literals and parentheses
+static std::vector<std::string> splitArgs(const std::string &str) {
+    std::vector<std::string> args;
+    int depth = 0;
+    size_t start = 0;
+    for (size_t i = 0; i < str.size();) {
+        char c = str[i];
+        if (c == '"' || c == '\'') {
+            i = skipLiteral(str, i);
+            continue;
+        }
+        if (c == '(') {
+            ++depth;
+        } else if (c == ')') {
+            --depth;
+        } else if (c == ',' && depth == 0) {
+            args.push_back(trim(str.substr(start, i - start)));
+            start = i + 1;
+        }
+        ++i;
+    }
+    std::string last = trim(str.substr(std::min(start, str.size())));
+    if (!last.empty() || !args.empty()) {
+        args.push_back(last);
+    }
+    return args;
+}
+
+static bool unescape(char c, char &out) {
+    switch (c) {
+        case 'n':
+            out = '\n';
+            return true;
+        case 't':
+            out = '\t';
+            return true;
+        case 'r':
+            out = '\r';
+            return true;
+        case '0':
+            out = '\0';
+            return true;
+        case '\\':
+        case '\'':
+        case '"':
+            out = c;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool parseString(const std::string &arg, std::string &out) {
+    if (arg.size() < 2 || arg.front() != '"' || arg.back() != '"') {
+        return false;
+    }
+    out.clear();
+    for (size_t i = 1; i + 1 < arg.size(); ++i) {
+        char c = arg[i];
+        if (c == '\\' && (i + 2 >= arg.size() || !unescape(arg[++i], c))) {
+            return false;
+        }
+        out += c;
+    }
+    return true;
+}
+
+static int32_t hi20(int64_t val) {
+    return (int32_t) ((((uint32_t) val + 0x800) >> 12) & 0xfffff);
+}
+
+static int32_t lo12(int64_t val) {
+    return (int32_t) ((uint32_t) val << 20) >> 20;
+}
+
+static bool fits12(int64_t val) {
+    return val >= -2048 && val < 2048;
+}
+
+// Recursive descent over C operator precedence, without the comparisons
+class ExprParser {
+public:
+    ExprParser(const std::string &str, const std::map<std::string, int64_t> &symbols, uint32_t pc)
+        : str(str), symbols(symbols), pc(pc), pos(0), unknown(false), invalid(false) {
+    }
+
+    bool parse(int64_t &value) {
+        value = parseOr();
+        skipSpace();
+        if (pos != str.size()) {
+            invalid = true;
+        }
+        return !invalid;
+    }
+
+    bool hasUnknown() const {
+        return unknown;
+    }
+
+private:
+    const std::string &str;
+    const std::map<std::string, int64_t> &symbols;
+    uint32_t pc;
+    size_t pos;
+    bool unknown;
+    bool invalid;
+
+    void skipSpace() {
+        while (pos < str.size() && isspace((unsigned char) str[pos])) {
+            ++pos;
+        }
+    }
+
+    bool accept(const char *token) {
+        skipSpace();
+        size_t n = strlen(token);
+        if (str.compare(pos, n, token) != 0) {
+            return false;
+        }
+        // << and >> aren't < and >, which aren't operators here anyway
+        pos += n;
+        return true;
+    }
+
+    int64_t parseOr() {
+        int64_t val = parseXor();
+        while (accept("|")) {
+            val |= parseXor();
+        }
+        return val;
+    }
+
+    int64_t parseXor() {
+        int64_t val = parseAnd();
+        while (accept("^")) {
+            val ^= parseAnd();
+        }
+        return val;
+    }
+
+    int64_t parseAnd() {
+        int64_t val = parseShift();
+        while (accept("&")) {
+            val &= parseShift();
+        }
+        return val;
+    }
+
+    int64_t parseShift() {
+        int64_t val = parseAdd();
+        for (;;) {
+            if (accept("<<")) {
+                val = (int64_t) ((uint64_t) val << (parseAdd() & 63));
+            } else if (accept(">>")) {
+                val >>= parseAdd() & 63;
+            } else {
+                return val;
+            }
+        }
+    }
+
+    int64_t parseAdd() {
+        int64_t val = parseMul();
+        for (;;) {
+            if (accept("+")) {
+                val += parseMul();
+            } else if (accept("-")) {
+                val -= parseMul();
+            } else {
+                return val;
+            }
+        }
+    }
+
+    int64_t parseMul() {
+        int64_t val = parseUnary();
+        for (;;) {
+            if (accept("*")) {
+                val *= parseUnary();
+            } else if (accept("/") || accept("%")) {
+                char op = str[pos - 1];
+                int64_t rhs = parseUnary();
+                if (rhs == 0) {
+                    // Unknown symbols evaluate to zero, the expression is computed again once they're known
+                    invalid = invalid || !unknown;
+                    return 0;
+                }
+                val = op == '/' ? val / rhs : val % rhs;
+            } else {
+                return val;
+            }
+        }
+    }
+
+    int64_t parseUnary() {
+        if (accept("-")) {
+            return -parseUnary();
+        }
+        if (accept("+")) {
+            return parseUnary();
+        }
+        if (accept("~")) {
+            return ~parseUnary();
+        }
+        return parsePrimary();
+    }
+
+    int64_t parsePrimary() {
+        skipSpace();
+        if (accept("%hi(") || accept("%lo(")) {
+            bool hi = str[pos - 3] == 'h';
+            int64_t val = parseOr();
+            if (!accept(")")) {
+                invalid = true;
+            }
+            return hi ? hi20(val) : lo12(val);
+        }
+        if (accept("(")) {
+            int64_t val = parseOr();
+            if (!accept(")")) {
+                invalid = true;
+            }
+            return val;
+        }
+        if (pos >= str.size()) {
+            invalid = true;
+            return 0;
+        }
+
+        char c = str[pos];
+        if (c == '\'') {
+            // Character literal
+            if (pos + 2 < str.size() && str[pos + 1] == '\\') {
+                char out;
+                if (pos + 3 < str.size() && unescape(str[pos + 2], out) && str[pos + 3] == '\'') {
+                    pos += 4;
+                    return (unsigned char) out;
+                }
+            } else if (pos + 2 < str.size() && str[pos + 2] == '\'') {
+                pos += 3;
+                return (unsigned char) str[pos - 2];
+            }
+            invalid = true;
+            return 0;
+        }
+        if (isdigit((unsigned char) c)) {
+            uint64_t val = 0;
+            size_t end = pos;
+            if (str.compare(pos, 2, "0b") == 0 || str.compare(pos, 2, "0B") == 0) {
+                end += 2;
+                while (end < str.size() && (str[end] == '0' || str[end] == '1')) {
+                    val = val * 2 + (str[end++] - '0');
+                }
+            } else {
+                char *stop;
+                val = strtoull(str.c_str() + pos, &stop, 0);
+                end = stop - str.c_str();
+            }
+            if (end < str.size() && isSymbolChar(str[end], false)) {
+                invalid = true;
+            }
+            pos = end;
+            return (int64_t) val;
+        }
+        if (isSymbolChar(c, true)) {
+            size_t end = pos + 1;
+            while (end < str.size() && isSymbolChar(str[end], false)) {
+                ++end;
+            }
+            std::string name = str.substr(pos, end - pos);
+            pos = end;
+            if (name == ".") {
+                return pc;
+            }
+            auto it = symbols.find(name);
+            if (it == symbols.end()) {
+                unknown = true;
+                return 0;
+            }
+            return it->second;
+        }
+        invalid = true;
+        return 0;
+    }
+};
+
+Assembler::Assembler(uint32_t base) : base(base), line(0) {
+}
+
+bool Assembler::fail(const std::string &msg) {
+    message = name + ":" + std::to_string(line) + ": " + msg;
+    return false;
+}
+
+bool Assembler::assemble(const std::string &source, const std::string &name) {
+    this->name = name;
+    statements.clear();
+    symbols.clear();
+    bytes.clear();
+    return parse(source) && layout() && emit();
+}
+
+bool Assembler::parse(const std::string &source) {
+    size_t pos = 0;
+    line = 0;
+    while (pos <= source.size()) {
+        size_t end = source.find('\n', pos);
+        if (end == std::string::npos) {
+            end = source.size();
+        }
+        std::string text = trim(stripComment(source.substr(pos, end - pos)));
+        pos = end + 1;
+        ++line;
+
+        // Labels in front of the statement, each is a statement of its own without an operation
+        for (;;) {
+            size_t i = 0;
+            while (i < text.size() && isSymbolChar(text[i], i == 0)) {
+                ++i;
+            }
+            if (i == 0 || i >= text.size() || text[i] != ':') {
+                break;
+            }
+            statements.push_back({line, "", {text.substr(0, i)}, 0, 0});
+            text = trim(text.substr(i + 1));
+        }
+        if (text.empty()) {
+            continue;
+        }
+
+        size_t split = 0;
+        while (split < text.size() && !isspace((unsigned char) text[split])) {
+            ++split;
+        }
+        std::string op = text.substr(0, split);
+        for (char &c : op) {
+            c = (char) tolower((unsigned char) c);
+        }
+        statements.push_back({line, op, splitArgs(trim(text.substr(split))), 0, 0});
+    }
+    return true;
+}
+
+bool Assembler::layout() {
+    uint64_t pc = base;
+    for (auto &st : statements) {
+        line = st.line;
+        st.address = (uint32_t) pc;
+        if (st.op.empty()) {
+            if (!symbols.emplace(st.args[0], pc).second) {
+                return fail("symbol " + st.args[0] + " is already defined");
+            }
+            continue;
+        }
+        if (!sizeOf(st, (uint32_t) pc, st.size)) {
+            return false;
+        }
+        pc += st.size;
+        if (pc > 0x100000000ull) {
+            return fail("the image doesn't fit into the address space");
+        }
+    }
+    bytes.assign((size_t) (pc - base), 0);
+    return true;
+}
+
+bool Assembler::emit() {
+    for (const auto &st : statements) {
+        line = st.line;
+        if (st.op.empty()) {
+            continue;
+        }
+        if (st.op[0] == '.') {
+            if (!data(st)) {
+                return false;
+            }
+            continue;
+        }
+        std::vector<uint32_t> words;
+        if (!encode(st, words)) {
+            return false;
+        }
+        if (words.size() * 4 != st.size) {
+            return fail("the size of " + st.op + " changed between the passes");
+        }
+        put(st.address, words.data(), words.size() * 4);
+    }
+    return true;
+}
+
+bool Assembler::evaluate(const std::string &expr, uint32_t pc, int64_t &value, bool partial, bool *known) {
+    ExprParser parser(expr, symbols, pc);
+    bool valid = parser.parse(value);
+    if (known) {
+        *known = valid && !parser.hasUnknown();
+    }
+    if (!valid) {
+        return fail("invalid expression " + expr);
+    }
+    if (parser.hasUnknown() && !partial) {
+        return fail("undefined symbol in " + expr);
+    }
+    return true;
+}
+
+bool Assembler::reg(const std::string &arg, uint32_t &n) {
+    for (n = 0; n < 32; ++n) {
+        if (arg == ABI_NAMES[n] || arg == "x" + std::to_string(n)) {
+            return true;
+        }
+    }
+    if (arg == "fp") {
+        n = 8;
+        return true;
+    }
+    return fail("invalid register " + arg);
+}
+
+bool Assembler::csr(const std::string &arg, uint32_t pc, uint32_t &n) {
+    auto it = CSR_NAMES.find(arg);
+    if (it != CSR_NAMES.end()) {
+        n = it->second;
+        return true;
+    }
+    int64_t val;
+    if (!immediate(arg, pc, 0, 0xfff, val)) {
+        return false;
+    }
+    n = (uint32_t) val;
+    return true;
+}
+
+bool Assembler::memory(const std::string &arg, uint32_t pc, int64_t &offset, uint32_t &rs1) {
+    size_t open = arg.rfind('(');
+    if (open == std::string::npos || arg.back() != ')') {
+        return fail("expected offset(register) instead of " + arg);
+    }
+    std::string ofs = trim(arg.substr(0, open));
+    offset = 0;
+    if (!ofs.empty() && !immediate(ofs, pc, -2048, 2047, offset)) {
+        return false;
+    }
+    return reg(trim(arg.substr(open + 1, arg.size() - open - 2)), rs1);
+}
+
+bool Assembler::immediate(const std::string &arg, uint32_t pc, int64_t min, int64_t max, int64_t &value) {
+    if (!evaluate(arg, pc, value)) {
+        return false;
+    }
+    if (value < min || value > max) {
+        std::string number = std::to_string(value);
+        return fail("immediate " + (arg == number ? arg : arg + " = " + number) + " is out of range");
+    }
+    return true;
+}
+
+bool Assembler::sizeOf(const Statement &st, uint32_t pc, uint32_t &size) {
+    const std::string &op = st.op;
+    size_t count = st.args.size();
+    size = 0;
+    if (op[0] != '.') {
+        if (op == "la") {
+            size = 8;
+        } else if (op == "li" && count == 2) {
+            // Constants known by now that fit into a single instruction take one
+            int64_t val;
+            bool known;
+            if (!evaluate(st.args[1], pc, val, true, &known)) {
+                return false;
+            }
+            size = known && (fits12(val) || !((uint32_t) val & 0xfff)) ? 4 : 8;
+        } else {
+            size = 4;
+        }
+        return true;
+    }
+
+    if (op == ".byte") {
+        size = (uint32_t) count;
+    } else if (op == ".half" || op == ".2byte" || op == ".short") {
+        size = (uint32_t) count * 2;
+    } else if (op == ".word" || op == ".4byte" || op == ".long") {
+        size = (uint32_t) count * 4;
+    } else if (op == ".zero" || op == ".space" || op == ".skip") {
+        int64_t val;
+        if (count < 1 || count > 2) {
+            return fail(op + " takes a size and an optional fill byte");
+        }
+        if (!immediate(st.args[0], pc, 0, 0xffffffffll, val)) {
+            return false;
+        }
+        size = (uint32_t) val;
+    } else if (op == ".ascii" || op == ".asciz" || op == ".string") {
+        for (const auto &arg : st.args) {
+            std::string str;
+            if (!parseString(arg, str)) {
+                return fail("invalid string " + arg);
+            }
+            size += (uint32_t) str.size() + (op == ".ascii" ? 0 : 1);
+        }
+    } else if (op == ".align" || op == ".p2align" || op == ".balign") {
+        int64_t val;
+        if (count < 1) {
+            return fail(op + " takes an alignment");
+        }
+        if (!immediate(st.args[0], pc, 0, op == ".balign" ? 4096 : 12, val)) {
+            return false;
+        }
+        uint32_t align = op == ".balign" ? (uint32_t) val : 1u << val;
+        if (align == 0 || (align & (align - 1))) {
+            return fail("alignment " + st.args[0] + " isn't a power of two");
+        }
+        size = (0u - pc) & (align - 1);
+    } else if (op == ".equ" || op == ".set") {
+        int64_t val;
+        if (count != 2) {
+            return fail(op + " takes a name and a value");
+        }
+        if (!evaluate(st.args[1], pc, val)) {
+            return false;
+        }
+        symbols[st.args[0]] = val;
+    } else if (std::find(std::begin(IGNORED), std::end(IGNORED), op) == std::end(IGNORED)) {
+        return fail("unknown directive " + op);
+    }
+    return true;
+}
+
+bool Assembler::data(const Statement &st) {
+    const std::string &op = st.op;
+    uint32_t address = st.address;
+    if (st.size == 0) {
+        return true;
+    }
+    if (op == ".byte" || op == ".half" || op == ".2byte" || op == ".short" || op == ".word" || op == ".4byte" ||
+        op == ".long") {
+        uint32_t width = st.size / (uint32_t) st.args.size();
+        int64_t min = -(1ll << (width * 8 - 1)), max = (1ll << (width * 8)) - 1;
+        for (const auto &arg : st.args) {
+            int64_t val;
+            if (!immediate(arg, address, min, max, val)) {
+                return false;
+            }
+            uint32_t word = (uint32_t) val;
+            put(address, &word, width);
+            address += width;
+        }
+    } else if (op == ".zero" || op == ".space" || op == ".skip") {
+        int64_t fill = 0;
+        if (st.args.size() == 2 && !immediate(st.args[1], address, -128, 255, fill)) {
+            return false;
+        }
+        std::vector<uint8_t> block(st.size, (uint8_t) fill);
+        put(address, block.data(), block.size());
+    } else if (op == ".ascii" || op == ".asciz" || op == ".string") {
+        for (const auto &arg : st.args) {
+            std::string str;
+            parseString(arg, str);
+            if (op != ".ascii") {
+                str += '\0';
+            }
+            put(address, str.data(), str.size());
+            address += (uint32_t) str.size();
+        }
+    } else if (op == ".align" || op == ".p2align" || op == ".balign") {
+        // Padding of whole words is filled with NOPs like the GNU assembler does in code
+        uint32_t nop = FIXED.at("nop");
+        for (uint32_t ofs = 0; !(address & 3) && ofs < st.size; ofs += 4) {
+            put(address + ofs, &nop, 4);
+        }
+    }
+    return true;
+}
+
+static uint32_t encodeR(const OpInfo &info, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return (info.funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (info.funct3 << 12) | (rd << 7) | info.opcode;
+}
+
+static uint32_t encodeI(const OpInfo &info, uint32_t rd, uint32_t rs1, int64_t imm) {
+    return (((uint32_t) imm & 0xfff) << 20) | (rs1 << 15) | (info.funct3 << 12) | (rd << 7) | info.opcode;
+}
+
+static uint32_t encodeS(const OpInfo &info, uint32_t rs1, uint32_t rs2, int64_t imm) {
+    uint32_t val = (uint32_t) imm;
+    return (((val >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) | (info.funct3 << 12) | ((val & 0x1f) << 7) |
+           info.opcode;
+}
+
+static uint32_t encodeB(const OpInfo &info, uint32_t rs1, uint32_t rs2, int64_t offset) {
+    uint32_t val = (uint32_t) offset;
+    return (((val >> 12) & 1) << 31) | (((val >> 5) & 0x3f) << 25) | (rs2 << 20) | (rs1 << 15) |
+           (info.funct3 << 12) | (((val >> 1) & 0xf) << 8) | (((val >> 11) & 1) << 7) | info.opcode;
+}
+
+static uint32_t encodeU(const OpInfo &info, uint32_t rd, int64_t imm) {
+    return (((uint32_t) imm & 0xfffff) << 12) | (rd << 7) | info.opcode;
+}
+
+static uint32_t encodeJ(uint32_t rd, int64_t offset) {
+    uint32_t val = (uint32_t) offset;
+    return (((val >> 20) & 1) << 31) | (((val >> 1) & 0x3ff) << 21) | (((val >> 11) & 1) << 20) |
+           (((val >> 12) & 0xff) << 12) | (rd << 7) | 0x6f;
+}
+
+bool Assembler::encode(const Statement &st, std::vector<uint32_t> &words) {
+    std::string op = st.op;
+    std::vector<std::string> args = st.args;
+    uint32_t pc = st.address;
+    size_t count = args.size();
+    auto arity = [&](size_t n) {
+        return count == n || fail(op + " takes " + std::to_string(n) + " operands");
+    };
+
+    auto fixed = FIXED.find(op);
+    if (fixed != FIXED.end() && count == 0) {
+        words.push_back(fixed->second);
+        return true;
+    }
+    if (op == "fence") {
+        // Only the full fence, the runtimes order all accesses anyway
+        words.push_back(0x0ff0000f);
+        return true;
+    }
+
+    // Pseudo-instructions with constants
+    if (op == "li" || op == "la") {
+        uint32_t rd;
+        int64_t val;
+        if (!arity(2) || !reg(args[0], rd) || !evaluate(args[1], pc, val)) {
+            return false;
+        }
+        if (val < INT32_MIN || val > UINT32_MAX) {
+            return fail("constant " + args[1] + " doesn't fit into 32 bits");
+        }
+        if (op == "la") {
+            val -= pc;
+            words.push_back(encodeU(OPS.at("auipc"), rd, hi20(val)));
+            words.push_back(encodeI(OPS.at("addi"), rd, rd, lo12(val)));
+        } else if (st.size == 4 && fits12(val)) {
+            words.push_back(encodeI(OPS.at("addi"), rd, 0, val));
+        } else if (st.size == 4) {
+            words.push_back(encodeU(OPS.at("lui"), rd, (uint32_t) val >> 12));
+        } else {
+            words.push_back(encodeU(OPS.at("lui"), rd, hi20(val)));
+            words.push_back(encodeI(OPS.at("addi"), rd, rd, lo12(val)));
+        }
+        return true;
+    }
+
+    // Other pseudo-instructions are rewritten to the instruction they stand for
+    if (op == "jal" && count == 1) {
+        op = "call";
+    } else if (op == "jalr" && count == 1) {
+        args = {"ra", args[0].find('(') == std::string::npos ? "0(" + args[0] + ")" : args[0]};
+        count = 2;
+    } else if (op == "jr" && arity(1)) {
+        op = "jalr";
+        args = {"zero", "0(" + args[0] + ")"};
+        count = 2;
+    } else if (op == "ret" && arity(0)) {
+        op = "jalr";
+        args = {"zero", "0(ra)"};
+        count = 2;
+    } else if (op == "jr" || op == "ret") {
+        return false;
+    }
+    auto pseudo = PSEUDOS.find(op);
+    if (pseudo != PSEUDOS.end()) {
+        std::vector<std::string> operands;
+        size_t used = 0;
+        for (const char *c = pseudo->second.operands; *c; ++c) {
+            if (*c >= 'a' && *c <= 'c') {
+                used = std::max(used, (size_t) (*c - 'a' + 1));
+                operands.push_back(*c - 'a' < (int) count ? args[*c - 'a'] : "");
+            } else {
+                operands.push_back(*c == 'z' ? "zero" : (*c == 'r' ? "ra" : (*c == 'm' ? "-1" : std::string(1, *c))));
+            }
+        }
+        if (!arity(used)) {
+            return false;
+        }
+        op = pseudo->second.op;
+        args = operands;
+        count = args.size();
+    }
+
+    // Ordering bits of the atomics
+    uint32_t ordering = 0;
+    static const std::pair<const char *, uint32_t> suffixes[] = {{".aqrl", 3}, {".aq", 2}, {".rl", 1}};
+    for (const auto &suffix : suffixes) {
+        size_t n = strlen(suffix.first);
+        if (op.size() > n && op.compare(op.size() - n, n, suffix.first) == 0) {
+            ordering = suffix.second;
+            op.resize(op.size() - n);
+            break;
+        }
+    }
+
+    auto it = OPS.find(op);
+    if (it == OPS.end()) {
+        return fail("unknown instruction " + st.op);
+    }
+    OpInfo info = it->second;
+    if (ordering && info.format != 'A') {
+        return fail("unknown instruction " + st.op);
+    }
+
+    uint32_t rd = 0, rs1 = 0, rs2 = 0;
+    int64_t imm = 0;
+    switch (info.format) {
+        case 'R':
+            if (!arity(3) || !reg(args[0], rd) || !reg(args[1], rs1) || !reg(args[2], rs2)) {
+                return false;
+            }
+            words.push_back(encodeR(info, rd, rs1, rs2));
+            return true;
+        case 'I':
+            if (op == "jalr" && count == 2) {
+                if (!reg(args[0], rd) || !memory(args[1], pc, imm, rs1)) {
+                    return false;
+                }
+            } else if (!arity(3) || !reg(args[0], rd) || !reg(args[1], rs1) ||
+                       !immediate(args[2], pc, -2048, 2047, imm)) {
+                return false;
+            }
+            words.push_back(encodeI(info, rd, rs1, imm));
+            return true;
+        case 'H':
+            if (!arity(3) || !reg(args[0], rd) || !reg(args[1], rs1) || !immediate(args[2], pc, 0, 31, imm)) {
+                return false;
+            }
+            words.push_back(encodeI(info, rd, rs1, imm | (info.funct7 << 5)));
+            return true;
+        case 'L':
+            if (!arity(2) || !reg(args[0], rd) || !memory(args[1], pc, imm, rs1)) {
+                return false;
+            }
+            words.push_back(encodeI(info, rd, rs1, imm));
+            return true;
+        case 'S':
+            if (!arity(2) || !reg(args[0], rs2) || !memory(args[1], pc, imm, rs1)) {
+                return false;
+            }
+            words.push_back(encodeS(info, rs1, rs2, imm));
+            return true;
+        case 'B':
+            if (!arity(3) || !reg(args[0], rs1) || !reg(args[1], rs2) || !evaluate(args[2], pc, imm)) {
+                return false;
+            }
+            imm -= pc;
+            if (imm < -4096 || imm > 4094 || (imm & 1)) {
+                return fail("branch target " + args[2] + " is out of range");
+            }
+            words.push_back(encodeB(info, rs1, rs2, imm));
+            return true;
+        case 'U':
+            if (!arity(2) || !reg(args[0], rd) || !immediate(args[1], pc, -0x80000, 0xfffff, imm)) {
+                return false;
+            }
+            words.push_back(encodeU(info, rd, imm));
+            return true;
+        case 'J':
+            if (!arity(2) || !reg(args[0], rd) || !evaluate(args[1], pc, imm)) {
+                return false;
+            }
+            imm -= pc;
+            if (imm < -(1 << 20) || imm >= (1 << 20) || (imm & 1)) {
+                return fail("jump target " + args[1] + " is out of range");
+            }
+            words.push_back(encodeJ(rd, imm));
+            return true;
+        case 'C':
+        case 'K': {
+            uint32_t n;
+            if (!arity(3) || !reg(args[0], rd) || !csr(args[1], pc, n)) {
+                return false;
+            }
+            if (info.format == 'C' ? !reg(args[2], rs1) : !immediate(args[2], pc, 0, 31, imm)) {
+                return false;
+            }
+            words.push_back(encodeI(info, rd, info.format == 'C' ? rs1 : (uint32_t) imm, n));
+            return true;
+        }
+        case 'A': {
+            // lr.w rd, (rs1); sc.w and the AMOs rd, rs2, (rs1)
+            bool lr = op == "lr.w";
+            if (!arity(lr ? 2 : 3) || !reg(args[0], rd) || (!lr && !reg(args[1], rs2)) ||
+                !memory(args[lr ? 1 : 2], pc, imm, rs1)) {
+                return false;
+            }
+            if (imm) {
+                return fail("atomics take no offset");
+            }
+            info.funct7 = (info.funct7 << 2) | ordering;
+            words.push_back(encodeR(info, rd, rs1, rs2));
+            return true;
+        }
+        default:
+            return fail("unknown instruction " + st.op);
+    }
+}
+
+void Assembler::put(uint32_t address, const void *src, size_t size) {
+    memcpy(bytes.data() + (address - base), src, size);
+}
@@ -0,0 +1,68 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Two pass assembler of RV32IMA with Zicsr into a flat image loaded at `base`. Understands the GNU assembler syntax
+// the benchmark kernels use: labels, expressions with %hi and %lo, the common pseudo-instructions and the data
+// directives. Sections are laid out in the order they appear.
+class Assembler {
+public:
+    explicit Assembler(uint32_t base);
+
+    // Returns false on the first error, described by error() with the line it's on
+    bool assemble(const std::string &source, const std::string &name);
+
+    const std::vector<uint8_t> &image() const {
+        return bytes;
+    }
+
+    const std::string &error() const {
+        return message;
+    }
+
+private:
+    struct Statement {
+        int line;
+        std::string op;
+        std::vector<std::string> args;
+        uint32_t address;
+        uint32_t size;
+    };
+
+    uint32_t base;
+    std::string name;
+    std::vector<Statement> statements;
+    std::map<std::string, int64_t> symbols;
+    std::vector<uint8_t> bytes;
+    std::string message;
+
+    // Statement being assembled, for the error message
+    int line;
+
+    bool fail(const std::string &msg);
+
+    bool parse(const std::string &source);
+    bool layout();
+    bool emit();
+
+    // Evaluates the expression with `.` at `pc`. Fails on unknown symbols unless `partial` is set, then `known`
+    // tells whether the value could be computed.
+    bool evaluate(const std::string &expr, uint32_t pc, int64_t &value, bool partial = false, bool *known = nullptr);
+
+    bool reg(const std::string &arg, uint32_t &n);
+    bool csr(const std::string &arg, uint32_t pc, uint32_t &n);
+    bool memory(const std::string &arg, uint32_t pc, int64_t &offset, uint32_t &rs1);
+    bool immediate(const std::string &arg, uint32_t pc, int64_t min, int64_t max, int64_t &value);
+
+    bool sizeOf(const Statement &st, uint32_t pc, uint32_t &size);
+    bool encode(const Statement &st, std::vector<uint32_t> &words);
+    bool data(const Statement &st);
+
+    void put(uint32_t address, const void *src, size_t size);
+};
+
+#endif // ASSEMBLER_H
@@ -0,0 +1,54 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#include "assembler.h"
+
+int main(int argc, char *argv[]) {
+    uint32_t base = 0x80000000;
+    std::string input, output;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--base" && i + 1 < argc) {
+            base = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (input.empty()) {
+            input = argv[i];
+        } else if (output.empty()) {
+            output = argv[i];
+        } else {
+            input.clear();
+            break;
+        }
+    }
+    if (input.empty() || output.empty()) {
+        std::cerr << "Usage: " << argv[0] << " <input.s> <output.bin> [--base <address>]" << std::endl;
+        std::cerr << "Assembles RV32IMA with Zicsr into a flat image loaded at the base address, 0x80000000 by "
+                     "default, the start of the guest's RAM"
+                  << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(input, std::ios::binary);
+    if (!in) {
+        std::cerr << "Error: Could not open input file " << input << std::endl;
+        return 1;
+    }
+    std::string source((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    Assembler assembler(base);
+    if (!assembler.assemble(source, input)) {
+        std::cerr << assembler.error() << std::endl;
+        return 1;
+    }
+
+    std::ofstream out(output, std::ios::binary);
+    const auto &image = assembler.image();
+    if (!out.write((const char *) image.data(), (std::streamsize) image.size())) {
+        std::cerr << "Error: Could not write output file " << output << std::endl;
+        return 1;
+    }
+    return 0;
+}